@@ -0,0 +1,497 @@
+// Microbenchmarks of the framework, one JSON object per line on stdout:
+//   ./build/HTTPSimple_bench [--filter=<substring>] [--min-time=<ms>]
+// Run it from the root of the repository (the file response reads
+// example/logo.jpg).
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "HTTPSimple.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Access to the internals of the framework that have no public entry
+ * point
+ *
+ */
+struct BenchAccess {
+  static bool Parse(HttpRequest& request, BufferChain& remaining,
+                    EventLoop* const event_loop, const int& fd) {
+    return request.parse(remaining, event_loop, fd);
+  }
+
+  static bool SendRequest(HttpResponse& response,
+                          EventLoop* const event_loop,
+                          const HttpStatusCode& status, const int& fd) {
+    return response.SendRequest(event_loop, status, fd);
+  }
+
+  // the lookup done by the router for every request
+  static bool Lookup(const Router& router, const HttpRequest& request) {
+    auto controller_key = request.path;
+    controller_key.push_back(static_cast<char>(request.method));
+    return router.controllers_.find(controller_key) !=
+           router.controllers_.end();
+  }
+};
+
+/**
+ * @brief An event loop reading from memory, in chunks of at most chunk_size
+ * bytes (like TCP segments), and discarding what is sent
+ *
+ */
+class MemoryEventLoop : public EventLoop {
+ public:
+  using EventLoop::Send;
+
+  MemoryEventLoop(Server* const server) : EventLoop(server, 0) {}
+
+  void Reset(const std::string* const input, const size_t& chunk_size) {
+    input_ = input;
+    offset_ = 0;
+    chunk_size_ = chunk_size;
+  }
+
+  bool Accept(const int&) override { return false; }
+  bool Add(const int&) override { return true; }
+
+  ssize_t Recv(const int&, void* buffer, const size_t& size) override {
+    if (offset_ == input_->size()) {
+      errno = EAGAIN;
+      return -1;
+    }
+    const size_t recv_cnt =
+        std::min({size, chunk_size_, input_->size() - offset_});
+    memcpy(buffer, input_->data() + offset_, recv_cnt);
+    offset_ += recv_cnt;
+    return recv_cnt;
+  }
+
+  bool Send(const int&, const std::shared_ptr<const std::string>&,
+            const bool&) override {
+    return true;
+  }
+
+  void Close(const int&) override {}
+  void ResumeWhenReady(const int&, Waiter* const) override {}
+
+ protected:
+  void Run() override {}
+  void Wake() override {}
+
+ private:
+  const std::string* input_ = nullptr;
+  size_t offset_ = 0;
+  size_t chunk_size_ = 0;
+};
+
+class Bench {
+ public:
+  // runs the benchmark for the given number of iterations, returns the number
+  // of operations done
+  using Body = std::function<uint64_t(const uint64_t& iterations)>;
+  using Fields = std::vector<std::pair<std::string, double>>;
+
+  Bench(const std::string& filter, const std::chrono::milliseconds& min_time)
+      : filter_(filter), min_time_(min_time) {}
+
+  bool IsSelected(const std::string& name) const {
+    return name.find(filter_) != std::string::npos;
+  }
+
+  /**
+   * @brief Run a benchmark with more and more iterations until it lasts
+   * min_time, then print the time per operation
+   *
+   * @param name the name of the benchmark
+   * @param body the benchmark
+   * @param fields extra fields computed once it is done
+   */
+  void Run(const std::string& name, const Body& body,
+           const std::function<Fields(const uint64_t& ops,
+                                      const double& seconds)>& fields =
+               nullptr) {
+    if (!IsSelected(name)) return;
+    body(1);  // warm up
+    uint64_t iterations = 1;
+    for (;;) {
+      const auto begin = Clock::now();
+      const uint64_t ops = body(iterations);
+      const auto elapsed = Clock::now() - begin;
+      if (elapsed >= min_time_ || iterations >= (uint64_t(1) << 40)) {
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        Print(name, ops, seconds, fields ? fields(ops, seconds) : Fields());
+        return;
+      }
+      // aim a bit past min_time from what was seen
+      const double ratio = std::chrono::duration<double>(min_time_).count() /
+                           std::max(std::chrono::duration<double>(elapsed)
+                                        .count(),
+                                    1e-9);
+      iterations = std::max<uint64_t>(
+          iterations + 1,
+          std::min<double>(iterations * ratio * 1.2, iterations * 100.0));
+    }
+  }
+
+  /**
+   * @brief Print a result
+   *
+   * @param name the name of the benchmark
+   * @param ops the number of operations
+   * @param seconds the time they took
+   * @param fields extra fields
+   */
+  void Print(const std::string& name, const uint64_t& ops,
+             const double& seconds, const Fields& fields) const {
+    std::stringstream ss;
+    ss << "{\"name\":\"" << name << "\",\"ops\":" << ops
+       << ",\"seconds\":" << seconds
+       << ",\"ns_per_op\":" << (ops ? seconds * 1e9 / ops : 0)
+       << ",\"ops_per_sec\":" << (seconds > 0 ? ops / seconds : 0);
+    for (const auto& field : fields)
+      ss << ",\"" << field.first << "\":" << field.second;
+    ss << '}';
+    std::cout << ss.str() << std::endl;
+  }
+
+ private:
+  const std::string filter_;
+  const std::chrono::milliseconds min_time_;
+};
+
+static std::string Repeat(const std::string& str, const size_t& times) {
+  std::string ret;
+  for (size_t i = 0; i < times; i++) ret += str;
+  return ret;
+}
+
+// requests as sent by common clients
+static const std::string kSmallGet =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const std::string kBrowserGet =
+    "GET /img/logo.jpg?size=large&v=3 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, "
+    "like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://localhost:8080/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8\r\n"
+    "\r\n";
+
+static std::string LargeHeaderGet() {
+  std::string cookie = "Cookie: ";
+  for (int i = 0; i < 64; i++)
+    cookie += "session_" + std::to_string(i) + "=" + std::string(96, 'x') +
+              "; ";
+  return "GET /txt HTTP/1.1\r\n"
+         "Host: localhost:8080\r\n"
+         "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n" +
+         cookie + "\r\n\r\n";
+}
+
+static std::string Post(const size_t& body_size) {
+  std::string body = "login=3190104500&pass=4500&pad=";
+  body += std::string(body_size > body.size() ? body_size - body.size() : 0,
+                      'a');
+  return "POST /dopost HTTP/1.1\r\n"
+         "Host: localhost:8080\r\n"
+         "Content-Type: application/x-www-form-urlencoded\r\n"
+         "Content-Length: " +
+         std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+static void BenchParse(Bench& bench, Server& server) {
+  MemoryEventLoop event_loop(&server);
+  struct Corpus {
+    std::string name;
+    std::string input;
+    size_t chunk_size;  // bytes per recv()
+  };
+  const std::vector<Corpus> corpora = {
+      {"small_get", kSmallGet, SIZE_MAX},
+      {"browser_get", kBrowserGet, SIZE_MAX},
+      {"large_headers", LargeHeaderGet(), SIZE_MAX},
+      {"pipelined_16", Repeat(kSmallGet, 16), SIZE_MAX},
+      {"pipelined_mixed_16",
+       Repeat(kSmallGet + kBrowserGet + Post(64) + kBrowserGet, 4), SIZE_MAX},
+      {"post_64", Post(64), SIZE_MAX},
+      // the body arrives in segments of one MSS
+      {"post_16k_segmented", Post(16 << 10), 1448},
+      {"post_256k_segmented", Post(256 << 10), 1448},
+  };
+  for (const auto& corpus : corpora) {
+    const std::string name = "parse/" + corpus.name;
+    if (!bench.IsSelected(name)) continue;
+    const auto ParseAll = [&](const uint64_t& iterations) {
+      uint64_t requests = 0;
+      for (uint64_t i = 0; i < iterations; i++) {
+        event_loop.Reset(&corpus.input, corpus.chunk_size);
+        BufferChain remaining(event_loop.buffer_pool());
+        for (;;) {
+          HttpRequest request;
+          if (!BenchAccess::Parse(request, remaining, &event_loop, 0)) break;
+          ++requests;
+        }
+      }
+      return requests;
+    };
+    const uint64_t requests_per_input = ParseAll(1);
+    bench.Run(name, ParseAll, [&](const uint64_t& ops, const double& seconds) {
+      const double inputs = requests_per_input
+                                ? static_cast<double>(ops) / requests_per_input
+                                : 0;
+      return Bench::Fields{
+          {"requests_per_input", static_cast<double>(requests_per_input)},
+          {"bytes_per_sec",
+           inputs * corpus.input.size() / std::max(seconds, 1e-9)}};
+    });
+  }
+}
+
+static void BenchRouter(Bench& bench, Server& server) {
+  const ControllerFunc noop =
+      [](const HttpRequestPtr&&,
+         std::function<void(const HttpResponsePtr&, const HttpStatusCode&)>&&) {
+      };
+  for (const size_t route_num : {10, 100, 1000, 10000}) {
+    const std::string name = "router/lookup_" + std::to_string(route_num);
+    if (!bench.IsSelected(name)) continue;
+    MemoryEventLoop event_loop(&server);
+    auto& router = event_loop.router();
+    std::vector<HttpRequest> requests(route_num);
+    for (size_t i = 0; i < route_num; i++) {
+      const std::string path =
+          "/api/v1/resource" + std::to_string(i) + "/items";
+      router.RegisterController(i % 2 ? HttpMethod::POST : HttpMethod::GET,
+                                path, ControllerFunc(noop));
+      requests[i].method = i % 2 ? HttpMethod::POST : HttpMethod::GET;
+      requests[i].path = path;
+    }
+    // visit the routes in a scattered order, a quarter of the lookups miss
+    std::vector<HttpRequest> lookups;
+    for (size_t i = 0; i < 4096; i++) {
+      HttpRequest request = requests[(i * 2654435761u) % route_num];
+      if (i % 4 == 3) request.path += "/missing";
+      lookups.push_back(std::move(request));
+    }
+    bench.Run(name, [&](const uint64_t& iterations) {
+      uint64_t found = 0;
+      for (uint64_t i = 0; i < iterations; i++)
+        found += BenchAccess::Lookup(router, lookups[i % lookups.size()]);
+      if (found > iterations) std::cerr << "impossible\n";  // keep it alive
+      return iterations;
+    });
+  }
+}
+
+static void BenchSerialize(Bench& bench, Server& server) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+    std::cerr << "socketpair() failed, errno: " << errno << std::endl;
+    return;
+  }
+  const int buffer_size = 4 << 20;
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+  setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  std::atomic<bool> is_done(false);
+  std::atomic<uint64_t> received(0);
+  std::thread reader([&]() {  // drain the other end
+    std::vector<char> buffer(1 << 20);
+    for (;;) {
+      const auto ret = read(fds[1], buffer.data(), buffer.size());
+      if (ret <= 0) break;
+      received += ret;
+    }
+    is_done = true;
+  });
+
+  EpollEventLoop event_loop(&server, 0);
+  struct Case {
+    std::string name;
+    std::function<HttpResponsePtr()> make;
+    HttpStatusCode status;
+  };
+  auto InMemory = [](const size_t& size) {
+    return [size]() {
+      HttpResponsePtr response = std::make_unique<HttpResponse>();
+      response->SetContentType("text/html");
+      const std::string body(size, 'x');
+      response->SetBody(std::move(body), body.size());
+      return response;
+    };
+  };
+  std::vector<Case> cases = {
+      {"serialize/not_found",
+       []() {
+         HttpResponsePtr response = std::make_unique<HttpResponse>();
+         response->SetContentLength(0);
+         return response;
+       },
+       HttpStatusCode::NOT_FOUND},
+      {"serialize/body_16", InMemory(16), HttpStatusCode::OK},
+      {"serialize/body_4k", InMemory(4 << 10), HttpStatusCode::OK},
+      {"serialize/body_64k", InMemory(64 << 10), HttpStatusCode::OK},
+  };
+  if (std::filesystem::exists("./example/logo.jpg"))
+    cases.push_back({"serialize/file_logo_jpg",
+                     []() {
+                       HttpResponsePtr response =
+                           std::make_unique<HttpResponse>();
+                       response->SetContentType("image/jpeg");
+                       response->SetBody("./example/logo.jpg");
+                       return response;
+                     },
+                     HttpStatusCode::OK});
+  for (const auto& test_case : cases) {
+    if (!bench.IsSelected(test_case.name)) continue;
+    const auto response = test_case.make();
+    uint64_t sent_bytes = 0;
+    bench.Run(
+        test_case.name,
+        [&](const uint64_t& iterations) {
+          const auto before = received.load();
+          for (uint64_t i = 0; i < iterations; i++)
+            BenchAccess::SendRequest(*response, &event_loop, test_case.status,
+                                     fds[0]);
+          sent_bytes = received.load() - before;
+          return iterations;
+        },
+        [&](const uint64_t& ops, const double& seconds) {
+          (void)ops;
+          return Bench::Fields{
+              {"bytes_per_sec", sent_bytes / std::max(seconds, 1e-9)}};
+        });
+  }
+  shutdown(fds[0], SHUT_WR);
+  reader.join();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void BenchThreadPool(Bench& bench) {
+  const int core_num =
+      std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  std::vector<int> thread_nums = {1};
+  if (core_num > 1) thread_nums.push_back(core_num);
+  for (const int thread_num : thread_nums) {
+    const std::string threads = std::to_string(thread_num) + "_threads";
+    ThreadPool pool(thread_num);
+    // a burst of tasks, throughput
+    bench.Run(
+        "thread_pool/push_burst_" + threads,
+        [&](const uint64_t& iterations) {
+          std::atomic<uint64_t> done(0);
+          for (uint64_t i = 0; i < iterations; i++)
+            pool.push([&done](int) {
+              done.fetch_add(1, std::memory_order_release);
+            });
+          while (done.load(std::memory_order_acquire) < iterations)
+            std::this_thread::yield();
+          return iterations;
+        },
+        [&](const uint64_t&, const double&) {
+          return Bench::Fields{{"threads", static_cast<double>(thread_num)}};
+        });
+    // one task at a time, the latency from push() to the task running
+    std::unique_ptr<Histogram> latency;
+    bench.Run(
+        "thread_pool/push_latency_" + threads,
+        [&](const uint64_t& iterations) {
+          latency = std::make_unique<Histogram>();
+          for (uint64_t i = 0; i < iterations; i++) {
+            std::atomic<bool> done(false);
+            const auto pushed = Clock::now();
+            pool.push([&done, &latency, pushed](int) {
+              latency->Record(Clock::now() - pushed);
+              done.store(true, std::memory_order_release);
+            });
+            while (!done.load(std::memory_order_acquire))
+              std::this_thread::yield();
+          }
+          return iterations;
+        },
+        [&](const uint64_t&, const double&) {
+          return Bench::Fields{
+              {"threads", static_cast<double>(thread_num)},
+              {"latency_p50_ns", static_cast<double>(latency->Percentile(50))},
+              {"latency_p99_ns", static_cast<double>(latency->Percentile(99))},
+              {"latency_p999_ns",
+               static_cast<double>(latency->Percentile(99.9))}};
+        });
+  }
+}
+
+static void BenchLogger(Bench& bench) {
+  const std::string message =
+      "[127.0.0.1:54321] GET /img/logo.jpg?size=large&v=3";
+  for (const bool is_enabled : {true, false}) {
+    const std::string name =
+        std::string("logger/") + (is_enabled ? "info" : "info_filtered");
+    if (!bench.IsSelected(name)) continue;
+    Logger logger;
+    logger.SetFile("/dev/null", 0);
+    if (!is_enabled) logger.SetLevel(Logger::LOG_LEVEL_WARN);
+    bench.Run(
+        name,
+        [&](const uint64_t& iterations) {
+          for (uint64_t i = 0; i < iterations; i++) logger.Info(message);
+          return iterations;
+        },
+        [&](const uint64_t&, const double&) {
+          // lines dropped when the ring buffer outran the writer thread
+          return Bench::Fields{
+              {"dropped", static_cast<double>(logger.dropped_num())}};
+        });
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string filter;
+  std::chrono::milliseconds min_time(300);
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    if (arg.rfind("--filter=", 0) == 0) {
+      filter = arg.substr(9);
+    } else if (arg.rfind("--min-time=", 0) == 0) {
+      min_time = std::chrono::milliseconds(std::stoi(arg.substr(11)));
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--filter=<substring>] [--min-time=<ms>]" << std::endl;
+      return 1;
+    }
+  }
+  Bench bench(filter, min_time);
+
+  Server server;
+  server.logger.SetLevel(Logger::LOG_LEVEL_FATAL);  // keep stdout parseable
+
+  BenchParse(bench, server);
+  BenchRouter(bench, server);
+  BenchSerialize(bench, server);
+  BenchThreadPool(bench);
+  BenchLogger(bench);
+  return 0;
+}
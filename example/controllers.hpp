@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
 #include "HTTPSimple.hpp"
+#include "HttpClient.hpp"
+#include "Multipart.hpp"
 #include "XForm.hpp"
 
 void test_html(const HttpRequestPtr&&,
@@ -31,17 +37,28 @@ void noimg(const HttpRequestPtr&&,
 void dopost(const HttpRequestPtr&& req,
             std::function<void(const HttpResponsePtr&,
                                const HttpStatusCode& status_code)>&& callback) {
-  HttpResponsePtr resp = std::make_unique<HttpResponse>();
-  if (req->headers["Content-Type"] != "application/x-www-form-urlencoded") {
+  std::optional<std::string> login, pass;
+  const auto& content_type = req->headers["Content-Type"];
+  if (content_type == "application/x-www-form-urlencoded") {
+    const FormView form(req->body);
+    login = form.Get("login");
+    pass = form.Get("pass");
+  } else if (const auto boundary = MultipartParser::Boundary(content_type)) {
+    MultipartForm form(*boundary, std::filesystem::temp_directory_path());
+    if (form.Feed(req->body) && form.IsDone()) {
+      login = form.fields["login"];
+      pass = form.fields["pass"];
+    }
+    for (const auto& file : form.files) std::filesystem::remove(file.path);
+  } else {
     HttpResponsePtr resp = std::make_unique<HttpResponse>();
     resp->SetContentType("text/html");
     const std::string s("Unsupported content type!");
     resp->SetBody(std::move(s), s.size());
     callback(resp, HttpStatusCode::OK);
+    return;
   }
-  auto form = DecodeXWWWFormUrlencoded(req->body);
-  if (form["login"] == "3190104500" &&
-      form["pass"] == "4500") {  // correct password
+  if (login == "3190104500" && pass == "4500") {  // correct password
     HttpResponsePtr resp = std::make_unique<HttpResponse>();
     resp->SetContentType("text/html");
     const std::string s("Login Success!");
@@ -64,3 +81,47 @@ void img(const HttpRequestPtr&&,
   resp->SetBody("./example/logo.jpg");
   callback(resp, HttpStatusCode::OK);
 };
+
+inline Task<HttpResponse> delay(HttpRequest& req) {
+  // wait for ?ms=<milliseconds> without holding a thread, then read the page
+  // in the worker group
+  int ms = 0;
+  try {
+    ms = std::stoi(req.params["ms"]);
+  } catch (const std::exception&) {
+  }
+  co_await Sleep(std::chrono::milliseconds(std::clamp(ms, 0, 10000)));
+  const auto page = co_await Offload([]() {
+    std::ifstream file("./example/test.txt");
+    return std::string(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+  });
+  HttpResponse resp;
+  resp.SetContentType("text/txt");
+  resp.SetBody(std::string(page), page.size());
+  co_return resp;
+}
+
+inline Task<HttpResponse> proxy(HttpRequest& req, HttpClient& upstream) {
+  // fetch ?path=<path> from the upstream over a pooled keep-alive connection
+  auto path = req.params["path"];
+  if (path.empty() || path[0] != '/') path = "/" + path;
+  const auto upstream_resp = co_await upstream.Request(HttpMethod::GET, path);
+  HttpResponse resp;
+  switch (upstream_resp.status) {
+    case 200:
+      resp.status = HttpStatusCode::OK;
+      break;
+    case 404:
+      resp.status = HttpStatusCode::NOT_FOUND;
+      break;
+    default:  // failed, or nothing we can pass on
+      resp.status = HttpStatusCode::BAD_GATEWAY;
+      resp.SetContentLength(0);
+      co_return resp;
+  }
+  const auto content_type = upstream_resp.Header("Content-Type");
+  if (!content_type.empty()) resp.SetContentType(content_type);
+  resp.SetBody(std::string(upstream_resp.body), upstream_resp.body.size());
+  co_return resp;
+}
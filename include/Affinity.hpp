@@ -0,0 +1,158 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Where the threads of the server run
+ *
+ * Event loop i (and the worker group dispatched from it) runs on
+ * loop_cpus[i % loop_cpus.size()]. An empty CPU set means "don't pin".
+ */
+struct ThreadPlacement {
+  // CPU set of every event loop thread
+  std::vector<std::vector<int>> loop_cpus;
+  // CPU set of the worker group of every event loop (defaults to loop_cpus)
+  std::vector<std::vector<int>> worker_cpus;
+  // CPU set of the thread accepting connections
+  std::vector<int> acceptor_cpus;
+  // CPU set of the logger thread
+  std::vector<int> logger_cpus;
+  // prefer allocating memory on the NUMA nodes of the CPU set of the thread
+  bool bind_memory = true;
+
+  /**
+   * @brief One event loop (and worker group) per NUMA node, each pinned to the
+   * CPUs of its node
+   *
+   * @return the placement
+   */
+  static ThreadPlacement PerNumaNode();
+};
+
+/**
+ * @brief Parse a Linux CPU list (e.g. "0-3,8,10-11")
+ *
+ * @param list the CPU list
+ * @return the CPUs
+ */
+inline std::vector<int> ParseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") continue;
+    const auto dash = range.find('-');
+    try {
+      if (dash == std::string::npos) {
+        cpus.push_back(std::stoi(range));
+      } else {
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+      }
+    } catch (const std::exception &) {  // malformed range
+      continue;
+    }
+  }
+  return cpus;
+}
+
+/**
+ * @brief Get the CPUs of every online NUMA node
+ *
+ * @return the CPU set of every node, indexed by node id (nodes without CPUs
+ * are empty, a single node with all the CPUs if the topology is unavailable)
+ */
+inline std::vector<std::vector<int>> NumaNodeCpus() {
+  std::vector<std::vector<int>> nodes;
+  std::ifstream online_file("/sys/devices/system/node/online");
+  std::string online;
+  if (std::getline(online_file, online)) {
+    for (const auto node : ParseCpuList(online)) {
+      std::ifstream cpulist_file("/sys/devices/system/node/node" +
+                                 std::to_string(node) + "/cpulist");
+      std::string cpulist;
+      std::getline(cpulist_file, cpulist);
+      if (node >= static_cast<int>(nodes.size())) nodes.resize(node + 1);
+      nodes[node] = ParseCpuList(cpulist);
+    }
+  }
+  if (std::all_of(nodes.begin(), nodes.end(),
+                  [](const std::vector<int> &cpus) { return cpus.empty(); })) {
+    nodes.clear();
+    std::vector<int> cpus;
+    for (int cpu = 0, n = sysconf(_SC_NPROCESSORS_ONLN); cpu < n; cpu++)
+      cpus.push_back(cpu);
+    nodes.push_back(cpus);
+  }
+  return nodes;
+}
+
+inline ThreadPlacement ThreadPlacement::PerNumaNode() {
+  ThreadPlacement placement;
+  for (auto &cpus : NumaNodeCpus())
+    if (!cpus.empty()) placement.loop_cpus.push_back(std::move(cpus));
+  return placement;
+}
+
+/**
+ * @brief Pin a thread to a CPU set
+ *
+ * @param thread the native handle of the thread
+ * @param cpus the CPU set (nothing is done if it is empty)
+ * @return whether the thread was pinned
+ */
+inline bool PinThread(const pthread_t &thread, const std::vector<int> &cpus) {
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const auto cpu : cpus)
+    if (0 <= cpu && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+/**
+ * @brief Make the calling thread prefer allocating memory on the NUMA nodes
+ * the CPU set belongs to
+ *
+ * @param cpus the CPU set (nothing is done if it is empty)
+ * @return whether the memory policy was set
+ */
+inline bool BindMemoryToCpus(const std::vector<int> &cpus) {
+  if (cpus.empty()) return false;
+  const auto nodes = NumaNodeCpus();
+  if (nodes.size() <= 1) return false;  // nothing to choose from
+  uint64_t node_mask = 0;
+  for (size_t node = 0; node < nodes.size() && node < 64; node++)
+    for (const auto cpu : cpus)
+      if (std::find(nodes[node].begin(), nodes[node].end(), cpu) !=
+          nodes[node].end())
+        node_mask |= 1ull << node;
+  if (!node_mask) return false;
+  // only the first node of the mask is used by MPOL_PREFERRED
+  const uint64_t preferred = node_mask & -node_mask;
+  return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &preferred, 64) == 0;
+}
+
+/**
+ * @brief Pin the calling thread and bind its memory to a CPU set
+ *
+ * @param cpus the CPU set (nothing is done if it is empty)
+ * @param bind_memory whether to also set the memory policy
+ */
+inline void PlaceCurrentThread(const std::vector<int> &cpus,
+                               const bool &bind_memory) {
+  PinThread(pthread_self(), cpus);
+  if (bind_memory) BindMemoryToCpus(cpus);
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A pool of fixed-size receive buffers (slabs), so that a connection
+ * only holds memory while it has bytes in flight
+ *
+ * The slabs given back are kept for the next borrowers, up to a bound, the
+ * others are freed.
+ */
+class BufferPool {
+ public:
+  static constexpr size_t kSlabSize = 16384;
+  static constexpr size_t kDefaultMaxFree = 256;
+
+  /**
+   * @brief Create a pool
+   *
+   * @param max_free the maximum number of free slabs kept
+   */
+  explicit BufferPool(const size_t& max_free = kDefaultMaxFree)
+      : max_free_(max_free), lent_num_(0) {}
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /**
+   * @brief Borrow a slab of kSlabSize bytes
+   *
+   * @return the slab
+   */
+  char* Acquire();
+
+  /**
+   * @brief Give a slab back
+   *
+   * @param slab the slab
+   */
+  void Release(char* const slab);
+
+  /**
+   * @brief Get the number of slabs lent
+   *
+   * @return the number of slabs
+   */
+  size_t lent_num() const { return lent_num_.load(std::memory_order_relaxed); }
+
+ private:
+  const size_t max_free_;
+  std::atomic<size_t> lent_num_;
+  std::mutex mutex_;
+  std::vector<char*> free_;
+};
+
+/**
+ * @brief A byte queue made of slabs borrowed from a pool: bytes are received
+ * at the back and parsed from the front, the slabs are given back as soon as
+ * they are consumed. It isn't thread-safe.
+ */
+class BufferChain {
+ public:
+  explicit BufferChain(BufferPool& pool) : pool_(&pool), begin_(0), end_(0) {}
+  ~BufferChain() { Clear(); }
+
+  BufferChain(BufferChain&& other) noexcept;
+  BufferChain& operator=(BufferChain&& other) noexcept;
+  BufferChain(const BufferChain&) = delete;
+  BufferChain& operator=(const BufferChain&) = delete;
+
+  /**
+   * @brief Get the number of bytes
+   *
+   * @return the number of bytes
+   */
+  size_t size() const {
+    return slabs_.empty() ? 0
+                          : (slabs_.size() - 1) * BufferPool::kSlabSize +
+                                end_ - begin_;
+  }
+
+  /**
+   * @brief Whether there are no bytes
+   *
+   * @return true if it's empty
+   */
+  bool empty() const { return !size(); }
+
+  /**
+   * @brief Get the free space at the back to receive into, borrowing a slab
+   * if the last one is full
+   *
+   * @param size the size of the space
+   * @return the space
+   */
+  char* Reserve(size_t& size);
+
+  /**
+   * @brief Append the bytes received into the space of Reserve()
+   *
+   * @param size the number of bytes
+   */
+  void Commit(const size_t& size);
+
+  /**
+   * @brief Append bytes
+   *
+   * @param data the bytes
+   * @param size the number of bytes
+   */
+  void Append(const char* data, size_t size);
+
+  /**
+   * @brief Move all the bytes of another chain of the same pool to the back
+   * (without copying them if this one is empty)
+   *
+   * @param other the other chain
+   */
+  void Append(BufferChain& other);
+
+  /**
+   * @brief Find a pattern among the first bytes
+   *
+   * @param pattern the pattern
+   * @param limit how many bytes to search
+   * @return the offset of the pattern (std::string::npos if it's not there)
+   */
+  size_t Find(const std::string_view& pattern, const size_t& limit) const;
+
+  /**
+   * @brief Copy the first bytes
+   *
+   * @param size the number of bytes
+   * @param output the bytes (appended)
+   */
+  void CopyTo(size_t size, std::string& output) const;
+
+  /**
+   * @brief Drop the first bytes, giving back the slabs they filled
+   *
+   * @param size the number of bytes
+   */
+  void Consume(size_t size);
+
+  /**
+   * @brief Move the first bytes out
+   *
+   * @param size the number of bytes
+   * @param output the bytes (appended)
+   */
+  void Read(const size_t& size, std::string& output) {
+    CopyTo(size, output);
+    Consume(size);
+  }
+
+  /**
+   * @brief Move the first bytes out
+   *
+   * @param buffer the destination
+   * @param size the size of the destination
+   * @return the number of bytes moved
+   */
+  size_t Read(char* const buffer, const size_t& size);
+
+  /**
+   * @brief Drop all the bytes, giving back the slabs
+   *
+   */
+  void Clear();
+
+  /**
+   * @brief Exchange the bytes of two chains of the same pool
+   *
+   * @param other the other chain
+   */
+  void swap(BufferChain& other) noexcept;
+
+ private:
+  BufferPool* pool_;
+  std::deque<char*> slabs_;
+  size_t begin_;  // the offset of the first byte in the first slab
+  size_t end_;    // the number of bytes in the last slab
+};
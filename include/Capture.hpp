@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief Records the traffic of a server to a capture file, to be replayed by
+ * HTTPSimple_replay: the raw bytes received on every connection with their
+ * arrival time, and when the responses were sent, so that the replay keeps the
+ * per-connection order and pipelining of the clients
+ *
+ * The file starts with kMagic, followed by records: a type byte, the
+ * nanoseconds since the previous record, the connection id and, for DATA, the
+ * size and the bytes, the integers as LEB128 varints. Connection ids count
+ * from 0 in the order the connections were accepted.
+ */
+class Capture {
+ public:
+  enum RecordType : uint8_t {
+    OPEN,      // a connection was accepted
+    DATA,      // bytes were received
+    RESPONSE,  // a response was sent
+    CLOSE,     // the connection was closed
+  };
+
+  static constexpr char kMagic[8] = {'H', 'S', 'C', 'A', 'P', 'v', '0', '1'};
+
+  Capture() = default;
+  ~Capture();
+
+  Capture(const Capture&) = delete;
+  Capture& operator=(const Capture&) = delete;
+
+  /**
+   * @brief Start recording to a file
+   *
+   * @param path the path of the capture file (truncated)
+   * @param max_size the size after which the recording stops
+   * @return whether the file could be opened
+   */
+  bool Open(const std::string& path, const uint64_t& max_size);
+
+  /**
+   * @brief Whether the traffic is being recorded
+   *
+   * @return true if it is
+   */
+  bool IsEnabled() const {
+    return is_enabled_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Record a new connection
+   *
+   * @param fd the file descriptor of the socket
+   */
+  void OnConnected(const int& fd);
+
+  /**
+   * @brief Record the bytes received from a connection
+   *
+   * @param fd the file descriptor of the socket
+   * @param data the bytes
+   * @param size the number of bytes
+   */
+  void OnReceived(const int& fd, const void* const data, const size_t& size);
+
+  /**
+   * @brief Record that a response was sent to a connection
+   *
+   * @param fd the file descriptor of the socket
+   */
+  void OnResponded(const int& fd);
+
+  /**
+   * @brief Record that a connection was closed
+   *
+   * @param fd the file descriptor of the socket
+   */
+  void OnDisconnected(const int& fd);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief append a record to the buffer, the mutex must be held
+   *
+   * @param type the type of the record
+   * @param connection the connection id
+   * @param data the bytes of a DATA record
+   * @param size the number of bytes
+   */
+  void Append(const RecordType& type, const uint64_t& connection,
+              const void* const data = nullptr, const size_t& size = 0);
+
+  /**
+   * @brief write the buffer to the file every 100ms (runs in the flusher
+   * thread)
+   *
+   */
+  void FlushLoop();
+
+  std::atomic<bool> is_enabled_{false};
+  int fd_ = -1;
+  uint64_t max_size_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool is_running_ = false;
+  std::string buffer_;  // the records not written yet
+  uint64_t size_ = 0;   // the bytes recorded so far
+  Clock::time_point last_record_;
+  uint64_t next_connection_ = 0;
+  std::unordered_map<int, uint64_t> connections_;  // fd -> connection id
+  std::thread flusher_;
+};
+
+/**
+ * @brief Reads the records of a capture file
+ */
+class CaptureReader {
+ public:
+  struct Record {
+    Capture::RecordType type;
+    uint64_t timestamp_ns;  // since the recording started
+    uint64_t connection;
+    std::string data;
+  };
+
+  explicit CaptureReader(const std::string& path);
+  ~CaptureReader();
+
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator=(const CaptureReader&) = delete;
+
+  /**
+   * @brief Whether the file is a capture file
+   *
+   * @return true if its header is valid
+   */
+  bool IsValid() const { return is_valid_; }
+
+  /**
+   * @brief Read the next record
+   *
+   * @param record the record
+   * @return false at the end of the file, or if the record is truncated
+   */
+  bool Next(Record& record);
+
+ private:
+  /**
+   * @brief read a LEB128 varint
+   *
+   * @param value the value
+   * @return whether it could be read
+   */
+  bool ReadVarint(uint64_t& value);
+
+  FILE* file_;
+  bool is_valid_;
+  uint64_t timestamp_ns_;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * @brief CoDel-style overload detector
+ *
+ * Every dequeue reports how long the task waited in the queue (its sojourn
+ * time). If the minimum sojourn time seen during a whole interval stays above
+ * the target, the queue is considered to be standing (not just bursting) and
+ * the detector reports overload until an interval with a good sojourn time is
+ * observed again.
+ */
+class CoDel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  CoDel(const std::chrono::nanoseconds &target = std::chrono::milliseconds(5),
+        const std::chrono::nanoseconds &interval =
+            std::chrono::milliseconds(100))
+      : target_ns_(target.count()),
+        interval_ns_(interval.count()),
+        interval_start_ns_(Now()),
+        min_sojourn_ns_(INT64_MAX),
+        overloaded_(false) {}
+
+  /**
+   * @brief Set the target sojourn time and the observation interval
+   *
+   * @param target the acceptable standing queue delay
+   * @param interval the window in which the minimum sojourn time is taken
+   */
+  void SetTarget(const std::chrono::nanoseconds &target,
+                 const std::chrono::nanoseconds &interval) {
+    target_ns_ = target.count();
+    interval_ns_ = interval.count();
+  }
+
+  /**
+   * @brief Report the sojourn time of a dequeued task
+   *
+   * @param sojourn the time the task spent in the queue
+   */
+  void OnDequeue(const Clock::duration &sojourn) {
+    const int64_t sojourn_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(sojourn).count();
+    int64_t min_sojourn = min_sojourn_ns_.load(std::memory_order_relaxed);
+    while (sojourn_ns < min_sojourn &&
+           !min_sojourn_ns_.compare_exchange_weak(min_sojourn, sojourn_ns,
+                                                  std::memory_order_relaxed))
+      ;
+    last_sojourn_ns_.store(sojourn_ns, std::memory_order_relaxed);
+
+    const int64_t now = Now();
+    int64_t interval_start = interval_start_ns_.load(std::memory_order_relaxed);
+    if (now - interval_start < interval_ns_) return;
+    // only one thread closes the interval
+    if (!interval_start_ns_.compare_exchange_strong(interval_start, now,
+                                                    std::memory_order_relaxed))
+      return;
+    const int64_t interval_min =
+        min_sojourn_ns_.exchange(INT64_MAX, std::memory_order_relaxed);
+    overloaded_.store(interval_min > target_ns_, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Whether the queue delay has stayed above the target for a whole
+   * interval
+   */
+  bool IsOverloaded() const {
+    return overloaded_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief The sojourn time of the most recently dequeued task
+   */
+  std::chrono::nanoseconds LastSojourn() const {
+    return std::chrono::nanoseconds(
+        last_sojourn_ns_.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief Forget the overload state (e.g. when the queue has drained)
+   */
+  void Reset() {
+    overloaded_.store(false, std::memory_order_relaxed);
+    min_sojourn_ns_.store(INT64_MAX, std::memory_order_relaxed);
+    interval_start_ns_.store(Now(), std::memory_order_relaxed);
+  }
+
+ private:
+  static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
+  std::atomic<int64_t> target_ns_;
+  std::atomic<int64_t> interval_ns_;
+  std::atomic<int64_t> interval_start_ns_;
+  std::atomic<int64_t> min_sojourn_ns_;
+  std::atomic<int64_t> last_sojourn_ns_{0};
+  std::atomic<bool> overloaded_;
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "EventLoop.hpp"
+
+template <typename T>
+class Task;
+
+// what the promises of all the tasks share
+class TaskPromiseBase {
+ public:
+  // resume the awaiting coroutine once the task is done
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) const noexcept {
+      const auto continuation = handle.promise().continuation_;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { exception_ = std::current_exception(); }
+
+  void SetContinuation(const std::coroutine_handle<>& continuation) {
+    continuation_ = continuation;
+  }
+
+ protected:
+  void RethrowIfFailed() const {
+    if (exception_) std::rethrow_exception(exception_);
+  }
+
+ private:
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+ public:
+  Task<T> get_return_object();
+
+  template <typename U>
+  void return_value(U&& value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T Result() {
+    RethrowIfFailed();
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+ public:
+  Task<void> get_return_object();
+
+  void return_void() const {}
+
+  void Result() const { RethrowIfFailed(); }
+};
+
+/**
+ * @brief A lazily started coroutine returning a T, run by co_await-ing it
+ * (the awaiting coroutine is resumed by the thread that finishes it)
+ *
+ * @tparam T the type of the result
+ */
+template <typename T = void>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = TaskPromise<T>;
+
+  explicit Task(const std::coroutine_handle<promise_type>& handle)
+      : handle_(handle) {}
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(
+      const std::coroutine_handle<>& continuation) noexcept {
+    handle_.promise().SetContinuation(continuation);
+    return handle_;  // start the task
+  }
+  T await_resume() { return handle_.promise().Result(); }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+  return Task<void>(
+      std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * @brief A coroutine started right away that nobody waits for, it destroys
+ * itself when it's done
+ */
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+/**
+ * @brief Wait until a file descriptor is ready, resumed on the event loop of
+ * the request (blocks with poll() outside of the threads of a server)
+ */
+class ReadyAwaiter {
+ public:
+  ReadyAwaiter(const int& fd, const uint32_t& events)
+      : fd_(fd), event_loop_(EventLoop::Current()), waiter_{{}, events} {}
+
+  bool await_ready() {
+    if (event_loop_) return false;
+    pollfd pfd = {fd_, static_cast<short>(waiter_.events), 0};
+    poll(&pfd, 1, -1);
+    waiter_.events = static_cast<uint16_t>(pfd.revents);
+    return true;
+  }
+  void await_suspend(const std::coroutine_handle<>& handle) {
+    waiter_.handle = handle;
+    event_loop_->ResumeWhenReady(fd_, &waiter_);
+  }
+  /**
+   * @return whether it's ready, false if an error happened instead
+   */
+  bool await_resume() const { return !(waiter_.events & EPOLLERR); }
+
+ private:
+  const int fd_;
+  EventLoop* const event_loop_;
+  Waiter waiter_;
+};
+
+/**
+ * @brief Wait until a file descriptor (not a connection of the server) is
+ * readable
+ *
+ * @param fd the file descriptor
+ * @return the awaitable, true if readable, false on errors
+ */
+inline ReadyAwaiter Readable(const int& fd) { return {fd, EPOLLIN}; }
+
+/**
+ * @brief Wait until a file descriptor (not a connection of the server) is
+ * writable
+ *
+ * @param fd the file descriptor
+ * @return the awaitable, true if writable, false on errors
+ */
+inline ReadyAwaiter Writable(const int& fd) { return {fd, EPOLLOUT}; }
+
+/**
+ * @brief Wait for some time, resumed on the event loop of the request
+ * (blocks outside of the threads of a server)
+ */
+class SleepAwaiter {
+ public:
+  explicit SleepAwaiter(const std::chrono::nanoseconds& delay)
+      : delay_(delay), event_loop_(EventLoop::Current()) {}
+
+  bool await_ready() const {
+    if (delay_.count() <= 0) return true;
+    if (event_loop_) return false;
+    std::this_thread::sleep_for(delay_);
+    return true;
+  }
+  void await_suspend(const std::coroutine_handle<>& handle) const {
+    event_loop_->ResumeAfter(delay_, handle);
+  }
+  void await_resume() const {}
+
+ private:
+  const std::chrono::nanoseconds delay_;
+  EventLoop* const event_loop_;
+};
+
+/**
+ * @brief Wait for some time without blocking a thread
+ *
+ * @param delay the delay
+ * @return the awaitable
+ */
+template <typename Rep, typename Period>
+SleepAwaiter Sleep(const std::chrono::duration<Rep, Period>& delay) {
+  return SleepAwaiter(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(delay));
+}
+
+/**
+ * @brief Run a function in the worker group and resume on the event loop of
+ * the request with its result (runs it in place outside of the threads of a
+ * server)
+ *
+ * @tparam F the type of the function
+ */
+template <typename F>
+class OffloadAwaiter {
+  using Result = std::invoke_result_t<F&>;
+  using Stored =
+      std::conditional_t<std::is_void_v<Result>, std::monostate, Result>;
+
+ public:
+  explicit OffloadAwaiter(F&& func)
+      : func_(std::move(func)), event_loop_(EventLoop::Current()) {}
+
+  bool await_ready() {
+    if (event_loop_) return false;
+    Call();
+    return true;
+  }
+  void await_suspend(const std::coroutine_handle<>& handle) {
+    event_loop_->Offload([this, handle]() {
+      Call();
+      event_loop_->Resume(handle);
+    });
+  }
+  Result await_resume() {
+    if (exception_) std::rethrow_exception(exception_);
+    if constexpr (!std::is_void_v<Result>) return std::move(*result_);
+  }
+
+ private:
+  void Call() {
+    try {
+      if constexpr (std::is_void_v<Result>) {
+        func_();
+        result_.emplace();
+      } else {
+        result_.emplace(func_());
+      }
+    } catch (...) {
+      exception_ = std::current_exception();
+    }
+  }
+
+  F func_;
+  EventLoop* const event_loop_;
+  std::optional<Stored> result_;
+  std::exception_ptr exception_;
+};
+
+/**
+ * @brief Run a blocking or CPU-heavy function in the worker group, the
+ * coroutine is resumed on the event loop with its result
+ *
+ * @param func the function
+ * @return the awaitable
+ */
+template <typename F>
+OffloadAwaiter<std::decay_t<F>> Offload(F&& func) {
+  return OffloadAwaiter<std::decay_t<F>>(std::forward<F>(func));
+}
+
+/**
+ * @brief Move the rest of the coroutine to the worker group (does nothing
+ * outside of the threads of a server)
+ */
+class WorkerAwaiter {
+ public:
+  WorkerAwaiter() : event_loop_(EventLoop::Current()) {}
+
+  bool await_ready() const { return !event_loop_; }
+  void await_suspend(const std::coroutine_handle<>& handle) const {
+    event_loop_->Offload([handle]() { handle.resume(); });
+  }
+  void await_resume() const {}
+
+ private:
+  EventLoop* const event_loop_;
+};
+
+/**
+ * @brief Continue the coroutine in the worker group, e.g. before a long
+ * computation
+ *
+ * @return the awaitable
+ */
+inline WorkerAwaiter ResumeOnWorker() { return {}; }
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "BufferPool.hpp"
+
+class Router;
+class Server;
+
+enum class IoBackend {
+  EPOLL,     // readiness notification, the workers recv() and send()
+  IO_URING,  // completion based, the loop receives and sends for the workers
+};
+
+// a coroutine waiting for a file descriptor, lives in the coroutine frame
+struct Waiter {
+  std::coroutine_handle<> handle;
+  uint32_t events;  // EPOLLIN / EPOLLOUT, then the events that happened
+};
+
+/**
+ * @brief An event loop watches a set of connections, hands the readable ones
+ * to the worker group of its router, and performs the socket I/O of the
+ * workers. It also resumes the coroutines of the coroutine controllers when
+ * what they wait for is ready.
+ */
+class EventLoop {
+ public:
+  EventLoop(Server* const server, const int& id);
+  virtual ~EventLoop();
+
+  /**
+   * @brief Get the server this loop belongs to
+   *
+   * @return the server
+   */
+  Server* server() const { return server_; }
+
+  /**
+   * @brief Get the router dispatching the requests of this loop to its worker
+   * group
+   *
+   * @return the router
+   */
+  Router& router() { return *router_; }
+
+  /**
+   * @brief Get the pool of the receive buffers of the connections of this
+   * loop
+   *
+   * @return the pool
+   */
+  BufferPool& buffer_pool() { return buffer_pool_; }
+
+  /**
+   * @brief Get the index of this loop
+   *
+   * @return the index
+   */
+  int id() const { return id_; }
+
+  /**
+   * @brief Get the event loop whose requests the calling thread handles
+   *
+   * @return the event loop (nullptr if it isn't a thread of the server)
+   */
+  static EventLoop* Current();
+
+  /**
+   * @brief Set the event loop whose requests the calling thread handles
+   *
+   * @param event_loop the event loop
+   */
+  static void SetCurrent(EventLoop* const event_loop);
+
+  /**
+   * @brief Whether the calling thread is the thread of this loop
+   *
+   * @return true if it is
+   */
+  bool IsInLoopThread() const;
+
+  /**
+   * @brief Get the CPU set this loop is pinned to
+   *
+   * @return the CPU set (empty if it isn't pinned)
+   */
+  const std::vector<int>& cpus() const { return cpus_; }
+
+  /**
+   * @brief Start the loop thread
+   *
+   * @param cpus the CPU set the loop thread is pinned to
+   * @param bind_memory whether the loop thread prefers the memory of the NUMA
+   * node of the CPU set
+   */
+  void Start(const std::vector<int>& cpus, const bool& bind_memory);
+
+  /**
+   * @brief Wait for the loop thread to exit
+   *
+   */
+  void Join();
+
+  /**
+   * @brief Accept the connections of a listening socket in this loop (must be
+   * called before Start, once per listening socket)
+   *
+   * @param sockfd the listening socket
+   * @return false if the backend can't accept, the caller has to accept and
+   * Add() the connections
+   */
+  virtual bool Accept(const int& sockfd) = 0;
+
+  /**
+   * @brief Stop accepting the connections of the listening sockets, which are
+   * left open
+   *
+   */
+  virtual void StopAccepting() {}
+
+  /**
+   * @brief Watch a connection
+   *
+   * @param fd the file descriptor of the socket (already non-blocking)
+   * @return whether the connection was added
+   */
+  virtual bool Add(const int& fd) = 0;
+
+  /**
+   * @brief Receive bytes from a connection (like recv() on a non-blocking
+   * socket)
+   *
+   * @param fd the file descriptor of the socket
+   * @param buffer the destination
+   * @param size the size of the destination
+   * @return the number of bytes, 0 if the peer has closed the connection, -1
+   * with errno set (EAGAIN if no data is available now)
+   */
+  virtual ssize_t Recv(const int& fd, void* buffer, const size_t& size) = 0;
+
+  /**
+   * @brief Receive bytes from a connection into pooled buffers
+   *
+   * @param fd the file descriptor of the socket
+   * @param input the bytes (appended)
+   * @return the number of bytes, 0 if the peer has closed the connection, -1
+   * with errno set (EAGAIN if no data is available now)
+   */
+  virtual ssize_t Recv(const int& fd, BufferChain& input);
+
+  /**
+   * @brief Send bytes to a connection
+   *
+   * @param fd the file descriptor of the socket
+   * @param data the bytes (shared, so that pre-serialized responses are sent
+   * without being copied)
+   * @param close_after whether to close the connection once they are sent
+   * @return whether the bytes were sent (or queued) successfully
+   */
+  virtual bool Send(const int& fd,
+                    const std::shared_ptr<const std::string>& data,
+                    const bool& close_after) = 0;
+
+  /**
+   * @brief Send bytes to a connection
+   *
+   * @param fd the file descriptor of the socket
+   * @param data the bytes
+   * @param close_after whether to close the connection once they are sent
+   * @return whether the bytes were sent (or queued) successfully
+   */
+  bool Send(const int& fd, std::string&& data, const bool& close_after) {
+    return Send(fd, std::make_shared<const std::string>(std::move(data)),
+                close_after);
+  }
+
+  /**
+   * @brief Close a connection
+   *
+   * @param fd the file descriptor of the socket
+   */
+  virtual void Close(const int& fd) = 0;
+
+  /**
+   * @brief Resume a coroutine in the loop thread
+   *
+   * @param handle the coroutine
+   */
+  void Resume(const std::coroutine_handle<>& handle);
+
+  /**
+   * @brief Resume a coroutine in the loop thread after a delay
+   *
+   * @param delay the delay
+   * @param handle the coroutine
+   */
+  void ResumeAfter(const std::chrono::nanoseconds& delay,
+                   const std::coroutine_handle<>& handle);
+
+  /**
+   * @brief Resume a coroutine in the loop thread once a file descriptor is
+   * ready (it must not be a connection of the loop)
+   *
+   * @param fd the file descriptor
+   * @param waiter the coroutine and the events it waits for, the events that
+   * happened are stored back (EPOLLERR if it can't be watched)
+   */
+  virtual void ResumeWhenReady(const int& fd, Waiter* const waiter) = 0;
+
+  /**
+   * @brief Run a function in the worker group of this loop
+   *
+   * @param func the function
+   */
+  void Offload(std::function<void()>&& func);
+
+ protected:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief wake the loop thread up if it's waiting (called from other threads)
+   *
+   */
+  virtual void Wake() = 0;
+
+  /**
+   * @brief resume the coroutines that are due (loop thread only)
+   *
+   * @return when the next timer expires (time_point::max() if there is none)
+   */
+  Clock::time_point ResumeDue();
+
+  /**
+   * @brief whether ResumeDue() has coroutines to resume before the time it
+   * returned last
+   *
+   * @return true if it has
+   */
+  bool HasDue();
+
+  /**
+   * @brief wait for events and dispatch them (runs in the loop thread)
+   *
+   */
+  virtual void Run() = 0;
+
+  Server* const server_;
+  const int id_;
+  BufferPool buffer_pool_;
+  std::unique_ptr<Router> router_;
+  std::unique_ptr<std::thread> thread_;
+  std::vector<int> cpus_;
+
+ private:
+  using Timer = std::pair<Clock::time_point, std::coroutine_handle<>>;
+  struct TimerLater {
+    bool operator()(const Timer& lhs, const Timer& rhs) const {
+      return lhs.first > rhs.first;
+    }
+  };
+
+  std::mutex resume_mutex_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::priority_queue<Timer, std::vector<Timer>, TimerLater> timers_;
+  Clock::time_point next_timer_ = Clock::time_point::max();
+};
+
+class EpollEventLoop : public EventLoop {
+ public:
+  EpollEventLoop(Server* const server, const int& id);
+  ~EpollEventLoop() override;
+
+  bool Accept(const int& sockfd) override;
+  bool Add(const int& fd) override;
+  using EventLoop::Recv;
+  ssize_t Recv(const int& fd, void* buffer, const size_t& size) override;
+  using EventLoop::Send;
+  bool Send(const int& fd, const std::shared_ptr<const std::string>& data,
+            const bool& close_after) override;
+  void Close(const int& fd) override;
+  void ResumeWhenReady(const int& fd, Waiter* const waiter) override;
+
+ private:
+  static const int kMaxEpollEvents = 64;
+  // the epoll data of the wake-up eventfd and of the watched file descriptors,
+  // the connections use their fd
+  static constexpr uint64_t kWakeData = UINT64_MAX;
+  static constexpr uint64_t kWatchFlag = uint64_t(1) << 32;
+
+  void Run() override;
+  void Wake() override;
+
+  int epfd_;
+  int wake_fd_;
+
+  std::mutex watches_mutex_;
+  std::unordered_map<int, Waiter*> watches_;
+};
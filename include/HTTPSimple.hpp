@@ -1,29 +1,56 @@
 #pragma once
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "Affinity.hpp"
+#include "Capture.hpp"
+#include "CoDel.hpp"
+#include "Coroutine.hpp"
+#include "EventLoop.hpp"
+#include "Http2.hpp"
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "ResponseCache.hpp"
+#include "StaticDirectory.hpp"
+#include "Supervisor.hpp"
 #include "TaskQueue.hpp"
 #include "ThreadPool.hpp"
+#include "Tracer.hpp"
 
 using ControllerFunc =
     std::function<void(const HttpRequestPtr&&,
                        std::function<void(const HttpResponsePtr&,
                                           const HttpStatusCode&)>&& callback)>;
+// a controller written as a coroutine, the request lives until it's done
+using CoroutineControllerFunc = std::function<Task<HttpResponse>(HttpRequest&)>;
 
 class Server;
+class UringEventLoop;
+struct BenchAccess;
 
 class Router : public TaskQueue<int, void> {
+  // the number of slots of RouteMetrics::durations: one per status code and
+  // one for the responses from the cache
+  static const size_t kStatusCodeNum = 9;
+
  public:
-  Router(Server* const server);
+  Router(Server* const server, EventLoop* const event_loop);
 
   /**
    * @brief Set the thread number
@@ -32,6 +59,13 @@ class Router : public TaskQueue<int, void> {
    */
   void SetThreadNum(const uint32_t& num);
 
+  /**
+   * @brief Let the thread number change with the load
+   *
+   * @param policy the auto-scaling policy
+   */
+  void SetAutoScale(const ThreadPool::AutoScalePolicy& policy);
+
   /**
    * @brief register a controller
    *
@@ -41,17 +75,329 @@ class Router : public TaskQueue<int, void> {
    */
   void RegisterController(const HttpMethod& method, std::string path,
                           const ControllerFunc&& func);
+
+  /**
+   * @brief register a controller whose responses are cached
+   *
+   * @param method the HTTP method
+   * @param path the URL path
+   * @param func the controller function
+   * @param cache the cache of the responses (may be shared among routers)
+   */
+  void RegisterController(const HttpMethod& method, std::string path,
+                          const ControllerFunc&& func,
+                          const std::shared_ptr<ResponseCache>& cache);
+
+  /**
+   * @brief register a coroutine controller
+   *
+   * @param method the HTTP method
+   * @param path the URL path
+   * @param func the controller coroutine
+   */
+  void RegisterController(const HttpMethod& method, std::string path,
+                          const CoroutineControllerFunc&& func);
+
+  /**
+   * @brief serve the files of a directory for the GET and HEAD requests no
+   * controller matches
+   *
+   * @param directory the directory (may be shared among routers)
+   */
+  void ServeDirectory(const std::shared_ptr<StaticDirectory>& directory);
+
+  /**
+   * @brief Set the maximum number of connections waiting in the queue
+   *
+   * @param num the maximum queue length (0 means unlimited)
+   */
+  void SetMaxQueueSize(const size_t& num);
+
+  /**
+   * @brief Set the acceptable queueing delay
+   *
+   * @param target the acceptable standing queue delay
+   * @param interval the window in which the minimum queue delay is taken
+   */
+  void SetQueueDelayTarget(const std::chrono::milliseconds& target,
+                           const std::chrono::milliseconds& interval);
+
+  /**
+   * @brief Set the Retry-After value of the 503 response sent when shedding
+   *
+   * @param seconds the number of seconds
+   */
+  void SetRetryAfter(const uint32_t& seconds);
+
+  /**
+   * @brief Pin the worker group to a CPU set
+   *
+   * @param cpus the CPU set
+   * @param bind_memory whether the workers prefer the memory of the NUMA node
+   * of the CPU set
+   */
+  void SetPlacement(const std::vector<int>& cpus, const bool& bind_memory);
+
+  /**
+   * @brief dispatch a readable connection to the thread pool, or answer it
+   * with 503 if the server is overloaded
+   *
+   * @param fd the file descriptor of the socket
+   */
   void push(const int& fd);
 
+  /**
+   * @brief forget the HTTP/2 session of a connection as its socket is being
+   * closed
+   *
+   * @param fd the file descriptor of the socket
+   */
+  void OnDisconnected(const int& fd);
+
+  /**
+   * @brief close the HTTP/1.1 connections once they are idle, as the server
+   * is stopping
+   *
+   */
+  void Drain() { is_draining_.store(true, std::memory_order_relaxed); }
+
  private:
+  friend BenchAccess;
+
   Server* const server_;
-  std::unordered_map<std::string, ControllerFunc> controllers_;
+  EventLoop* const event_loop_;
+
+  // the latency histograms of a route, one per status code, created on the
+  // first response with that status
+  struct RouteMetrics {
+    std::string route;
+    std::string method;
+    std::array<std::atomic<Histogram*>, kStatusCodeNum> durations{};
+  };
+
+  struct Route {
+    ControllerFunc func;
+    CoroutineControllerFunc coroutine;     // set instead of func
+    std::shared_ptr<ResponseCache> cache;  // nullptr if not cached
+    std::shared_ptr<RouteMetrics> metrics;
+  };
+  std::unordered_map<std::string, Route> controllers_;
+
+  struct Mount {
+    std::shared_ptr<StaticDirectory> directory;
+    std::shared_ptr<RouteMetrics> metrics;
+  };
+  std::vector<Mount> mounts_;  // in the order they were registered
+
+  // when a request was parsed and routed, for the metrics and the tracer
+  struct RequestTiming {
+    std::chrono::steady_clock::time_point parse_begin;
+    std::chrono::steady_clock::time_point routed;
+    bool is_traced;
+    std::string trace_args;
+  };
+
+  // an HTTP/1.1 connection while a worker serves it or a request is partly
+  // received: its bytes not parsed yet, and whether it may be read again
+  struct Connection {
+    explicit Connection(BufferPool& pool) : input(pool) {}
+    BufferChain input;
+    bool is_serving = false;      // a worker (or a coroutine) owns it
+    bool is_ready_again = false;  // readable again while it was served
+  };
+  std::mutex connections_mutex_;
+  std::unordered_map<int, std::shared_ptr<Connection>> connections_;
+
+  // how the connection goes on once a coroutine controller has responded
+  struct Continuation {
+    int fd;
+    bool is_traced;
+    std::shared_ptr<Connection> connection;
+  };
+  struct ServeTask;
+
+  // the connections speaking HTTP/2
+  std::mutex http2_mutex_;
+  std::unordered_map<int, Http2ConnectionPtr> http2_connections_;
+  std::atomic<size_t> http2_num_;  // spares the lookup while there are none
+
+  std::atomic<bool> is_draining_;
+
+  CoDel codel_;
+  std::atomic<size_t> max_queue_size_;
+  std::shared_ptr<const std::string> overload_response_;
+
+  // where the time of a request goes
+  Histogram& queue_delay_;
+  Histogram& parse_duration_;
+  Histogram& controller_duration_;
+  Histogram& send_duration_;
+  Histogram& unmatched_duration_;
+  Counter& rejected_num_;
+
+  /**
+   * @brief get the latency histogram of a route for a status code
+   *
+   * @param metrics the metrics of the route
+   * @param status the status code (nullptr for responses from the cache)
+   * @return the histogram
+   */
+  Histogram& RouteDuration(RouteMetrics& metrics,
+                           const HttpStatusCode* const status);
+
+  /**
+   * @brief answer a readable connection (runs in a worker), unless another
+   * worker is serving it
+   *
+   * @param fd the file descriptor of the socket
+   * @param is_traced whether the requests are traced
+   */
+  void Serve(const int& fd, const bool& is_traced);
+
+  /**
+   * @brief parse and answer the requests of an HTTP/1.1 connection until no
+   * more bytes are available
+   *
+   * @param fd the file descriptor of the socket
+   * @param connection the connection, owned by the caller
+   * @param is_traced whether the requests are traced
+   */
+  void ServeConnection(const int& fd,
+                       const std::shared_ptr<Connection>& connection,
+                       const bool& is_traced);
+
+  /**
+   * @brief forget a connection being closed, unless it was forgotten already
+   *
+   * @param fd the file descriptor of the socket
+   * @param connection the connection, owned by the caller
+   */
+  void Forget(const int& fd, const std::shared_ptr<Connection>& connection);
+
+  /**
+   * @brief send the response of a controller and record its metrics
+   *
+   * @param fd the file descriptor of the socket
+   * @param response the response
+   * @param status_code the status code
+   * @param timing when the request was parsed and routed
+   * @param metrics the metrics of the route
+   */
+  void Respond(const int& fd, const HttpResponse& response,
+               const HttpStatusCode& status_code, const RequestTiming& timing,
+               RouteMetrics& metrics);
+
+  /**
+   * @brief run a coroutine controller, it ends with how the connection goes
+   * on
+   *
+   * @param route the route
+   * @param request the request
+   * @param fd the file descriptor of the socket
+   * @param timing when the request was parsed and routed
+   * @param connection the connection, owned by the coroutine
+   * @return the coroutine, not started yet
+   */
+  ServeTask ServeCoroutine(const Route* const route, HttpRequestPtr request,
+                           const int fd, const RequestTiming timing,
+                           const std::shared_ptr<Connection> connection);
+
+  /**
+   * @brief find the directory serving a request
+   *
+   * @param request the request
+   * @return the mount of the directory (nullptr if there is none)
+   */
+  const Mount* FindMount(const HttpRequest& request) const;
+
+  /**
+   * @brief create the HTTP/2 session of a connection
+   *
+   * @param fd the file descriptor of the socket
+   * @return the session, not registered yet
+   */
+  Http2ConnectionPtr CreateHttp2(const int& fd);
+
+  /**
+   * @brief hand an HTTP/1.1 connection over to its HTTP/2 session
+   *
+   * @param fd the file descriptor of the socket
+   * @param connection the connection, owned by the caller
+   * @param http2 the session
+   * @param received the bytes received but not parsed yet
+   */
+  void SwitchToHttp2(const int& fd,
+                     const std::shared_ptr<Connection>& connection,
+                     const Http2ConnectionPtr& http2, std::string&& received);
+
+  /**
+   * @brief process the received bytes of an HTTP/2 connection
+   *
+   * @param connection the session
+   * @param received the bytes received already
+   */
+  void ServeHttp2(const Http2ConnectionPtr& connection,
+                  std::string&& received);
+
+  /**
+   * @brief switch a connection to HTTP/2 as its request asked for it
+   *
+   * @param fd the file descriptor of the socket
+   * @param connection the connection, owned by the caller
+   * @param request the request, with the Upgrade: h2c header
+   */
+  void UpgradeHttp2(const int& fd,
+                    const std::shared_ptr<Connection>& connection,
+                    HttpRequestPtr& request);
+
+  /**
+   * @brief answer the request of an HTTP/2 stream (runs in a worker)
+   *
+   * @param connection the session
+   * @param stream_id the stream
+   * @param request the request
+   */
+  void ServeStream(const Http2ConnectionPtr& connection,
+                   const uint32_t& stream_id, HttpRequestPtr&& request);
+
+  /**
+   * @brief run a coroutine controller for an HTTP/2 stream
+   *
+   * @param route the route
+   * @param connection the session
+   * @param stream_id the stream
+   * @param request the request
+   * @param begin when the request was dispatched
+   * @return the coroutine, already started
+   */
+  DetachedTask ServeCoroutineStream(
+      const Route* const route, const Http2ConnectionPtr connection,
+      const uint32_t stream_id, HttpRequestPtr request,
+      const std::chrono::steady_clock::time_point begin);
+
+  /**
+   * @brief whether a new connection can be put into the queue
+   *
+   * @return true if the connection is admitted
+   */
+  bool Admit() const;
+
+  /**
+   * @brief answer a connection with a pre-serialized response and close it
+   *
+   * @param fd the file descriptor of the socket
+   * @param response the serialized response
+   */
+  void Reject(const int& fd,
+              const std::shared_ptr<const std::string>& response);
 };
 
 class Server {
  public:
   Server();
   Logger logger;
+  Metrics metrics;
+  Tracer tracer;
 
   /**
    * @brief register a controller
@@ -64,26 +410,272 @@ class Server {
                              const ControllerFunc&& func);
 
   /**
-   * @brief Set the thread number
+   * @brief register a controller whose responses are cached: a fresh cached
+   * response is sent without calling the controller, concurrent misses wait
+   * for a single controller call, and a stale response is sent while it is
+   * being refreshed (the controller must always call the callback)
+   *
+   * @param method the HTTP method
+   * @param path the URL path
+   * @param func the controller function
+   * @param policy how the responses are cached
+   */
+  Server& RegisterController(const HttpMethod& method, const std::string& path,
+                             const ControllerFunc&& func,
+                             const CachePolicy& policy);
+
+  /**
+   * @brief register a coroutine controller: it runs in a worker until it
+   * first waits (on Readable / Writable, Sleep or Offload), and is then
+   * resumed on the event loop of the connection, without blocking a thread.
+   * The next requests of the connection are parsed once it has responded.
+   *
+   * @param method the HTTP method
+   * @param path the URL path
+   * @param func the controller coroutine, co_returning the response (with its
+   * status)
+   */
+  Server& RegisterController(const HttpMethod& method, const std::string& path,
+                             const CoroutineControllerFunc&& func);
+
+  /**
+   * @brief serve the files of a directory tree under a URL prefix, for the GET
+   * and HEAD requests no controller matches. The tree is indexed here and
+   * re-indexed when it changes (inotify), the requests are resolved without
+   * touching the filesystem and the recently used files are kept open.
+   *
+   * @param url_prefix the URL path, e.g. "/static"
+   * @param root the directory
+   * @param max_open_files the maximum number of files kept open
+   */
+  Server& ServeDirectory(
+      const std::string& url_prefix, const std::string& root,
+      const size_t& max_open_files = StaticDirectory::kDefaultMaxOpenFiles);
+
+  /**
+   * @brief Set the thread number (shared among the worker groups of the event
+   * loops)
    *
    * @param num the thread number
    */
   Server& SetThreadNum(const uint32_t& num);
 
   /**
-   * @brief Start the server (It's a blocking function)
+   * @brief Let the thread number change with the load: threads are added when
+   * connections wait too long or threads are blocked in controllers, and idle
+   * threads are retired (the bounds are shared among the worker groups of the
+   * event loops)
+   *
+   * @param min_num the minimum thread number
+   * @param max_num the maximum thread number
+   */
+  Server& SetAutoScale(const uint32_t& min_num, const uint32_t& max_num);
+
+  /**
+   * @brief Let the thread number change with the load
+   *
+   * @param policy the auto-scaling policy
+   */
+  Server& SetAutoScale(const ThreadPool::AutoScalePolicy& policy);
+
+  /**
+   * @brief Set the maximum number of connections waiting for a thread, the
+   * following ones are answered with 503
+   *
+   * @param num the maximum queue length (0 means unlimited)
+   */
+  Server& SetMaxQueueSize(const size_t& num);
+
+  /**
+   * @brief Set the acceptable queueing delay, if the minimum delay stays above
+   * the target for a whole interval, new connections are answered with 503
+   *
+   * @param target the acceptable standing queue delay
+   * @param interval the window in which the minimum queue delay is taken
+   */
+  Server& SetQueueDelayTarget(const std::chrono::milliseconds& target,
+                              const std::chrono::milliseconds& interval =
+                                  std::chrono::milliseconds(100));
+
+  /**
+   * @brief Set the Retry-After value of the 503 response
+   *
+   * @param seconds the number of seconds
+   */
+  Server& SetRetryAfter(const uint32_t& seconds);
+
+  /**
+   * @brief Set the number of event loops, every loop has its own worker group
+   *
+   * @param num the number of event loops (0 means one per entry of the
+   * loop_cpus of the thread placement)
+   */
+  Server& SetEventLoopNum(const uint32_t& num);
+
+  /**
+   * @brief Pin the event loops, their worker groups and the logger to CPU sets
+   *
+   * @param placement the CPU sets
+   */
+  Server& SetThreadPlacement(const ThreadPlacement& placement);
+
+  /**
+   * @brief Set the I/O backend of the event loops (falls back to epoll if the
+   * kernel doesn't support io_uring)
+   *
+   * @param backend the backend
+   */
+  Server& SetIoBackend(const IoBackend& backend);
+
+  /**
+   * @brief Serve the metrics in the Prometheus text format
+   *
+   * @param path the URL path
+   */
+  Server& EnableMetrics(const std::string& path = "/metrics");
+
+  /**
+   * @brief Trace one request out of one_in and serve the recent spans in the
+   * Chrome trace event format
+   *
+   * @param one_in trace one request out of one_in
+   * @param path the URL path
+   */
+  Server& EnableTracing(const uint32_t& one_in,
+                        const std::string& path = "/debug/trace");
+
+  /**
+   * @brief Record the received bytes of every connection, with their arrival
+   * time, and when the responses are sent, to a capture file that
+   * HTTPSimple_replay plays back
+   *
+   * @param path the path of the capture file
+   * @param max_size the size of the file after which the recording stops
+   */
+  Server& SetCapture(const std::string& path,
+                     const uint64_t& max_size = uint64_t(1) << 30);
+
+  /**
+   * @brief Run the server in several worker processes under a supervisor,
+   * which restarts the workers that die and upgrades the binary without
+   * closing the listening sockets on SIGUSR2 (see Supervisor). A worker that
+   * receives SIGTERM stops accepting, closes its HTTP/1.1 connections once
+   * they are idle and exits when they are all closed or the drain timeout
+   * expires.
+   *
+   * @param num the number of worker processes (0 means a single process)
+   * @param drain_timeout how long a stopping worker waits for its connections
+   */
+  Server& SetWorkerProcessNum(const uint32_t& num,
+                              const std::chrono::seconds& drain_timeout =
+                                  Supervisor::kDefaultDrainTimeout);
+
+  /**
+   * @brief Add a listening address, all of them are served by the same event
+   * loops:
+   * - "unix:/run/app.sock", a Unix domain socket (a stale socket file is
+   *   replaced)
+   * - "unix:@app", a Unix domain socket in the abstract namespace
+   * - "[::]:8080", IPv6 (accepting IPv4 too if the address is "::")
+   * - "0.0.0.0:8080", IPv4
+   *
+   * @param address the address
+   */
+  Server& AddListener(const std::string& address);
+
+  /**
+   * @brief Start the server on the added listeners and an IPv4 port (It's a
+   * blocking function)
    *
    * @param port the listening port
    */
   void Listen(const uint16_t& port);
 
+  /**
+   * @brief Start the server on the added listeners (It's a blocking function)
+   *
+   */
+  void Listen();
+
  private:
   friend Router;
   friend HttpRequest;
   friend HttpResponse;
+  friend EventLoop;
+  friend EpollEventLoop;
+  friend UringEventLoop;
+
+  /**
+   * @brief create, bind and listen on the socket of an address (exits if it
+   * fails)
+   *
+   * @param address the address, see AddListener()
+   * @return the listening socket
+   */
+  int OpenListener(const std::string& address);
+
+  /**
+   * @brief create the event loops and apply the settings to their routers
+   *
+   * @param sockfds the listening sockets
+   * @return whether the event loops accept the connections themselves
+   */
+  bool InitEventLoops(const std::vector<int>& sockfds);
+
+  /**
+   * @brief stop accepting, wait for the connections to be closed and exit
+   * (in a worker process)
+   *
+   */
+  [[noreturn]] void Drain();
+
+  /**
+   * @brief accept a connection and add it to an event loop
+   *
+   * @param sockfd the listening socket
+   */
+  void AcceptConnection(const int& sockfd);
+
+  /**
+   * @brief record the address of a new connection
+   *
+   * @param fd the file descriptor of the socket
+   * @param client_addr the address of the peer
+   * @param addr_size the size of the address
+   */
+  void OnConnected(const int& fd, const sockaddr_storage& client_addr,
+                   const socklen_t& addr_size);
+
+  /**
+   * @brief forget a connection once its socket is closed
+   *
+   * @param fd the file descriptor of the socket
+   */
+  void OnDisconnected(const int& fd);
+
+  /**
+   * @brief choose the event loop of a new connection, preferring the loop
+   * pinned to the CPU that received it
+   *
+   * @param fd the file descriptor of the socket
+   * @return the event loop
+   */
+  EventLoop& SelectEventLoop(const int& fd);
 
-  static const int kMaxEpollEvents = 64;
-  std::unique_ptr<Router> router_;
-  std::unique_ptr<std::thread> task_parser_;
+  // settings replayed on the router of every event loop, the second param is
+  // the number of event loops
+  std::vector<std::function<void(Router&, const uint32_t&)>> router_settings_;
+  uint32_t event_loop_num_;
+  uint32_t worker_process_num_;
+  std::chrono::seconds drain_timeout_;
+  IoBackend io_backend_;
+  ThreadPlacement placement_;
+  std::vector<std::string> listen_addresses_;
+  std::vector<std::unique_ptr<EventLoop>> event_loops_;
+  uint32_t next_event_loop_;
   std::unordered_map<int, std::string> client_addrs_;
+  std::atomic<int64_t> connection_num_;
+  std::string capture_path_;
+  uint64_t capture_max_size_;
+  Capture capture_;
 };
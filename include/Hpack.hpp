@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a header field of HTTP/2, the names are lowercase
+using HeaderField = std::pair<std::string, std::string>;
+using HeaderList = std::vector<HeaderField>;
+
+/**
+ * @brief The static and the dynamic table of HPACK (RFC 7541), addressed by a
+ * single index space starting at 1
+ */
+class HpackTable {
+ public:
+  static constexpr size_t kDefaultMaxSize = 4096;
+
+  explicit HpackTable(const size_t& max_size = kDefaultMaxSize)
+      : size_(0), max_size_(max_size) {}
+
+  /**
+   * @brief Get the field at an index
+   *
+   * @param index the index
+   * @return the field (nullptr if the index is out of range)
+   */
+  const HeaderField* Get(const size_t& index) const;
+
+  /**
+   * @brief Find a field, or at least its name
+   *
+   * @param field the field
+   * @param is_exact whether the value matched too
+   * @return the index (0 if neither was found)
+   */
+  size_t Find(const HeaderField& field, bool& is_exact) const;
+
+  /**
+   * @brief Insert a field into the dynamic table, evicting the oldest ones
+   *
+   * @param field the field
+   */
+  void Add(const HeaderField& field);
+
+  /**
+   * @brief Change the maximum size of the dynamic table, evicting the oldest
+   * fields
+   *
+   * @param max_size the new maximum size
+   */
+  void SetMaxSize(const size_t& max_size);
+
+  /**
+   * @brief Get the maximum size of the dynamic table
+   *
+   * @return the maximum size
+   */
+  size_t max_size() const { return max_size_; }
+
+ private:
+  // the fields of the dynamic table, the newest first
+  std::deque<HeaderField> fields_;
+  size_t size_;  // the size of the fields (their lengths + 32 each)
+  size_t max_size_;
+};
+
+/**
+ * @brief Decodes the header blocks of a connection, keeping the dynamic table
+ * in sync with the encoder of the peer
+ */
+class HpackDecoder {
+ public:
+  /**
+   * @brief Create a decoder
+   *
+   * @param max_table_size the SETTINGS_HEADER_TABLE_SIZE sent to the peer
+   */
+  explicit HpackDecoder(
+      const size_t& max_table_size = HpackTable::kDefaultMaxSize)
+      : table_(max_table_size), max_table_size_(max_table_size) {}
+
+  /**
+   * @brief Decode a header block
+   *
+   * @param block the header block
+   * @param fields the decoded fields (appended)
+   * @return false if the block is malformed (a connection error, the table
+   * can't be trusted any more)
+   */
+  bool Decode(const std::string& block, HeaderList& fields);
+
+ private:
+  HpackTable table_;
+  const size_t max_table_size_;
+};
+
+/**
+ * @brief Encodes the header blocks of a connection, the blocks must be sent in
+ * the order they are encoded
+ */
+class HpackEncoder {
+ public:
+  /**
+   * @brief Apply the SETTINGS_HEADER_TABLE_SIZE of the peer (signalled at the
+   * start of the next block)
+   *
+   * @param size the size
+   */
+  void SetMaxTableSize(const size_t& size);
+
+  /**
+   * @brief Encode a header block
+   *
+   * @param fields the fields, with lowercase names
+   * @param block the encoded block (appended)
+   */
+  void Encode(const HeaderList& fields, std::string& block);
+
+ private:
+  HpackTable table_;
+  bool is_size_update_pending_ = false;
+};
+
+/**
+ * @brief Decode a Huffman encoded string of HPACK
+ *
+ * @param data the encoded bytes
+ * @param size the number of bytes
+ * @param output the decoded string (appended)
+ * @return false if it is malformed
+ */
+bool HuffmanDecode(const uint8_t* data, const size_t& size,
+                   std::string& output);
+
+/**
+ * @brief Huffman encode a string for HPACK
+ *
+ * @param input the string
+ * @param output the encoded bytes (appended)
+ */
+void HuffmanEncode(const std::string& input, std::string& output);
+
+/**
+ * @brief Get the length of a string once Huffman encoded
+ *
+ * @param input the string
+ * @return the number of bytes
+ */
+size_t HuffmanEncodedSize(const std::string& input);
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Hpack.hpp"
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+
+class EventLoop;
+
+/**
+ * @brief The HTTP/2 (RFC 7540) session of a cleartext connection (h2c),
+ * started by the client connection preface (prior knowledge) or upgraded from
+ * HTTP/1.1 (Upgrade: h2c)
+ *
+ * The frames are parsed as they are received and the complete requests of the
+ * streams are handed to a dispatch function. Their responses can be sent from
+ * any thread, in any order, each stream within the flow control windows of the
+ * peer, so a slow response doesn't hold the others back.
+ */
+class Http2Connection : public std::enable_shared_from_this<Http2Connection> {
+ public:
+  // called with every complete request, while the connection is locked: it
+  // must hand the request over instead of responding in place
+  using DispatchFunc = std::function<void(
+      const std::shared_ptr<Http2Connection>&, const uint32_t&,
+      HttpRequestPtr&&)>;
+
+  enum ErrorCode : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    SETTINGS_TIMEOUT = 0x4,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+  };
+
+  // the client connection preface, the same bytes as "PRI * HTTP/2.0"
+  static constexpr char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  static constexpr size_t kPrefaceSize = sizeof(kPreface) - 1;
+
+  Http2Connection(EventLoop* const event_loop, const int& fd,
+                  DispatchFunc&& dispatch);
+
+  /**
+   * @brief Start the session, the client connection preface comes next
+   *
+   */
+  void Start();
+
+  /**
+   * @brief Start the session upgraded from HTTP/1.1: send 101 Switching
+   * Protocols, the request becomes stream 1, the client connection preface
+   * comes next
+   *
+   * @param settings the HTTP2-Settings header of the request
+   * @param request the request (taken if the upgrade succeeds)
+   * @return false if the settings are malformed, nothing was sent
+   */
+  bool Upgrade(const std::string& settings, HttpRequestPtr& request);
+
+  /**
+   * @brief Process the received bytes, and receive and process the connection
+   * until no more bytes are available (runs in a worker). The connection is
+   * closed if the peer closed it, or if it broke the protocol.
+   *
+   * @param received the bytes received already
+   * @return the error code sent in GOAWAY if the peer broke the protocol
+   * (NO_ERROR otherwise)
+   */
+  ErrorCode Serve(std::string&& received);
+
+  /**
+   * @brief Send the response of a stream (from any thread)
+   *
+   * @param stream_id the stream
+   * @param response the response
+   * @param status_code the status code
+   * @return false if the stream or the connection is closed
+   */
+  bool Respond(const uint32_t& stream_id, const HttpResponse& response,
+               const HttpStatusCode& status_code);
+
+  /**
+   * @brief Forget the connection as its socket is being closed, the responses
+   * sent from now on are dropped
+   *
+   */
+  void OnClosed();
+
+  /**
+   * @brief Get the file descriptor of the socket
+   *
+   * @return the file descriptor
+   */
+  int fd() const { return fd_; }
+
+ private:
+  enum FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+  };
+
+  struct Stream {
+    HttpRequestPtr request;  // being received, nullptr once dispatched
+    bool is_head = false;    // the response has no body
+    bool is_responding = false;
+    int64_t send_window = 0;
+    std::string body;  // the body of the response
+    size_t sent = 0;   // the bytes of the body sent so far
+  };
+
+  /**
+   * @brief parse and process the frames in the input
+   *
+   * @return the connection error (NO_ERROR if none)
+   */
+  ErrorCode Process();
+
+  /**
+   * @brief process a frame
+   *
+   * @param type the type
+   * @param flags the flags
+   * @param stream_id the stream
+   * @param payload the payload
+   * @param length the length of the payload
+   * @return the connection error (NO_ERROR if none)
+   */
+  ErrorCode ProcessFrame(const uint8_t& type, const uint8_t& flags,
+                         const uint32_t& stream_id, const char* payload,
+                         const size_t& length);
+
+  /**
+   * @brief process a complete header block
+   *
+   * @param stream_id the stream
+   * @param is_end_stream whether the request ends with it
+   * @return the connection error (NO_ERROR if none)
+   */
+  ErrorCode ProcessHeaderBlock(const uint32_t& stream_id,
+                               const bool& is_end_stream);
+
+  /**
+   * @brief apply the settings of the peer
+   *
+   * @param payload the payload of a SETTINGS frame
+   * @param length the length of the payload
+   * @return the connection error (NO_ERROR if none)
+   */
+  ErrorCode ApplySettings(const char* payload, const size_t& length);
+
+  /**
+   * @brief hand the request of a stream over as it's complete
+   *
+   * @param stream_id the stream
+   * @param stream the stream
+   */
+  void Dispatch(const uint32_t& stream_id, Stream& stream);
+
+  /**
+   * @brief write as much of the response bodies as the flow control windows
+   * allow, forgetting the streams that are done
+   *
+   */
+  void WriteData();
+
+  /**
+   * @brief append the SETTINGS of the server to the output, with the window
+   * of the connection
+   *
+   */
+  void WriteSettings();
+
+  /**
+   * @brief append a frame to the output
+   *
+   * @param type the type
+   * @param flags the flags
+   * @param stream_id the stream
+   * @param payload the payload
+   * @param length the length of the payload
+   */
+  void WriteFrame(const uint8_t& type, const uint8_t& flags,
+                  const uint32_t& stream_id, const char* payload,
+                  const size_t& length);
+
+  /**
+   * @brief append a RST_STREAM frame to the output and forget the stream
+   *
+   * @param stream_id the stream
+   * @param error the error code
+   */
+  void ResetStream(const uint32_t& stream_id, const ErrorCode& error);
+
+  /**
+   * @brief send the output, the mutex must be held so that the frames are sent
+   * in the order they are written
+   *
+   */
+  void SendOutput();
+
+  EventLoop* const event_loop_;
+  const int fd_;
+  const DispatchFunc dispatch_;
+
+  std::mutex mutex_;
+  bool is_closed_ = false;
+  bool is_preface_received_ = false;
+  std::string input_;   // the bytes not parsed yet
+  std::string output_;  // the frames not sent yet
+
+  HpackDecoder decoder_;
+  HpackEncoder encoder_;
+  std::map<uint32_t, Stream> streams_;  // the open streams
+  uint32_t last_stream_id_ = 0;
+
+  // a header block continued by CONTINUATION frames
+  uint32_t continued_stream_id_ = 0;
+  bool is_continued_end_stream_ = false;
+  std::string header_block_;
+
+  int64_t send_window_;          // of the connection
+  int64_t initial_send_window_;  // of new streams
+  size_t max_send_frame_size_;
+  size_t received_num_ = 0;  // the DATA bytes to give back to the peer's window
+};
+
+using Http2ConnectionPtr = std::shared_ptr<Http2Connection>;
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Coroutine.hpp"
+#include "HttpRequest.hpp"
+
+// a response from an upstream server
+struct ClientResponse {
+  int status = 0;     // 0 if the request failed
+  std::string error;  // why it failed
+  std::unordered_map<std::string, std::string> headers;
+  std::string body;
+
+  /**
+   * @brief Get a header, the name is case insensitive
+   *
+   * @param name the name of the header
+   * @return the value (empty if there isn't one)
+   */
+  std::string Header(const std::string& name) const;
+};
+
+using ClientCallback = std::function<void(ClientResponse&&)>;
+using ClientHeaders = std::unordered_map<std::string, std::string>;
+
+/**
+ * @brief A non-blocking HTTP/1.1 client of an upstream server, keeping a pool
+ * of keep-alive connections to it so that a request doesn't pay for a connect
+ * handshake
+ *
+ * The waits for the upstream are done by the event loop of the request, so
+ * neither the coroutine controllers nor the worker threads are held while the
+ * upstream is slow. Outside of the threads of a server, the requests block.
+ * It must outlive its requests.
+ */
+class HttpClient {
+ public:
+  /**
+   * @brief Create the client of an upstream server
+   *
+   * @param host the host name or address of the server (resolved once, here)
+   * @param port the port of the server
+   */
+  HttpClient(const std::string& host, const uint16_t& port);
+  ~HttpClient();
+
+  HttpClient(const HttpClient&) = delete;
+  HttpClient& operator=(const HttpClient&) = delete;
+
+  /**
+   * @brief Set the maximum number of idle connections kept in the pool
+   *
+   * @param num the maximum number (default 16)
+   * @return HttpClient& the client itself
+   */
+  HttpClient& SetMaxIdle(const size_t& num);
+
+  /**
+   * @brief Set how long a request may take, from connecting to the last byte
+   * of the response
+   *
+   * @param timeout the timeout (default 10s)
+   * @return HttpClient& the client itself
+   */
+  HttpClient& SetTimeout(const std::chrono::milliseconds& timeout);
+
+  /**
+   * @brief Send a request and wait for its response
+   *
+   * @param method the method
+   * @param path the path, with the query string
+   * @param body the body
+   * @param headers the headers (Host and Content-Length are added)
+   * @return the task, whose result has status 0 if the request failed
+   */
+  Task<ClientResponse> Request(HttpMethod method, std::string path,
+                               std::string body = std::string(),
+                               ClientHeaders headers = ClientHeaders());
+
+  /**
+   * @brief Send a request and call a function with its response, in the worker
+   * group of the calling thread (e.g. from a callback controller, which calls
+   * its own callback from there)
+   *
+   * @param method the method
+   * @param path the path, with the query string
+   * @param callback the function, the response has status 0 if the request
+   * failed
+   * @param body the body
+   * @param headers the headers (Host and Content-Length are added)
+   */
+  void Request(const HttpMethod& method, const std::string& path,
+               ClientCallback&& callback, std::string body = std::string(),
+               ClientHeaders headers = ClientHeaders());
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  class ResponseParser;
+
+  // how a request went on a connection
+  enum class Outcome {
+    DONE,    // the response was received
+    STALE,   // the pooled connection was closed by the upstream before
+             // anything was received, the request can be retried
+    FAILED,  // the request failed
+  };
+
+  /**
+   * @brief take a connection from the pool
+   *
+   * @return the file descriptor of the socket (-1 if there is none)
+   */
+  int TakeIdle();
+
+  /**
+   * @brief put a connection back into the pool, or close it if it's full
+   *
+   * @param fd the file descriptor of the socket
+   */
+  void Release(const int& fd);
+
+  /**
+   * @brief open a new connection
+   *
+   * @param deadline when to give up
+   * @param error why it failed
+   * @return the file descriptor of the socket (-1 on failure)
+   */
+  Task<int> Connect(const Clock::time_point deadline, std::string& error);
+
+  /**
+   * @brief send a request on a connection and read its response
+   *
+   * @param fd the file descriptor of the socket
+   * @param request the serialized request
+   * @param is_head whether the response has no body
+   * @param deadline when to give up
+   * @param response the response
+   * @param is_reusable whether the connection can be kept
+   * @return how it went
+   */
+  Task<Outcome> Exchange(const int fd, const std::string& request,
+                         const bool is_head, const Clock::time_point deadline,
+                         ClientResponse& response, bool& is_reusable);
+
+  /**
+   * @brief wait until a socket is ready, or the deadline has passed
+   *
+   * @param fd the file descriptor of the socket
+   * @param events EPOLLIN or EPOLLOUT
+   * @param deadline when to give up
+   * @return whether it's ready
+   */
+  static Task<bool> Wait(const int fd, const uint32_t events,
+                         const Clock::time_point deadline);
+
+  std::string host_header_;
+  sockaddr_storage addr_;
+  socklen_t addr_len_;  // 0 if the host couldn't be resolved
+  size_t max_idle_;
+  std::chrono::milliseconds timeout_;
+
+  std::mutex mutex_;
+  std::vector<int> idle_;  // the most recently used last
+};
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <istream>
 #include <memory>
 #include <string>
 #include <unordered_map>
 
+#include "BufferPool.hpp"
 #include "Logger.hpp"
 
 enum HttpMethod {
@@ -18,8 +20,9 @@ enum HttpMethod {
   PATCH
 };
 
-class Server;
+class EventLoop;
 class Router;
+struct BenchAccess;
 
 struct HttpRequest {
  public:
@@ -31,17 +34,37 @@ struct HttpRequest {
 
  private:
   friend Router;
+  friend BenchAccess;
+
+  // the request line was the client connection preface of HTTP/2, the bytes
+  // are left in the input for the HTTP/2 session
+  bool is_http2_preface = false;
+  // the connection was closed while parsing
+  bool is_closed = false;
 
   /**
-   * @brief Parse a HTTP request from a socket
+   * @brief Parse a HTTP request from a socket: the bytes received already are
+   * parsed first, then more are received until a request is complete or no
+   * more bytes are available
    *
-   * @param remaining unprocessed bytes of the socket (the last recv() gets more
-   * bytes than necessary)
-   * @param server the server
+   * @param input the bytes of the socket received but not parsed yet (the
+   * bytes of an incomplete request are left there)
+   * @param event_loop the event loop the socket belongs to
    * @param fd the file descriptor of the socket
    * @return whether get a request successfully
    */
-  bool parse(std::string &remaining, Server *const server, const int fd);
+  bool parse(BufferChain &input, EventLoop *const event_loop, const int fd);
 };
 
 using HttpRequestPtr = std::unique_ptr<HttpRequest>;
+
+/**
+ * @brief Parse the header lines of a HTTP message (request or response) up to
+ * the empty line ending them
+ *
+ * @param input the message, positioned after the start line
+ * @param headers the parsed headers
+ * @return whether the empty line was reached
+ */
+bool ParseHeaders(std::istream &input,
+                  std::unordered_map<std::string, std::string> &headers);
@@ -13,15 +13,22 @@ enum class HttpStatusCode {
   FORBIDDEN = 403,
   NOT_FOUND = 404,
   INTERNAL_SERVER_ERROR = 500,
+  BAD_GATEWAY = 502,
   SERVICE_UNAVAILABLE = 503
 };
 
+class EventLoop;
+class Http2Connection;
+class ResponseCache;
 class Router;
-class Server;
+class StaticDirectory;
+struct BenchAccess;
 
 struct HttpResponse {
  public:
   std::unordered_map<std::string, std::string> headers;
+  // the status code of a response returned by a coroutine controller
+  HttpStatusCode status = HttpStatusCode::OK;
 
   /**
    * @brief Set the Content Type
@@ -54,6 +61,10 @@ struct HttpResponse {
 
  private:
   friend Router;
+  friend Http2Connection;
+  friend ResponseCache;
+  friend StaticDirectory;
+  friend BenchAccess;
 
   static const std::string http_version_string;
   static const std::unordered_map<HttpStatusCode, std::string>
@@ -62,15 +73,23 @@ struct HttpResponse {
   std::string body;
   std::filesystem::path filepath;
 
+  /**
+   * @brief Serialize the HTTP Response into the bytes sent on the wire
+   *
+   * @param status_code the HTTP status code
+   * @return the serialized response
+   */
+  std::string Serialize(const HttpStatusCode& status_code) const;
+
   /**
    * @brief Send the HTTP Response to the socket
    *
-   * @param server the server
+   * @param event_loop the event loop the socket belongs to
    * @param status_code the HTTP status code
    * @param fd the file descriptor of the socket
-   * @return whether the response was sent successfully
+   * @return whether the response was sent (or queued) successfully
    */
-  bool SendRequest(Server* const server, HttpStatusCode status_code,
+  bool SendRequest(EventLoop* const event_loop, HttpStatusCode status_code,
                    const int& fd);
 };
 
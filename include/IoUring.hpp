@@ -0,0 +1,271 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief A minimal io_uring wrapper (raw syscalls, one submitting thread)
+ */
+class IoUring {
+ public:
+  IoUring() = default;
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  ~IoUring() {
+    for (auto &buffer_ring : buffer_rings_) {
+      io_uring_buf_reg reg;
+      memset(&reg, 0, sizeof(reg));
+      reg.bgid = buffer_ring.group_id;
+      syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_PBUF_RING,
+              &reg, 1);
+      free(buffer_ring.ring);
+      free(buffer_ring.buffers);
+    }
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_) munmap(sq_ptr_, sq_size_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+  }
+
+  /**
+   * @brief Set up the rings
+   *
+   * @param entries the number of submission queue entries
+   * @return whether io_uring is available
+   */
+  bool Init(const unsigned &entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd_ < 0) {  // older kernels don't know the flags
+      params.flags = 0;
+      ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (ring_fd_ < 0) return false;
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    sq_ptr_ = Map(sq_size_, IORING_OFF_SQ_RING);
+    if (!sq_ptr_) return false;
+    cq_ptr_ = single_mmap ? sq_ptr_ : Map(cq_size_, IORING_OFF_CQ_RING);
+    if (!cq_ptr_) return false;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(Map(sqes_size_, IORING_OFF_SQES));
+    if (!sqes_) return false;
+
+    char *sq = static_cast<char *>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    sqe_tail_ = *sq_tail_;
+    return true;
+  }
+
+  /**
+   * @brief Whether the kernel supports all the given opcodes
+   *
+   * @param opcodes the opcodes
+   * @return true if all of them are supported
+   */
+  bool Supports(const std::vector<int> &opcodes) const {
+    const size_t probe_size =
+        sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    auto probe = static_cast<io_uring_probe *>(calloc(1, probe_size));
+    bool supported =
+        syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe,
+                256) == 0;
+    for (const auto opcode : opcodes)
+      supported = supported && opcode <= probe->last_op &&
+                  (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+  }
+
+  /**
+   * @brief Get a free submission queue entry, flushing the queue if it's full
+   *
+   * @return the zeroed entry
+   */
+  io_uring_sqe *GetSqe() {
+    if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+        sq_entries_) {
+      Submit(0);
+      if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+          sq_entries_)
+        return nullptr;
+    }
+    const unsigned index = sqe_tail_++ & sq_mask_;
+    sq_array_[index] = index;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  /**
+   * @brief Submit the pending entries and wait for completions
+   *
+   * @param wait_num the number of completions to wait for
+   * @return the number of submitted entries, or -errno
+   */
+  int Submit(const unsigned &wait_num) {
+    const unsigned to_submit = sqe_tail_ - *sq_tail_;
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+    if (!to_submit && !wait_num) return 0;
+    const int ret =
+        syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_num,
+                wait_num ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    return ret < 0 ? -errno : ret;
+  }
+
+  /**
+   * @brief Handle every available completion
+   *
+   * @param handler called with every completion entry
+   * @return the number of handled entries
+   */
+  template <typename F>
+  unsigned ForEachCqe(F &&handler) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    const unsigned count = tail - head;
+    for (; head != tail; head++) handler(cqes_[head & cq_mask_]);
+    __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  /**
+   * @brief Register a ring of provided buffers the kernel picks from when a
+   * recv is submitted with IOSQE_BUFFER_SELECT
+   *
+   * @param group_id the buffer group id
+   * @param entries the number of buffers (a power of 2)
+   * @param buffer_size the size of every buffer
+   * @return whether the ring was registered
+   */
+  bool RegisterBufferRing(const uint16_t &group_id, const uint16_t &entries,
+                          const uint32_t &buffer_size) {
+    BufferRing buffer_ring;
+    buffer_ring.group_id = group_id;
+    buffer_ring.entries = entries;
+    buffer_ring.buffer_size = buffer_size;
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (posix_memalign(reinterpret_cast<void **>(&buffer_ring.ring),
+                       page_size, entries * sizeof(io_uring_buf)))
+      return false;
+    memset(buffer_ring.ring, 0, entries * sizeof(io_uring_buf));
+    buffer_ring.buffers =
+        static_cast<char *>(malloc(size_t(entries) * buffer_size));
+    if (!buffer_ring.buffers) {
+      free(buffer_ring.ring);
+      return false;
+    }
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring.ring);
+    reg.ring_entries = entries;
+    reg.bgid = group_id;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+                &reg, 1)) {
+      free(buffer_ring.ring);
+      free(buffer_ring.buffers);
+      return false;
+    }
+    buffer_rings_.push_back(buffer_ring);
+    for (uint16_t i = 0; i < entries; i++) RecycleBuffer(group_id, i);
+    return true;
+  }
+
+  /**
+   * @brief Get a provided buffer
+   *
+   * @param group_id the buffer group id
+   * @param buffer_id the buffer id
+   * @return the buffer
+   */
+  char *Buffer(const uint16_t &group_id, const uint16_t &buffer_id) {
+    auto &buffer_ring = FindBufferRing(group_id);
+    return buffer_ring.buffers + size_t(buffer_id) * buffer_ring.buffer_size;
+  }
+
+  /**
+   * @brief Give a provided buffer back to the kernel
+   *
+   * @param group_id the buffer group id
+   * @param buffer_id the buffer id
+   */
+  void RecycleBuffer(const uint16_t &group_id, const uint16_t &buffer_id) {
+    auto &buffer_ring = FindBufferRing(group_id);
+    // the tail overlays the resv field of the first entry (io_uring_buf_ring
+    // can't be used in C++, its flexible array member is shifted)
+    uint16_t *tail_ptr = &buffer_ring.ring[0].resv;
+    const uint16_t tail = *tail_ptr;
+    io_uring_buf &buf = buffer_ring.ring[tail & (buffer_ring.entries - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(Buffer(group_id, buffer_id));
+    buf.len = buffer_ring.buffer_size;
+    buf.bid = buffer_id;
+    __atomic_store_n(tail_ptr, tail + 1, __ATOMIC_RELEASE);
+  }
+
+ private:
+  struct BufferRing {
+    uint16_t group_id;
+    uint16_t entries;
+    uint32_t buffer_size;
+    io_uring_buf *ring;
+    char *buffers;
+  };
+
+  void *Map(const size_t &size, const off_t &offset) {
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+  }
+
+  BufferRing &FindBufferRing(const uint16_t &group_id) {
+    for (auto &buffer_ring : buffer_rings_)
+      if (buffer_ring.group_id == group_id) return buffer_ring;
+    return buffer_rings_.front();
+  }
+
+  int ring_fd_ = -1;
+  void *sq_ptr_ = nullptr;
+  void *cq_ptr_ = nullptr;
+  size_t sq_size_ = 0;
+  size_t cq_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned sqe_tail_ = 0;  // entries handed out but not yet published
+
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+
+  std::vector<BufferRing> buffer_rings_;
+};
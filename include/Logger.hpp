@@ -1,16 +1,25 @@
 #pragma once
 
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
-#include <iomanip>
-#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <memory>
 #include <mutex>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <utility>
+#include <vector>
 
-#include "TaskQueue.hpp"
+#include "Affinity.hpp"
 
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
@@ -20,9 +29,16 @@
 #define ANSI_COLOR_CYAN "\x1b[36m"
 #define ANSI_COLOR_RESET "\x1b[0m"
 
+/**
+ * @brief An asynchronous logger: every thread formats its lines into its own
+ * lock-free ring buffer, and one writer thread drains all the rings into large
+ * write() calls on stdout or a rotating file
+ *
+ * Lines of one thread keep their order, lines of different threads may be
+ * interleaved out of order within a batch. When the ring of a thread is full,
+ * its lines are dropped instead of blocking it.
+ */
 class Logger {
-  std::unique_ptr<TaskQueue<const std::string&, void>> queue_;
-
  public:
   enum LogLevel {
     LOG_LEVEL_DEBUG,
@@ -33,45 +49,373 @@ class Logger {
     LOG_LEVEL_FATAL,
   };
 
-  Logger() {
-    queue_ = std::make_unique<TaskQueue<const std::string&, void>>(
-        [](int, const std::string& str) { std::cout << str; });
+  Logger()
+      : id_(next_id_++),
+        is_running_(true),
+        writer_([this]() { WriterLoop(); }) {}
+
+  ~Logger() {
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex_);
+      is_running_ = false;
+    }
+    writer_cv_.notify_one();
+    writer_.join();
+    Flush();
+    if (fd_ != STDOUT_FILENO) close(fd_);
+  }
+
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  /**
+   * @brief Set the lowest level that is logged, the other messages are
+   * discarded before being formatted
+   *
+   * @param level the level
+   */
+  void SetLevel(const LogLevel &level) { level_ = level; }
+
+  /**
+   * @brief Whether messages of a level are logged, to skip building them
+   *
+   * @param level the level
+   * @return true if they are logged
+   */
+  bool IsEnabled(const LogLevel &level) const { return level >= level_; }
+
+  /**
+   * @brief Set the size of the ring buffer of every thread logging from now
+   * on, the lines that don't fit are dropped
+   *
+   * @param size the size in bytes (rounded up to a power of 2)
+   */
+  void SetBufferSize(const size_t &size) {
+    size_t capacity = 1024;
+    while (capacity < size) capacity <<= 1;
+    buffer_size_ = capacity;
+  }
+
+  /**
+   * @brief Write the log to a file instead of stdout, rotating it when it
+   * becomes too large: path is renamed to path.1, path.1 to path.2, and so on
+   *
+   * @param path the path of the file
+   * @param max_size the size in bytes a file is rotated at (0 means never)
+   * @param max_files the number of rotated files that are kept
+   * @return whether the file could be opened
+   */
+  bool SetFile(const std::string &path, const uint64_t &max_size = 64 << 20,
+               const int &max_files = 5) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                        0644);
+    if (fd < 0) return false;
+    if (fd_ != STDOUT_FILENO) close(fd_);
+    fd_ = fd;
+    fd_is_tty_ = isatty(fd);
+    path_ = path;
+    max_file_size_ = max_size;
+    max_file_num_ = max_files;
+    file_size_ = lseek(fd_, 0, SEEK_END);
+    return true;
+  }
+
+  /**
+   * @brief Pin the writer thread to a CPU set
+   *
+   * @param cpus the CPU set (nothing is done if it is empty)
+   */
+  void SetPlacement(const std::vector<int> &cpus) {
+    PinThread(writer_.native_handle(), cpus);
   }
 
-  void Log(const LogLevel& level, const std::string& message) {
-    const auto now =
-        std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    std::stringstream ss;
-    ss << '[' << std::put_time(std::localtime(&now), "%F %T") << ']';
+  /**
+   * @brief get the number of lines dropped because a ring buffer was full
+   *
+   * @return the number of dropped lines
+   */
+  uint64_t dropped_num() const { return dropped_num_; }
+
+  void Log(const LogLevel &level, const std::string_view &message) {
+    if (level < level_) return;
+    const bool is_tty = fd_is_tty_;
+    const std::string_view tag = Tag(level, is_tty);
+    char timestamp[kTimestampSize];
+    Timestamp(timestamp);
+
+    Ring &ring = LocalRing();
+    const uint64_t size = kTimestampSize + tag.size() + message.size() + 1;
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    const uint64_t tail = ring.tail.load(std::memory_order_acquire);
+    if (ring.capacity - (head - tail) < size) {
+      ++dropped_num_;
+      return;
+    }
+    uint64_t pos = head;
+    ring.Write(pos, std::string_view(timestamp, kTimestampSize));
+    ring.Write(pos, tag);
+    ring.Write(pos, message);
+    ring.Write(pos, "\n");
+    ring.head.store(pos, std::memory_order_release);
+
+    if (level == LOG_LEVEL_FATAL) {  // the process is likely to exit
+      Flush();
+    } else if (head - tail + size > ring.capacity / 2) {
+      writer_cv_.notify_one();
+    }
+  }
+
+  void Debug(const std::string_view &message) {
+    Log(LOG_LEVEL_DEBUG, message);
+  }
+  void Info(const std::string_view &message) { Log(LOG_LEVEL_INFO, message); }
+  void Ok(const std::string_view &message) { Log(LOG_LEVEL_OK, message); }
+  void Warn(const std::string_view &message) { Log(LOG_LEVEL_WARN, message); }
+  void Error(const std::string_view &message) {
+    Log(LOG_LEVEL_ERROR, message);
+  }
+  void Fatal(const std::string_view &message) {
+    Log(LOG_LEVEL_FATAL, message);
+  }
+
+  /**
+   * @brief Write everything logged so far
+   *
+   */
+  void Flush() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Drain();
+  }
+
+ private:
+  // "[YYYY-mm-dd HH:MM:SS]"
+  static const size_t kTimestampSize = 21;
+  static const size_t kDefaultBufferSize = 256 << 10;
+  static constexpr auto kFlushInterval = std::chrono::milliseconds(20);
+
+  // a single-producer single-consumer byte ring of complete lines
+  struct Ring {
+    explicit Ring(const size_t &size)
+        : capacity(size), data(std::make_unique<char[]>(size)) {}
+
+    /**
+     * @brief copy bytes into the ring (the space must be free)
+     *
+     * @param pos the position to write at, advanced past the bytes
+     * @param bytes the bytes
+     */
+    void Write(uint64_t &pos, const std::string_view &bytes) {
+      const size_t offset = pos & (capacity - 1);
+      const size_t first = std::min(bytes.size(), capacity - offset);
+      memcpy(data.get() + offset, bytes.data(), first);
+      memcpy(data.get(), bytes.data() + first, bytes.size() - first);
+      pos += bytes.size();
+    }
+
+    const size_t capacity;
+    const std::unique_ptr<char[]> data;
+    alignas(64) std::atomic<uint64_t> head{0};  // written by the producer
+    alignas(64) std::atomic<uint64_t> tail{0};  // written by the consumer
+  };
+
+  static std::string_view Tag(const LogLevel &level, const bool &is_tty) {
     switch (level) {
       case LOG_LEVEL_DEBUG:
-        ss << " [" ANSI_COLOR_MAGENTA "DEBUG" ANSI_COLOR_RESET "] ";
-        break;
+        return is_tty ? " [" ANSI_COLOR_MAGENTA "DEBUG" ANSI_COLOR_RESET "] "
+                      : " [DEBUG] ";
       case LOG_LEVEL_INFO:
-        ss << " [" ANSI_COLOR_BLUE "INFO" ANSI_COLOR_RESET "]  ";
-        break;
+        return is_tty ? " [" ANSI_COLOR_BLUE "INFO" ANSI_COLOR_RESET "]  "
+                      : " [INFO]  ";
       case LOG_LEVEL_OK:
-        ss << " [" ANSI_COLOR_GREEN "OK" ANSI_COLOR_RESET "]    ";
-        break;
+        return is_tty ? " [" ANSI_COLOR_GREEN "OK" ANSI_COLOR_RESET "]    "
+                      : " [OK]    ";
       case LOG_LEVEL_WARN:
-        ss << " [" ANSI_COLOR_YELLOW "WARN" ANSI_COLOR_RESET "]  ";
-        break;
+        return is_tty ? " [" ANSI_COLOR_YELLOW "WARN" ANSI_COLOR_RESET "]  "
+                      : " [WARN]  ";
       case LOG_LEVEL_ERROR:
-        ss << " [" ANSI_COLOR_RED "ERROR" ANSI_COLOR_RESET "] ";
-        break;
-      case LOG_LEVEL_FATAL:
-        ss << " [" ANSI_COLOR_RED "FATAL" ANSI_COLOR_RESET "] ";
+        return is_tty ? " [" ANSI_COLOR_RED "ERROR" ANSI_COLOR_RESET "] "
+                      : " [ERROR] ";
+      default:
+        return is_tty ? " [" ANSI_COLOR_RED "FATAL" ANSI_COLOR_RESET "] "
+                      : " [FATAL] ";
+    }
+  }
+
+  /**
+   * @brief copy the timestamp of the current second, formatting it only when
+   * the second changes (a seqlock guards the cached text)
+   *
+   * @param timestamp where to copy it, kTimestampSize bytes
+   */
+  void Timestamp(char *const timestamp) {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    if (now.tv_sec != cached_second_.load(std::memory_order_relaxed) &&
+        timestamp_mutex_.try_lock()) {
+      if (now.tv_sec != cached_second_.load(std::memory_order_relaxed)) {
+        tm local;
+        localtime_r(&now.tv_sec, &local);
+        char text[sizeof(timestamp_words_)] = {};
+        strftime(text, sizeof(text), "[%F %T]", &local);
+        uint64_t words[kTimestampWords];
+        memcpy(words, text, sizeof(words));
+        timestamp_seq_.fetch_add(1, std::memory_order_relaxed);  // odd: writing
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kTimestampWords; i++)
+          timestamp_words_[i].store(words[i], std::memory_order_relaxed);
+        timestamp_seq_.fetch_add(1, std::memory_order_release);
+        cached_second_.store(now.tv_sec, std::memory_order_relaxed);
+      }
+      timestamp_mutex_.unlock();
+    }
+    uint64_t words[kTimestampWords];
+    for (;;) {
+      const uint64_t seq = timestamp_seq_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < kTimestampWords; i++)
+        words[i] = timestamp_words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(seq & 1) && seq == timestamp_seq_.load(std::memory_order_relaxed))
         break;
     }
-    ss << message << std::endl;
+    memcpy(timestamp, words, kTimestampSize);
+  }
+
+  /**
+   * @brief get the ring of the calling thread, creating it on its first line
+   *
+   * @return the ring
+   */
+  Ring &LocalRing() {
+    // a thread may log to several loggers, keyed by id as addresses get reused
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> rings;
+    for (const auto &ring : rings)
+      if (ring.first == id_) return *ring.second;
+    auto ring = std::make_shared<Ring>(buffer_size_);
+    {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      rings_.push_back(ring);
+    }
+    rings.emplace_back(id_, ring);
+    return *ring;
+  }
+
+  /**
+   * @brief move everything in the rings to the output (write_mutex_ must be
+   * locked, it makes the writer the only consumer)
+   *
+   */
+  void Drain() {
+    {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      // forget the drained rings of the threads that have exited
+      rings_.erase(
+          std::remove_if(rings_.begin(), rings_.end(),
+                         [](const std::shared_ptr<Ring> &ring) {
+                           return ring.use_count() == 1 &&
+                                  ring->head.load(std::memory_order_acquire) ==
+                                      ring->tail.load(std::memory_order_relaxed);
+                         }),
+          rings_.end());
+      rings_snapshot_ = rings_;
+    }
+    batch_.clear();
+    for (const auto &ring : rings_snapshot_) {
+      const uint64_t head = ring->head.load(std::memory_order_acquire);
+      const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      if (head == tail) continue;
+      const size_t offset = tail & (ring->capacity - 1);
+      const size_t size = head - tail;
+      const size_t first = std::min(size, ring->capacity - offset);
+      batch_.append(ring->data.get() + offset, first);
+      batch_.append(ring->data.get(), size - first);
+      ring->tail.store(head, std::memory_order_release);
+    }
+    rings_snapshot_.clear();
+    if (!batch_.empty()) Output(batch_);
+  }
+
+  /**
+   * @brief write a batch of lines, rotating the file first if needed
+   * (write_mutex_ must be locked)
+   *
+   * @param batch the lines
+   */
+  void Output(const std::string &batch) {
+    if (fd_ != STDOUT_FILENO && max_file_size_ && file_size_ &&
+        file_size_ + batch.size() > max_file_size_)
+      Rotate();
+    size_t written = 0;
+    while (written < batch.size()) {
+      const auto ret = write(fd_, batch.data() + written, batch.size() - written);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        return;  // nowhere left to report it
+      }
+      written += ret;
+    }
+    file_size_ += written;
+  }
 
-    queue_->push(ss.str());
+  /**
+   * @brief rotate the log file (write_mutex_ must be locked)
+   *
+   */
+  void Rotate() {
+    for (int i = max_file_num_ - 1; i >= 1; i--) {
+      const auto from = path_ + '.' + std::to_string(i);
+      rename(from.c_str(), (path_ + '.' + std::to_string(i + 1)).c_str());
+    }
+    if (max_file_num_ > 0)
+      rename(path_.c_str(), (path_ + ".1").c_str());
+    else
+      unlink(path_.c_str());
+    const int fd = open(path_.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return;  // keep writing to the old file
+    close(fd_);
+    fd_ = fd;
+    file_size_ = 0;
   }
 
-  void Debug(const std::string& message) { Log(LOG_LEVEL_DEBUG, message); }
-  void Info(const std::string& message) { Log(LOG_LEVEL_INFO, message); }
-  void Ok(const std::string& message) { Log(LOG_LEVEL_OK, message); }
-  void Warn(const std::string& message) { Log(LOG_LEVEL_WARN, message); }
-  void Error(const std::string& message) { Log(LOG_LEVEL_ERROR, message); }
-  void Fatal(const std::string& message) { Log(LOG_LEVEL_FATAL, message); }
+  void WriterLoop() {
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    while (is_running_) {
+      writer_cv_.wait_for(lock, kFlushInterval);
+      lock.unlock();
+      Flush();
+      lock.lock();
+    }
+  }
+
+  static const size_t kTimestampWords = (kTimestampSize + 7) / 8;
+  static inline std::atomic<uint64_t> next_id_{0};
+
+  const uint64_t id_;
+  std::atomic<int> level_{LOG_LEVEL_DEBUG};
+  std::atomic<size_t> buffer_size_{kDefaultBufferSize};
+  std::atomic<uint64_t> dropped_num_{0};
+
+  std::mutex timestamp_mutex_;
+  std::atomic<int64_t> cached_second_{-1};
+  std::atomic<uint64_t> timestamp_seq_{0};
+  std::atomic<uint64_t> timestamp_words_[kTimestampWords] = {};
+
+  std::mutex rings_mutex_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+
+  std::mutex write_mutex_;  // held by the single consumer of the rings
+  std::vector<std::shared_ptr<Ring>> rings_snapshot_;
+  std::string batch_;
+  int fd_ = STDOUT_FILENO;
+  std::atomic<bool> fd_is_tty_{static_cast<bool>(isatty(STDOUT_FILENO))};
+  std::string path_;
+  uint64_t file_size_ = 0;
+  uint64_t max_file_size_ = 0;
+  int max_file_num_ = 0;
+
+  std::mutex writer_mutex_;
+  std::condition_variable writer_cv_;
+  bool is_running_;
+  std::thread writer_;  // last, it starts in the constructor
 };
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A counter split into cache-line sized shards, every thread adds to
+ * its own shard so that hot counters don't bounce between CPUs
+ */
+class Counter {
+ public:
+  void Add(const uint64_t& value = 1) {
+    shards_[ShardIndex()].value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief get the sum of the shards
+   *
+   * @return the value
+   */
+  uint64_t Value() const;
+
+  static const size_t kShardNum = 16;
+
+  /**
+   * @brief get the shard of the calling thread
+   *
+   * @return the index of the shard
+   */
+  static size_t ShardIndex();
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value{0};
+  };
+  std::array<Shard, kShardNum> shards_;
+};
+
+/**
+ * @brief A latency histogram with log-linear buckets (like HdrHistogram): 8
+ * buckets per power of 2, so any value is known within 12.5%, from 1ns to
+ * hours with a fixed amount of memory
+ */
+class Histogram {
+ public:
+  using Duration = std::chrono::steady_clock::duration;
+
+  void Record(const Duration& duration) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        duration)
+                        .count();
+    Record(static_cast<uint64_t>(ns > 0 ? ns : 0));
+  }
+
+  /**
+   * @brief record a value
+   *
+   * @param ns the value in nanoseconds
+   */
+  void Record(const uint64_t& ns) {
+    auto& shard = shards_[Counter::ShardIndex() % kShardNum];
+    shard.buckets[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief get the number of recorded values
+   *
+   * @return the number of values
+   */
+  uint64_t Count() const;
+
+  /**
+   * @brief get the sum of the recorded values
+   *
+   * @return the sum in nanoseconds
+   */
+  uint64_t Sum() const;
+
+  /**
+   * @brief get a percentile of the recorded values
+   *
+   * @param percentile the percentile (e.g. 99.9)
+   * @return the value in nanoseconds (0 if nothing was recorded)
+   */
+  uint64_t Percentile(const double& percentile) const;
+
+  /**
+   * @brief get the number of values at most each bound
+   *
+   * @param bounds the bounds in nanoseconds, in ascending order
+   * @return the cumulative counts (a bucket straddling a bound is counted in
+   * the next one)
+   */
+  std::vector<uint64_t> CumulativeCounts(
+      const std::vector<uint64_t>& bounds) const;
+
+  /**
+   * @brief add the values recorded in another histogram
+   *
+   * @param other the other histogram
+   */
+  void Merge(const Histogram& other);
+
+  static const int kSubBucketBits = 3;
+  static const size_t kBucketNum = (64 - kSubBucketBits + 1)
+                                   << kSubBucketBits;
+
+  /**
+   * @brief get the bucket of a value
+   *
+   * @param ns the value
+   * @return the index of the bucket
+   */
+  static size_t BucketIndex(const uint64_t& ns) {
+    if (ns < (uint64_t(1) << kSubBucketBits)) return ns;
+    const int shift = 63 - __builtin_clzll(ns) - kSubBucketBits;
+    return (static_cast<size_t>(shift + 1) << kSubBucketBits) +
+           ((ns >> shift) & ((1 << kSubBucketBits) - 1));
+  }
+
+  /**
+   * @brief get the smallest value of a bucket
+   *
+   * @param index the index of the bucket
+   * @return the value
+   */
+  static uint64_t BucketLowerBound(const size_t& index) {
+    if (index < (size_t(1) << kSubBucketBits)) return index;
+    const int shift = (index >> kSubBucketBits) - 1;
+    return ((uint64_t(1) << kSubBucketBits) +
+            (index & ((1 << kSubBucketBits) - 1)))
+           << shift;
+  }
+
+  /**
+   * @brief get the largest value of a bucket
+   *
+   * @param index the index of the bucket
+   * @return the value
+   */
+  static uint64_t BucketUpperBound(const size_t& index) {
+    return index + 1 < kBucketNum ? BucketLowerBound(index + 1) - 1
+                                  : UINT64_MAX;
+  }
+
+ private:
+  static const size_t kShardNum = 4;
+
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, kBucketNum> buckets{};
+    std::atomic<uint64_t> sum{0};
+  };
+  std::array<Shard, kShardNum> shards_;
+};
+
+/**
+ * @brief A registry of named metrics with labels, serialized in the Prometheus
+ * text format
+ *
+ * Looking a metric up takes a lock, so hot paths keep the returned reference,
+ * which stays valid as long as the registry.
+ */
+class Metrics {
+ public:
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+  using Gauge = std::function<double()>;
+
+  /**
+   * @brief get a counter, creating it on the first call
+   *
+   * @param name the metric name
+   * @param help the description of the metric
+   * @param labels the labels
+   * @return the counter
+   */
+  Counter& GetCounter(const std::string& name, const std::string& help,
+                      const Labels& labels = {});
+
+  /**
+   * @brief get a histogram of durations, creating it on the first call
+   *
+   * @param name the metric name (in seconds)
+   * @param help the description of the metric
+   * @param labels the labels
+   * @return the histogram
+   */
+  Histogram& GetHistogram(const std::string& name, const std::string& help,
+                          const Labels& labels = {});
+
+  /**
+   * @brief add a gauge read when the metrics are serialized
+   *
+   * @param name the metric name
+   * @param help the description of the metric
+   * @param labels the labels
+   * @param gauge the function reading the value
+   */
+  void AddGauge(const std::string& name, const std::string& help,
+                const Labels& labels, const Gauge& gauge);
+
+  /**
+   * @brief serialize all the metrics
+   *
+   * @return the metrics in the Prometheus text exposition format
+   */
+  std::string Serialize() const;
+
+ private:
+  enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+  struct Family {
+    Type type;
+    std::string help;
+    // keyed on the serialized labels
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    std::map<std::string, Gauge> gauges;
+  };
+
+  /**
+   * @brief get a family, creating it on the first call (mutex_ must be locked)
+   *
+   * @param name the metric name
+   * @param help the description of the metric
+   * @param type the metric type
+   * @return the family
+   */
+  Family& GetFamily(const std::string& name, const std::string& help,
+                    const Type& type);
+
+  /**
+   * @brief serialize labels as `key="value",...`
+   *
+   * @param labels the labels
+   * @return the serialized labels
+   */
+  static std::string SerializeLabels(const Labels& labels);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Get the value of a parameter of a header (e.g. the boundary of
+ * "multipart/form-data; boundary=xyz")
+ *
+ * @param header the header value
+ * @param name the parameter name
+ * @return the (unquoted) value, std::nullopt if there is no such parameter
+ */
+inline std::optional<std::string> HeaderParam(const std::string_view &header,
+                                              const std::string_view &name) {
+  size_t pos = header.find(';');
+  while (pos != std::string_view::npos) {
+    pos = header.find_first_not_of(" \t", pos + 1);
+    if (pos == std::string_view::npos) break;
+    const auto end = header.find(';', pos);
+    auto param = header.substr(pos, end == std::string_view::npos
+                                        ? std::string_view::npos
+                                        : end - pos);
+    const auto delimiter = param.find('=');
+    if (delimiter != std::string_view::npos) {
+      auto key = param.substr(0, delimiter);
+      while (!key.empty() && (key.back() == ' ' || key.back() == '\t'))
+        key.remove_suffix(1);
+      if (key.size() == name.size() &&
+          std::equal(key.begin(), key.end(), name.begin(),
+                     [](const char &a, const char &b) {
+                       return std::tolower(a) == std::tolower(b);
+                     })) {
+        auto value = param.substr(delimiter + 1);
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+          value = value.substr(1, value.size() - 2);
+        return std::string(value);
+      }
+    }
+    pos = end;
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief A streaming multipart/form-data parser: the body is fed in chunks of
+ * any size, and the parts are reported through callbacks as soon as their
+ * bytes are known, so a part never has to be held in memory as a whole
+ */
+class MultipartParser {
+ public:
+  struct Part {
+    // header names are in lower case
+    std::unordered_map<std::string, std::string> headers;
+    std::string name;
+    std::optional<std::string> filename;
+    std::string content_type;
+  };
+
+  // return false to stop the parsing
+  using PartBeginHandler = std::function<bool(const Part &)>;
+  using PartDataHandler = std::function<bool(const std::string_view &)>;
+  using PartEndHandler = std::function<bool()>;
+
+  /**
+   * @brief Construct a parser
+   *
+   * @param boundary the boundary from the Content-Type of the request
+   */
+  explicit MultipartParser(const std::string &boundary)
+      : delimiter_("\r\n--" + boundary),
+        searcher_(delimiter_.begin(), delimiter_.end()) {
+    // the first boundary isn't preceded by a line break
+    buffer_ = "\r\n";
+  }
+
+  MultipartParser(const MultipartParser &) = delete;
+  MultipartParser &operator=(const MultipartParser &) = delete;
+
+  /**
+   * @brief Get the boundary of a multipart/form-data Content-Type
+   *
+   * @param content_type the Content-Type header
+   * @return the boundary, std::nullopt if it isn't multipart/form-data
+   */
+  static std::optional<std::string> Boundary(
+      const std::string_view &content_type) {
+    static const std::string_view kMultipart("multipart/form-data");
+    if (content_type.size() < kMultipart.size() ||
+        !std::equal(kMultipart.begin(), kMultipart.end(), content_type.begin(),
+                    [](const char &a, const char &b) {
+                      return a == std::tolower(b);
+                    }))
+      return std::nullopt;
+    auto boundary = HeaderParam(content_type, "boundary");
+    if (boundary && (boundary->empty() || boundary->size() > 70))
+      return std::nullopt;  // RFC 2046 limits it to 70 characters
+    return boundary;
+  }
+
+  void OnPartBegin(const PartBeginHandler &handler) { on_begin_ = handler; }
+  void OnPartData(const PartDataHandler &handler) { on_data_ = handler; }
+  void OnPartEnd(const PartEndHandler &handler) { on_end_ = handler; }
+
+  /**
+   * @brief Parse the next chunk of the body
+   *
+   * @param chunk the chunk
+   * @return false if the body is malformed or a handler stopped the parsing
+   */
+  bool Feed(const std::string_view &chunk) {
+    if (state_ == ERROR) return false;
+    if (state_ == DONE) return true;  // ignore the epilogue
+    buffer_.append(chunk.data(), chunk.size());
+    size_t pos = 0;
+    while (pos < buffer_.size() && state_ != ERROR && state_ != DONE) {
+      size_t next_pos = pos;
+      switch (state_) {
+        case PREAMBLE:
+        case BODY:
+          next_pos = ParseBody(pos);
+          break;
+        case BOUNDARY_END:
+          next_pos = ParseBoundaryEnd(pos);
+          break;
+        case HEADERS:
+          next_pos = ParseHeaders(pos);
+          break;
+        default:
+          break;
+      }
+      if (next_pos == pos) break;  // need more bytes
+      pos = next_pos;
+    }
+    buffer_.erase(0, pos);  // only a partial delimiter / header stays
+    return state_ != ERROR;
+  }
+
+  /**
+   * @brief Whether the closing boundary has been parsed
+   *
+   * @return true if the whole body was well-formed
+   */
+  bool IsDone() const { return state_ == DONE; }
+
+ private:
+  enum State { PREAMBLE, BOUNDARY_END, HEADERS, BODY, DONE, ERROR };
+
+  static const size_t kMaxHeaderSize = 16384;
+
+  /**
+   * @brief look for the next delimiter, reporting the bytes before it as part
+   * data
+   *
+   * @param pos the position in the buffer
+   * @return the new position
+   */
+  size_t ParseBody(const size_t &pos) {
+    const auto found =
+        std::search(buffer_.begin() + pos, buffer_.end(), searcher_);
+    if (found == buffer_.end()) {
+      // keep what may be the beginning of a delimiter
+      const size_t keep =
+          std::min(buffer_.size() - pos, delimiter_.size() - 1);
+      const size_t data_end = buffer_.size() - keep;
+      if (state_ == BODY && data_end > pos && !Data(pos, data_end - pos))
+        return pos;
+      return data_end;
+    }
+    const size_t delimiter_pos = found - buffer_.begin();
+    if (state_ == BODY) {
+      if (delimiter_pos > pos && !Data(pos, delimiter_pos - pos)) return pos;
+      if (on_end_ && !on_end_()) {
+        state_ = ERROR;
+        return pos;
+      }
+    }
+    state_ = BOUNDARY_END;
+    return delimiter_pos + delimiter_.size();
+  }
+
+  /**
+   * @brief parse what follows a delimiter: "--" closes the body, a line break
+   * starts a part
+   *
+   * @param pos the position in the buffer
+   * @return the new position
+   */
+  size_t ParseBoundaryEnd(const size_t &pos) {
+    // transport padding is allowed before the line break
+    size_t end = pos;
+    while (end < buffer_.size() &&
+           (buffer_[end] == ' ' || buffer_[end] == '\t'))
+      end++;
+    if (buffer_.size() - end < 2) return pos;
+    if (buffer_.compare(end, 2, "--") == 0) {
+      state_ = DONE;
+      return buffer_.size();
+    }
+    if (buffer_.compare(end, 2, "\r\n") != 0) {
+      state_ = ERROR;
+      return pos;
+    }
+    state_ = HEADERS;
+    part_ = Part();
+    return end + 2;
+  }
+
+  /**
+   * @brief parse the header block of a part
+   *
+   * @param pos the position in the buffer
+   * @return the new position
+   */
+  size_t ParseHeaders(const size_t &pos) {
+    if (buffer_.size() - pos < 2) return pos;
+    if (buffer_.compare(pos, 2, "\r\n") == 0) {  // no headers
+      state_ = BODY;
+      return Begin() ? pos + 2 : pos;
+    }
+    const auto header_end = buffer_.find("\r\n\r\n", pos);
+    if (header_end == std::string::npos) {
+      if (buffer_.size() - pos > kMaxHeaderSize) state_ = ERROR;
+      return pos;
+    }
+    std::string_view headers(buffer_.data() + pos, header_end - pos);
+    size_t line_begin = 0;
+    while (line_begin < headers.size()) {
+      auto line_end = headers.find("\r\n", line_begin);
+      if (line_end == std::string_view::npos) line_end = headers.size();
+      const auto line = headers.substr(line_begin, line_end - line_begin);
+      const auto colon = line.find(':');
+      if (colon != std::string_view::npos) {
+        std::string key(line.substr(0, colon));
+        std::transform(
+            key.begin(), key.end(), key.begin(),
+            [](const unsigned char &ch) { return std::tolower(ch); });
+        auto value = line.substr(colon + 1);
+        while (!value.empty() &&
+               (value.front() == ' ' || value.front() == '\t'))
+          value.remove_prefix(1);
+        part_.headers[key] = std::string(value);
+      }
+      line_begin = line_end + 2;
+    }
+    const auto disposition = part_.headers.find("content-disposition");
+    if (disposition != part_.headers.end()) {
+      part_.name = HeaderParam(disposition->second, "name").value_or("");
+      part_.filename = HeaderParam(disposition->second, "filename");
+    }
+    const auto content_type = part_.headers.find("content-type");
+    part_.content_type = content_type == part_.headers.end()
+                             ? "text/plain"
+                             : content_type->second;
+    state_ = BODY;
+    return Begin() ? header_end + 4 : pos;
+  }
+
+  /**
+   * @brief report the beginning of a part
+   *
+   * @return false if the handler stopped the parsing
+   */
+  bool Begin() {
+    if (on_begin_ && !on_begin_(part_)) {
+      state_ = ERROR;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief report some bytes of the body of the current part
+   *
+   * @param pos the position of the bytes in the buffer
+   * @param size the number of bytes
+   * @return false if the handler stopped the parsing
+   */
+  bool Data(const size_t &pos, const size_t &size) {
+    if (on_data_ && !on_data_(std::string_view(buffer_.data() + pos, size))) {
+      state_ = ERROR;
+      return false;
+    }
+    return true;
+  }
+
+  const std::string delimiter_;  // "\r\n--" + boundary
+  const std::boyer_moore_horspool_searcher<std::string::const_iterator>
+      searcher_;
+  std::string buffer_;
+  State state_ = PREAMBLE;
+  Part part_;
+
+  PartBeginHandler on_begin_;
+  PartDataHandler on_data_;
+  PartEndHandler on_end_;
+};
+
+/**
+ * @brief A multipart/form-data form: the fields are kept in memory, the files
+ * are written straight to disk while the body is parsed
+ */
+class MultipartForm {
+ public:
+  struct File {
+    std::string name;      // the field name
+    std::string filename;  // as sent by the client, don't use it as a path
+    std::string content_type;
+    std::filesystem::path path;  // where the content was saved
+    uint64_t size;
+  };
+
+  /**
+   * @brief Construct a form
+   *
+   * @param boundary the boundary from the Content-Type of the request
+   * @param upload_dir the directory the files are saved in (with unique names)
+   * @param max_field_size the maximum size of a field kept in memory
+   */
+  MultipartForm(const std::string &boundary,
+                const std::filesystem::path &upload_dir,
+                const size_t &max_field_size = 1 << 20)
+      : parser_(boundary),
+        upload_dir_(upload_dir),
+        max_field_size_(max_field_size) {
+    parser_.OnPartBegin([this](const MultipartParser::Part &part) {
+      name_ = part.name;
+      if (!part.filename) {
+        fd_ = -1;
+        value_.clear();
+        return true;
+      }
+      std::string path = (upload_dir_ / "upload-XXXXXX").string();
+      fd_ = mkstemp(path.data());
+      if (fd_ < 0) return false;
+      files.push_back({part.name, *part.filename, part.content_type, path, 0});
+      return true;
+    });
+    parser_.OnPartData([this](const std::string_view &data) {
+      if (fd_ < 0) {
+        if (value_.size() + data.size() > max_field_size_) return false;
+        value_.append(data.data(), data.size());
+        return true;
+      }
+      for (size_t written = 0; written < data.size();) {
+        const auto ret =
+            write(fd_, data.data() + written, data.size() - written);
+        if (ret < 0) return false;
+        written += ret;
+      }
+      files.back().size += data.size();
+      return true;
+    });
+    parser_.OnPartEnd([this]() {
+      if (fd_ < 0) {
+        fields[name_] = std::move(value_);
+        value_.clear();
+      } else {
+        close(fd_);
+        fd_ = -1;
+      }
+      return true;
+    });
+  }
+
+  ~MultipartForm() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  /**
+   * @brief Parse the next chunk of the body
+   *
+   * @param chunk the chunk
+   * @return false if the body is malformed, a field is too large or a file
+   * can't be written
+   */
+  bool Feed(const std::string_view &chunk) { return parser_.Feed(chunk); }
+
+  /**
+   * @brief Whether the whole body has been parsed
+   *
+   * @return true if the closing boundary has been parsed
+   */
+  bool IsDone() const { return parser_.IsDone(); }
+
+  std::unordered_map<std::string, std::string> fields;
+  std::vector<File> files;
+
+ private:
+  MultipartParser parser_;
+  const std::filesystem::path upload_dir_;
+  const size_t max_field_size_;
+  std::string name_;
+  std::string value_;
+  int fd_ = -1;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+
+class EventLoop;
+
+/**
+ * @brief How the responses of a route are cached
+ *
+ */
+struct CachePolicy {
+  // how long a response is fresh
+  std::chrono::milliseconds ttl = std::chrono::milliseconds(1000);
+  // how long an expired response is still served while it is being refreshed
+  std::chrono::milliseconds stale_while_revalidate =
+      std::chrono::milliseconds(0);
+  // the params that select a different response
+  std::vector<std::string> vary_params;
+  // the request headers that select a different response
+  std::vector<std::string> vary_headers;
+  // the maximum number of cached responses of the route
+  size_t max_entries = 1024;
+};
+
+/**
+ * @brief The serialized responses of a route, keyed on the method, the path
+ * and the selected params / headers of the request
+ *
+ * Only one controller call is in flight per key: the requests arriving
+ * meanwhile wait for its response instead of calling the controller again.
+ * Only 200 responses are cached.
+ */
+class ResponseCache {
+ public:
+  using Callback =
+      std::function<void(const HttpResponsePtr &, const HttpStatusCode &)>;
+  using Controller =
+      std::function<void(const HttpRequestPtr &&, Callback &&callback)>;
+
+  ResponseCache(const CachePolicy &policy) : policy_(policy) {}
+
+  /**
+   * @brief Answer a request from the cache, or call the controller and cache
+   * its response
+   *
+   * @param request the request
+   * @param controller the controller of the route
+   * @param event_loop the event loop the socket belongs to
+   * @param fd the file descriptor of the socket
+   */
+  void Handle(HttpRequestPtr &&request, const Controller &controller,
+              EventLoop *const event_loop, const int &fd);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Waiter {
+    EventLoop *event_loop;
+    int fd;
+  };
+
+  struct Entry {
+    std::shared_ptr<const std::string> response;
+    Clock::time_point fresh_until;
+    Clock::time_point stale_until;
+    bool is_in_flight = false;
+    std::vector<Waiter> waiters;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  /**
+   * @brief build the key of a request
+   *
+   * @param request the request
+   * @return the key
+   */
+  std::string Key(const HttpRequest &request) const;
+
+  /**
+   * @brief call the controller and store its response (the entry must be
+   * marked in flight)
+   *
+   * @param request the request
+   * @param controller the controller of the route
+   * @param key the key of the entry
+   */
+  void Fill(HttpRequestPtr &&request, const Controller &controller,
+            const std::string &key);
+
+  /**
+   * @brief find an entry and mark it as the most recently used one, creating
+   * it if it doesn't exist (mutex_ must be locked)
+   *
+   * @param key the key
+   * @return the entry
+   */
+  Entry &Touch(const std::string &key);
+
+  /**
+   * @brief drop the least recently used entries that aren't in flight until
+   * the cache fits (mutex_ must be locked)
+   *
+   */
+  void Evict();
+
+  const CachePolicy policy_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;  // most recently used first
+};
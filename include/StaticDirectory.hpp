@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+
+/**
+ * @brief The files of a directory tree served under a URL prefix
+ *
+ * The tree is indexed once: a request is resolved in memory, without stat() or
+ * open(), and a path that climbs out of the tree is rejected before it can
+ * reach the filesystem. The most recently used files are kept open. The index
+ * is rebuilt when inotify reports a change in the tree. Symbolic links aren't
+ * followed, and a directory is served by its index.html.
+ */
+class StaticDirectory {
+ public:
+  static constexpr size_t kDefaultMaxOpenFiles = 64;
+
+  /**
+   * @brief Index a directory tree and start watching it
+   *
+   * @param url_prefix the URL path the tree is served under
+   * @param root the root of the tree
+   * @param max_open_files the maximum number of files kept open
+   */
+  StaticDirectory(const std::string& url_prefix,
+                  const std::filesystem::path& root,
+                  const size_t& max_open_files = kDefaultMaxOpenFiles);
+  ~StaticDirectory();
+
+  StaticDirectory(const StaticDirectory&) = delete;
+  StaticDirectory& operator=(const StaticDirectory&) = delete;
+
+  /**
+   * @brief Whether a URL path is under the prefix of the directory
+   *
+   * @param path the URL path
+   * @return true if the directory answers it
+   */
+  bool Match(const std::string& path) const;
+
+  /**
+   * @brief Answer a GET or HEAD request for a file
+   *
+   * @param request the request, its path under the prefix
+   * @param response the response (the body is the file)
+   * @return the status code
+   */
+  HttpStatusCode Handle(const HttpRequest& request, HttpResponse& response);
+
+  /**
+   * @brief Get the URL path the tree is served under
+   *
+   * @return the prefix, without the trailing slash
+   */
+  const std::string& url_prefix() const { return url_prefix_; }
+
+  /**
+   * @brief Get the number of files in the index
+   *
+   * @return the number of files
+   */
+  size_t file_num();
+
+ private:
+  struct Entry {
+    std::filesystem::path path;
+    uint64_t size;
+    const char* content_type;
+  };
+  // the relative paths of the files, e.g. "img/logo.jpg" (a directory with an
+  // index.html is an entry too, e.g. "img" or "" for the root)
+  using Index = std::unordered_map<std::string, Entry>;
+
+  // an open file, closed once neither the cache nor a request uses it
+  struct OpenFile {
+    explicit OpenFile(const int& fd) : fd(fd) {}
+    ~OpenFile();
+    const int fd;
+  };
+  struct CachedFile {
+    std::shared_ptr<const OpenFile> file;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  /**
+   * @brief turn the part of a URL path under the prefix into a key of the
+   * index
+   *
+   * @param path the path under the prefix (percent-encoded)
+   * @param key the key
+   * @return false if the path is malformed or climbs out of the tree
+   */
+  static bool Normalize(std::string_view path, std::string& key);
+
+  /**
+   * @brief index the tree, watching its directories
+   *
+   * @return the index
+   */
+  std::shared_ptr<const Index> BuildIndex();
+
+  /**
+   * @brief rebuild the index whenever the tree changes (runs in watcher_)
+   *
+   */
+  void Watch();
+
+  /**
+   * @brief get an open file from the cache, or open it
+   *
+   * @param key the key of the file
+   * @param entry the entry of the file
+   * @return the file (nullptr if it can't be opened)
+   */
+  std::shared_ptr<const OpenFile> Open(const std::string& key,
+                                       const Entry& entry);
+
+  const std::string url_prefix_;
+  const std::filesystem::path root_;
+  const size_t max_open_files_;
+
+  std::mutex index_mutex_;
+  std::shared_ptr<const Index> index_;
+
+  std::mutex files_mutex_;
+  std::unordered_map<std::string, CachedFile> files_;
+  std::list<std::string> lru_;  // most recently used first
+
+  int inotify_fd_;  // -1 if the tree isn't watched
+  int stop_fd_;     // an eventfd stopping the watcher
+  std::thread watcher_;
+};
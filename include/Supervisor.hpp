@@ -0,0 +1,140 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+
+/**
+ * @brief The parent of the worker processes of a server (pre-fork mode)
+ *
+ * The supervisor opens the listening sockets and starts every worker by
+ * executing the binary again, the worker inheriting the sockets: the kernel
+ * spreads the connections among the processes. A worker that dies is
+ * restarted. On SIGUSR2 the binary is upgraded without closing the sockets:
+ * the binary on disk is started as the next generation of supervisor and the
+ * sockets are passed to it over a Unix socket (SCM_RIGHTS). Once its workers
+ * are ready, the old workers stop accepting and drain their connections. On
+ * SIGTERM or SIGINT the workers are drained and the supervisor stops.
+ */
+class Supervisor {
+ public:
+  static constexpr std::chrono::seconds kDefaultDrainTimeout{30};
+
+  /**
+   * @brief Create a supervisor
+   *
+   * @param logger the logger
+   * @param worker_num the number of worker processes
+   * @param drain_timeout how long a stopping worker waits for its connections
+   */
+  Supervisor(Logger& logger, const uint32_t& worker_num,
+             const std::chrono::seconds& drain_timeout);
+
+  Supervisor(const Supervisor&) = delete;
+  Supervisor& operator=(const Supervisor&) = delete;
+
+  /**
+   * @brief Receive the listening sockets from the previous generation, if this
+   * process was started by a binary upgrade (exits if they don't match)
+   *
+   * @param num the number of listening sockets
+   * @param sockfds the sockets
+   * @return false if this process isn't an upgrade
+   */
+  bool ReceiveListeners(const size_t& num, std::vector<int>& sockfds);
+
+  /**
+   * @brief Start the workers on the listening sockets and supervise them
+   *
+   * @param sockfds the listening sockets
+   */
+  [[noreturn]] void Run(const std::vector<int>& sockfds);
+
+  /**
+   * @brief Get the index of this process among the workers
+   *
+   * @return the index (-1 if this process isn't a worker)
+   */
+  static int WorkerIndex();
+
+  /**
+   * @brief Get the listening sockets a worker inherited from its supervisor
+   *
+   * @param num the number of listening sockets
+   * @param sockfds the sockets
+   * @return false if they don't match
+   */
+  static bool InheritListeners(const size_t& num, std::vector<int>& sockfds);
+
+  /**
+   * @brief Tell the supervisor that the worker accepts connections
+   *
+   */
+  static void NotifyReady();
+
+  /**
+   * @brief Catch SIGTERM and SIGINT in a worker
+   *
+   * @return a file descriptor that becomes readable once one is received
+   */
+  static int WatchStopSignals();
+
+ private:
+  struct Worker {
+    pid_t pid;
+    std::chrono::steady_clock::time_point started;
+  };
+
+  /**
+   * @brief execute the binary in a child process
+   *
+   * @param path the path of the binary
+   * @param env the variables added to the environment
+   * @param fds the file descriptors inherited
+   * @return the pid of the child (-1 if fork() failed)
+   */
+  pid_t Spawn(const std::string& path, const std::vector<std::string>& env,
+              const std::vector<int>& fds) const;
+
+  /**
+   * @brief start a worker
+   *
+   * @param index the index of the worker
+   * @param ready_fd where it tells it's ready (-1 if no one waits for it)
+   */
+  void StartWorker(const uint32_t& index, const int& ready_fd);
+
+  /**
+   * @brief reap the children that exited, restarting the workers
+   *
+   */
+  void Reap();
+
+  /**
+   * @brief start the next generation and hand the listening sockets over,
+   * stopping once it is ready
+   *
+   */
+  void Upgrade();
+
+  /**
+   * @brief drain the workers and exit
+   *
+   */
+  [[noreturn]] void Stop();
+
+  Logger& logger_;
+  const uint32_t worker_num_;
+  const std::chrono::seconds drain_timeout_;
+  std::string path_;  // of the binary on disk, the next generation runs it
+  std::vector<std::string> args_;
+  std::vector<int> sockfds_;
+  std::vector<Worker> workers_;  // by index, the pid is 0 if not running
+  pid_t next_generation_;        // 0 if not upgrading
+  int handoff_fd_;  // to the previous generation, -1 if not an upgrade
+};
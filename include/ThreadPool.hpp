@@ -1,14 +1,18 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "Affinity.hpp"
 #include "ThreadSafeQueue.hpp"
 
 #ifdef _DEBUG
@@ -16,18 +20,72 @@
 #endif
 
 class ThreadPool {
+ public:
+  /**
+   * @brief the policy used to grow and shrink the pool automatically
+   *
+   */
+  struct AutoScalePolicy {
+    int min_thread_num = 1;
+    int max_thread_num = 1;
+    // how often the pool is inspected
+    std::chrono::milliseconds interval = std::chrono::milliseconds(100);
+    // grow when no thread is idle and a task waited longer than this
+    std::chrono::milliseconds sojourn_target = std::chrono::milliseconds(5);
+    // a thread running one task for longer than this is considered blocked
+    std::chrono::milliseconds blocked_threshold = std::chrono::milliseconds(50);
+    // shrink when some threads have been idle for this long
+    std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(2000);
+  };
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
   std::vector<std::unique_ptr<std::thread>> threads_;
   std::vector<std::shared_ptr<std::atomic<bool>>> flags_;
+  // when the thread started its current task (0 if it is not running any)
+  std::vector<std::shared_ptr<std::atomic<int64_t>>> busy_since_;
+  // threads removed by resize() that may still be finishing their last task,
+  // with flags telling whether they have exited and can be joined
+  std::vector<std::pair<std::unique_ptr<std::thread>,
+                        std::shared_ptr<std::atomic<bool>>>>
+      retired_;
+  std::vector<std::shared_ptr<std::atomic<bool>>> exited_;
   ThreadSafeQueue<std::function<void(int id)> *> q_;
   std::atomic<bool> is_done_;
   std::atomic<bool> is_stop_;
   std::atomic<int> waiting_num_;
+  std::atomic<size_t> queue_size_;
+  std::atomic<int64_t> max_sojourn_ns_;
+  std::function<void(const std::chrono::steady_clock::duration &)>
+      dequeue_observer_;
 
   std::mutex mutex_;
   std::condition_variable cv_;
 
+  // guards the thread vectors, resize() may be called by the scaler thread
+  std::recursive_mutex resize_mutex_;
+  AutoScalePolicy policy_;
+  std::unique_ptr<std::thread> scaler_;
+  std::mutex scaler_mutex_;
+  std::condition_variable scaler_cv_;
+  bool scaler_stop_ = false;
+  int idle_ticks_ = 0;
+
+  // CPU set the threads are pinned to
+  std::vector<int> cpus_;
+  bool bind_memory_ = false;
+
+  static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
   void Init() {
     waiting_num_ = 0;
+    queue_size_ = 0;
+    max_sojourn_ns_ = 0;
     is_stop_ = false;
     is_done_ = false;
   }
@@ -39,7 +97,15 @@ class ThreadPool {
    */
   void InitThread(int i) {
     std::shared_ptr<std::atomic<bool>> flag_ptr(flags_[i]);
-    auto f = [this, i, flag_ptr]() {
+    std::shared_ptr<std::atomic<int64_t>> busy_ptr(busy_since_[i]);
+    std::shared_ptr<std::atomic<bool>> exited_ptr(exited_[i]);
+    auto f = [this, i, flag_ptr, busy_ptr, exited_ptr, cpus = cpus_,
+              bind_memory = bind_memory_]() {
+      struct ExitGuard {
+        std::atomic<bool> &exited;
+        ~ExitGuard() { exited = true; }
+      } exit_guard{*exited_ptr};
+      PlaceCurrentThread(cpus, bind_memory);
       std::atomic<bool> &flag = *flag_ptr;
       std::function<void(int id)> *f_ptr;
       bool isPop = q_.pop(f_ptr);
@@ -47,7 +113,9 @@ class ThreadPool {
         while (isPop) {
           // at return, delete the function
           std::unique_ptr<std::function<void(int id)>> func(f_ptr);
+          *busy_ptr = Now();
           (*f_ptr)(i);
+          *busy_ptr = 0;
           if (flag)
             return;
           else
@@ -75,6 +143,117 @@ class ThreadPool {
   void ClearQueue() {
     std::function<void(int id)> *f;
     while (q_.pop(f)) delete f;
+    queue_size_ = 0;
+  }
+
+  /**
+   * @brief wrap a task so that its sojourn time is reported when it is
+   * dequeued
+   *
+   * @param task the task
+   * @return the wrapper to be put into the queue
+   */
+  template <typename T>
+  std::function<void(int id)> *Wrap(std::shared_ptr<T> task) {
+    const auto enqueue_time = std::chrono::steady_clock::now();
+    ++queue_size_;
+    return new std::function<void(int id)>([this, task, enqueue_time](int id) {
+      --queue_size_;
+      const auto sojourn = std::chrono::steady_clock::now() - enqueue_time;
+      const int64_t sojourn_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(sojourn).count();
+      int64_t max_sojourn = max_sojourn_ns_;
+      while (sojourn_ns > max_sojourn &&
+             !max_sojourn_ns_.compare_exchange_weak(max_sojourn, sojourn_ns))
+        ;
+      if (dequeue_observer_) dequeue_observer_(sojourn);
+      (*task)(id);
+    });
+  }
+
+  /**
+   * @brief join the retired threads
+   *
+   * @param wait true to wait for the threads still running their last task,
+   * false to only join those that have already exited
+   */
+  void JoinRetired(bool wait) {
+    std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
+    for (auto it = retired_.begin(); it != retired_.end();) {
+      if (wait || *it->second) {
+        if (it->first->joinable()) it->first->join();
+        it = retired_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  /**
+   * @brief inspect the pool once and grow or shrink it according to the
+   * policy
+   *
+   */
+  void Scale() {
+    std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
+    JoinRetired(false);
+    const int thread_num = size();
+    const int idle_num = waiting_num_;
+    const size_t queued_num = queue_size_;
+    const int64_t max_sojourn_ns = max_sojourn_ns_.exchange(0);
+    const int64_t now = Now();
+    const int64_t blocked_threshold_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            policy_.blocked_threshold)
+            .count();
+    int blocked_num = 0;
+    for (const auto &busy_since : busy_since_) {
+      const int64_t since = *busy_since;
+      if (since && now - since > blocked_threshold_ns) ++blocked_num;
+    }
+    const bool is_delayed =
+        max_sojourn_ns >
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            policy_.sojourn_target)
+            .count();
+
+    if (thread_num < policy_.min_thread_num) {
+      resize(policy_.min_thread_num);
+    } else if (idle_num == 0 && queued_num > 0 &&
+               (is_delayed || blocked_num > 0)) {
+      // every thread is busy and tasks are waiting: add one thread for every
+      // blocked one, and a quarter more if the queue delay is too high
+      idle_ticks_ = 0;
+      int grow_num = blocked_num;
+      if (is_delayed) grow_num += (thread_num + 3) / 4;
+      grow_num = std::min(grow_num, static_cast<int>(queued_num));
+      resize(std::min(policy_.max_thread_num,
+                      thread_num + std::max(grow_num, 1)));
+    } else if (idle_num > 0 && queued_num == 0) {
+      if (++idle_ticks_ * policy_.interval >= policy_.idle_timeout &&
+          thread_num > policy_.min_thread_num) {
+        // retire half of the idle threads
+        idle_ticks_ = 0;
+        resize(std::max(policy_.min_thread_num,
+                        thread_num - std::max(idle_num / 2, 1)));
+      }
+    } else {
+      idle_ticks_ = 0;
+    }
+  }
+
+  /**
+   * @brief stop the scaler thread if it is running
+   *
+   */
+  void StopScaler() {
+    {
+      std::lock_guard<std::mutex> lock(scaler_mutex_);
+      scaler_stop_ = true;
+    }
+    scaler_cv_.notify_all();
+    if (scaler_ && scaler_->joinable()) scaler_->join();
+    scaler_.reset();
   }
 
  public:
@@ -108,7 +287,36 @@ class ThreadPool {
    *
    * @return the number of threads
    */
-  int size() { return static_cast<int>(threads_.size()); }
+  int size() {
+    std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
+    return static_cast<int>(threads_.size());
+  }
+
+  /**
+   * @brief get the number of tasks waiting in the queue
+   *
+   * @return the number of queued tasks
+   */
+  size_t queue_size() const { return queue_size_; }
+
+  /**
+   * @brief get the number of idle threads
+   *
+   * @return the number of threads waiting for a task
+   */
+  int idle_size() const { return waiting_num_; }
+
+  /**
+   * @brief Set a function to be called with the queueing delay of every task
+   * when a thread picks it up (must be set before any task is pushed)
+   *
+   * @param observer the function
+   */
+  void SetDequeueObserver(
+      const std::function<void(const std::chrono::steady_clock::duration &)>
+          &observer) {
+    dequeue_observer_ = observer;
+  }
 
   /**
    * @brief modify the number of threads in the pool
@@ -116,26 +324,34 @@ class ThreadPool {
    * @param thread_num the number of threads
    */
   void resize(const int &thread_num) {
+    std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
     if (!is_stop_ && !is_done_) {
       int old_thread_num = static_cast<int>(threads_.size());
       if (old_thread_num <= thread_num) {
         threads_.resize(thread_num);
         flags_.resize(thread_num);
+        busy_since_.resize(thread_num);
+        exited_.resize(thread_num);
         for (int i = old_thread_num; i < thread_num; ++i) {
           flags_[i] = std::make_shared<std::atomic<bool>>(false);
+          busy_since_[i] = std::make_shared<std::atomic<int64_t>>(0);
+          exited_[i] = std::make_shared<std::atomic<bool>>(false);
           InitThread(i);
         }
       } else {
         for (int i = old_thread_num - 1; i >= thread_num; --i) {
           *flags_[i] = true;
-          threads_[i]->detach();
+          // joined once it finishes its current task
+          retired_.emplace_back(std::move(threads_[i]), exited_[i]);
         }
-        {  // stop the detached threads that were waiting
+        {  // stop the retired threads that were waiting
           std::unique_lock<std::mutex> lock(mutex_);
           cv_.notify_all();
         }
         threads_.resize(thread_num);
         flags_.resize(thread_num);
+        busy_since_.resize(thread_num);
+        exited_.resize(thread_num);
       }
     }
 #ifdef _DEBUG
@@ -144,6 +360,52 @@ class ThreadPool {
 #endif
   }
 
+  /**
+   * @brief pin the threads to a CPU set (the running threads are replaced by
+   * new ones so that their stacks and buffers are allocated on the local node)
+   *
+   * @param cpus the CPU set (empty to unpin)
+   * @param bind_memory whether the threads prefer the memory of the NUMA node
+   * of the CPU set
+   */
+  void SetPlacement(const std::vector<int> &cpus, const bool &bind_memory) {
+    std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
+    cpus_ = cpus;
+    bind_memory_ = bind_memory;
+    const int thread_num = size();
+    resize(0);
+    resize(thread_num);
+  }
+
+  /**
+   * @brief grow and shrink the pool automatically within the bounds of the
+   * policy, based on the number of idle threads, the queueing delay and the
+   * number of threads blocked in a long task
+   *
+   * @param policy the policy
+   */
+  void SetAutoScale(const AutoScalePolicy &policy) {
+    StopScaler();
+    policy_ = policy;
+    policy_.min_thread_num = std::max(policy_.min_thread_num, 1);
+    policy_.max_thread_num =
+        std::max(policy_.max_thread_num, policy_.min_thread_num);
+    idle_ticks_ = 0;
+    {
+      std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
+      if (size() < policy_.min_thread_num) resize(policy_.min_thread_num);
+      if (size() > policy_.max_thread_num) resize(policy_.max_thread_num);
+    }
+    scaler_stop_ = false;
+    scaler_ = std::make_unique<std::thread>([this]() {
+      std::unique_lock<std::mutex> lock(scaler_mutex_);
+      while (!scaler_cv_.wait_for(lock, policy_.interval,
+                                  [this]() { return scaler_stop_; })) {
+        Scale();
+      }
+    });
+  }
+
   /**
    * @brief pop a functional wrapper to the original function (without running
    * it)
@@ -166,6 +428,7 @@ class ThreadPool {
    * @param isWait true if all the functions in the queue need to be run
    */
   void Stop(bool isWait = true) {
+    StopScaler();
     if (!isWait) {
       if (is_stop_) return;
       is_stop_ = true;
@@ -181,12 +444,16 @@ class ThreadPool {
       std::unique_lock<std::mutex> lock(mutex_);
       cv_.notify_all();
     }
+    std::lock_guard<std::recursive_mutex> lock(resize_mutex_);
     for (int i = 0; i < static_cast<int>(threads_.size()); i++) {
       if (threads_[i]->joinable()) threads_[i]->join();
     }
+    JoinRetired(true);
     ClearQueue();
     threads_.clear();
     flags_.clear();
+    busy_since_.clear();
+    exited_.clear();
   }
 
   /**
@@ -203,8 +470,7 @@ class ThreadPool {
         std::make_shared<std::packaged_task<decltype(f(0, rest...))(int)>>(
             std::bind(std::forward<F>(f), std::placeholders::_1,
                       std::forward<Rest>(rest)...));
-    q_.push(new std::function<void(int id)>(
-        [task_ptr](int id) { (*task_ptr)(id); }));
+    q_.push(Wrap(task_ptr));
     {
       std::unique_lock<std::mutex> lock(mutex_);
       cv_.notify_one();
@@ -223,8 +489,7 @@ class ThreadPool {
   auto push(F &&f) -> std::future<decltype(f(0))> {
     auto task_ptr = std::make_shared<std::packaged_task<decltype(f(0))(int)>>(
         std::forward<F>(f));
-    q_.push(new std::function<void(int id)>(
-        [task_ptr](int id) { (*task_ptr)(id); }));
+    q_.push(Wrap(task_ptr));
     {
       std::unique_lock<std::mutex> lock(mutex_);
       cv_.notify_one();
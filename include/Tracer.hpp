@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A sampling tracer: the phases of one request out of N are recorded
+ * as spans into per-thread ring buffers, and dumped in the Chrome trace event
+ * format (chrome://tracing, https://ui.perfetto.dev)
+ *
+ * When sampling is off, the only cost is one atomic load per request.
+ */
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Tracer();
+
+  /**
+   * @brief Set how often requests are traced
+   *
+   * @param one_in trace one request out of one_in (0 turns tracing off)
+   */
+  void SetSampleRate(const uint32_t& one_in) { sample_rate_ = one_in; }
+
+  /**
+   * @brief Set the number of spans every thread keeps (the oldest ones are
+   * overwritten), for the threads tracing from now on
+   *
+   * @param num the number of spans
+   */
+  void SetBufferSize(const size_t& num) { buffer_size_ = num ? num : 1; }
+
+  /**
+   * @brief Whether tracing is on
+   *
+   * @return true if requests are sampled
+   */
+  bool IsEnabled() const {
+    return sample_rate_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Decide whether the calling thread traces its next request
+   *
+   * @return true if it is sampled
+   */
+  bool Sample() {
+    const uint32_t rate = sample_rate_.load(std::memory_order_relaxed);
+    if (!rate) return false;
+    thread_local uint32_t count = 0;
+    return ++count % rate == 0;
+  }
+
+  /**
+   * @brief Record a span on the calling thread
+   *
+   * @param name the name of the span (a string literal)
+   * @param begin when it began
+   * @param end when it ended
+   * @param args the arguments as the members of a JSON object (e.g.
+   * "\"fd\":5"), may be empty
+   */
+  void Record(const char* const name, const Clock::time_point& begin,
+              const Clock::time_point& end, std::string&& args = "");
+
+  /**
+   * @brief Dump the spans kept by all the threads
+   *
+   * @return a JSON trace in the Chrome trace event format
+   */
+  std::string Dump() const;
+
+  /**
+   * @brief Quote a string for the arguments of a span
+   *
+   * @param str the string
+   * @return the JSON string literal
+   */
+  static std::string Quote(const std::string& str);
+
+ private:
+  struct Span {
+    const char* name;
+    int64_t begin_ns;
+    int64_t duration_ns;
+    std::string args;
+  };
+
+  // the spans of a thread, only locked by the thread and by Dump()
+  struct ThreadBuffer {
+    std::mutex mutex;
+    int tid;
+    std::vector<Span> spans;
+    size_t next = 0;  // where the next span goes once the buffer is full
+  };
+
+  /**
+   * @brief get the buffer of the calling thread, creating it on its first
+   * span
+   *
+   * @return the buffer
+   */
+  ThreadBuffer& LocalBuffer();
+
+  static std::atomic<uint64_t> next_id_;
+
+  const uint64_t id_;
+  std::atomic<uint32_t> sample_rate_;
+  std::atomic<size_t> buffer_size_;
+
+  mutable std::mutex buffers_mutex_;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.hpp"
+#include "IoUring.hpp"
+
+/**
+ * @brief An event loop based on io_uring: connections are accepted with a
+ * multishot accept, received with a multishot recv into a ring of provided
+ * buffers, and the bytes are queued per connection for the workers. Sends and
+ * closes of the workers are handed to the loop thread, which submits them
+ * (linked, for responses that close the connection) in the same
+ * io_uring_enter() it waits in. Coroutines wait for file descriptors with
+ * poll operations and for timers with a timeout operation.
+ */
+class UringEventLoop : public EventLoop {
+ public:
+  UringEventLoop(Server* const server, const int& id);
+  ~UringEventLoop() override;
+
+  /**
+   * @brief Whether the kernel supports everything this loop needs
+   *
+   * @return true if io_uring with multishot accept / recv and provided buffer
+   * rings is available
+   */
+  static bool Supported();
+
+  bool Accept(const int& sockfd) override;
+  void StopAccepting() override;
+  bool Add(const int& fd) override;
+  ssize_t Recv(const int& fd, void* buffer, const size_t& size) override;
+  ssize_t Recv(const int& fd, BufferChain& input) override;
+  using EventLoop::Send;
+  bool Send(const int& fd, const std::shared_ptr<const std::string>& data,
+            const bool& close_after) override;
+  void Close(const int& fd) override;
+  void ResumeWhenReady(const int& fd, Waiter* const waiter) override;
+
+ private:
+  static constexpr unsigned kEntries = 4096;
+  static constexpr uint16_t kBufferGroup = 0;
+  static constexpr uint16_t kBufferNum = 1024;
+  static constexpr uint32_t kBufferSize = 16384;
+
+  enum OpType : uint64_t {
+    ACCEPT = 1,
+    RECV,
+    SEND,
+    CLOSE,
+    CANCEL,
+    WAKE,
+    POLL,
+    TIMER
+  };
+
+  struct SendOp {
+    int fd;
+    std::shared_ptr<const std::string> data;
+    size_t offset;
+    bool close_after;
+  };
+
+  struct PendingOp {
+    OpType type;
+    int fd;
+    std::unique_ptr<SendOp> send;
+    Waiter* waiter = nullptr;  // for POLL
+  };
+
+  // the bytes received but not taken by the workers yet
+  struct Connection {
+    explicit Connection(BufferPool& pool) : input(pool) {}
+    BufferChain input;
+  };
+
+  void Run() override;
+  void Wake() override;
+
+  /**
+   * @brief hand an operation to the loop thread (or prepare it directly if
+   * called in the loop thread)
+   *
+   * @param op the operation
+   */
+  void Submit(PendingOp&& op);
+
+  /**
+   * @brief fill the submission queue entries of an operation (loop thread
+   * only)
+   *
+   * @param op the operation
+   */
+  void Prepare(PendingOp&& op);
+
+  void PrepareAccept(const int& listen_fd);
+  void PrepareRecv(const int& fd);
+  void PrepareSend(std::unique_ptr<SendOp>&& send, const uint8_t& flags);
+  void PrepareCancel(const int& fd, const uint8_t& flags);
+  void PrepareClose(const int& fd);
+  void PrepareWake();
+  void PreparePoll(const int& fd, Waiter* const waiter);
+
+  /**
+   * @brief make sure a timeout operation completes by a deadline
+   *
+   * @param deadline the deadline
+   */
+  void PrepareTimer(const Clock::time_point& deadline);
+
+  /**
+   * @brief handle a completion (loop thread only)
+   *
+   * @param cqe the completion queue entry
+   */
+  void Complete(const io_uring_cqe& cqe);
+
+  IoUring ring_;
+  std::vector<int> listen_fds_;
+  int wake_fd_;
+  uint64_t wake_value_;
+  std::atomic<bool> is_sleeping_;
+  __kernel_timespec timer_spec_;  // copied by the kernel on submission
+  Clock::time_point timer_deadline_;  // of the pending timeout operation
+
+  std::mutex pending_mutex_;
+  std::vector<PendingOp> pending_;
+
+  std::mutex connections_mutex_;
+  std::unordered_map<int, Connection> connections_;
+};
@@ -1,7 +1,24 @@
 #pragma once
 
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Get the value of a hex digit
+ *
+ * @param ch the digit
+ * @return the value, -1 if it isn't a hex digit
+ */
+inline int HexValue(const char &ch) {
+  if ('0' <= ch && ch <= '9') return ch - '0';
+  if ('a' <= ch && ch <= 'f') return ch - 'a' + 10;
+  if ('A' <= ch && ch <= 'F') return ch - 'A' + 10;
+  return -1;
+}
 
 /**
  * @brief Decode a URL string
@@ -9,15 +26,14 @@
  * @param src the URL string
  * @return the decoded string
  */
-std::string UrlDecode(const std::string &src) {
+inline std::string UrlDecode(const std::string_view &src) {
   std::string ret;
-  char ch;
+  ret.reserve(src.length());
   for (size_t i = 0; i < src.length(); i++) {
-    if (src[i] == '%') {
-      int ascii;
-      sscanf(src.substr(i + 1, 2).c_str(), "%x", &ascii);
-      ch = static_cast<char>(ascii);
-      ret += ch;
+    if (src[i] == '%' && i + 2 < src.length() &&
+        HexValue(src[i + 1]) >= 0 && HexValue(src[i + 2]) >= 0) {
+      ret +=
+          static_cast<char>(HexValue(src[i + 1]) << 4 | HexValue(src[i + 2]));
       i = i + 2;
     } else if (src[i] == '+') {
       ret += ' ';
@@ -25,29 +41,104 @@ std::string UrlDecode(const std::string &src) {
       ret += src[i];
     }
   }
-  return (ret);
+  return ret;
 }
 
+/**
+ * @brief Whether a URL string needs to be decoded
+ *
+ * @param src the URL string
+ * @return true if it contains '%' or '+'
+ */
+inline bool IsUrlEncoded(const std::string_view &src) {
+  return src.find_first_of("%+") != std::string_view::npos;
+}
+
+/**
+ * @brief A x-www-form-urlencoded string split into its fields in one pass,
+ * without copying or decoding them (the source string must outlive it)
+ */
+class FormView {
+ public:
+  using Field = std::pair<std::string_view, std::string_view>;
+
+  FormView() = default;
+
+  /**
+   * @brief Split a form string
+   *
+   * @param src the form string
+   */
+  explicit FormView(const std::string_view &src) {
+    size_t begin = 0;
+    while (begin < src.length()) {
+      auto end = src.find('&', begin);
+      if (end == std::string_view::npos) end = src.length();
+      const auto field = src.substr(begin, end - begin);
+      if (!field.empty()) {
+        const auto delimiter = field.find('=');
+        if (delimiter == std::string_view::npos)
+          fields_.emplace_back(field, std::string_view());
+        else
+          fields_.emplace_back(field.substr(0, delimiter),
+                               field.substr(delimiter + 1));
+      }
+      begin = end + 1;
+    }
+  }
+
+  /**
+   * @brief Get the fields (still encoded)
+   *
+   * @return the fields in the order of the form
+   */
+  const std::vector<Field> &fields() const { return fields_; }
+
+  /**
+   * @brief Get the number of fields
+   *
+   * @return the number of fields
+   */
+  size_t size() const { return fields_.size(); }
+
+  /**
+   * @brief Get the decoded value of the first field with a name
+   *
+   * @param name the (decoded) name
+   * @return the decoded value, std::nullopt if there is no such field
+   */
+  std::optional<std::string> Get(const std::string_view &name) const {
+    for (const auto &field : fields_) {
+      if (IsUrlEncoded(field.first) ? UrlDecode(field.first) == name
+                                    : field.first == name)
+        return UrlDecode(field.second);
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Decode all the fields
+   *
+   * @return the form (the last field wins if a name is repeated)
+   */
+  std::unordered_map<std::string, std::string> Decode() const {
+    std::unordered_map<std::string, std::string> ret;
+    ret.reserve(fields_.size());
+    for (const auto &field : fields_)
+      ret[UrlDecode(field.first)] = UrlDecode(field.second);
+    return ret;
+  }
+
+ private:
+  std::vector<Field> fields_;
+};
+
 /**
  * @brief Docode a x-www-form-urlencoded string
  *
  * @param src the form string
  * @return the form
  */
-auto DecodeXWWWFormUrlencoded(std::string &src) {
-  std::unordered_map<std::string, std::string> ret;
-  auto delimiter = src.find_first_of('=');
-  while (delimiter != std::string::npos) {
-    auto delimiter_2 = src.find_first_of('&');
-    if (delimiter_2 == std::string::npos) {  // the end of the form
-      ret[UrlDecode(src.substr(0, delimiter))] =
-          UrlDecode(src.substr(delimiter + 1));
-      return ret;
-    }
-    ret[UrlDecode(src.substr(0, delimiter))] =
-        UrlDecode(src.substr(delimiter + 1, delimiter_2 - delimiter - 1));
-    src = src.substr(delimiter_2 + 1);
-    delimiter = src.find_first_of('=');
-  }
-  return ret;
+inline auto DecodeXWWWFormUrlencoded(const std::string_view &src) {
+  return FormView(src).Decode();
 }
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <string>
 #include <thread>
 
 #include "./example/controllers.hpp"
@@ -6,20 +8,45 @@
 
 int main(int argc, char** argv) {
   int port = 8080;
-  if (argc == 2) {  // the first arg is the port number, default is 8080
+  if (argc >= 2) {  // the first arg is the port number, default is 8080
     int tmp = std::stoi(argv[1]);
     if (0 <= tmp && tmp <= 65535) port = tmp;
   }
+  auto backend = IoBackend::EPOLL;
+  if (argc >= 3 && std::string(argv[2]) == "io_uring") {  // the second arg is
+                                                         // the I/O backend
+    backend = IoBackend::IO_URING;
+  }
+
+  const auto core_num = std::max(std::thread::hardware_concurrency(), 1u);
+
+  // the example pages never change, serve them from memory
+  CachePolicy page_cache;
+  page_cache.ttl = std::chrono::seconds(1);
+  page_cache.stale_while_revalidate = std::chrono::seconds(10);
 
-  const auto core_num = std::thread::hardware_concurrency() * 5;
+  // the example server is its own upstream for /proxy
+  HttpClient upstream("127.0.0.1", port);
 
   Server server;
-  server.SetThreadNum(core_num ? core_num : 1)
-      .RegisterController(HttpMethod::GET, "/", test_html)
-      .RegisterController(HttpMethod::GET, "/txt", test_txt)
-      .RegisterController(HttpMethod::GET, "/noimg", noimg)
+  server.SetAutoScale(core_num, core_num * 16)
+      .SetIoBackend(backend)
+      .RegisterController(HttpMethod::GET, "/", test_html, page_cache)
+      .RegisterController(HttpMethod::GET, "/txt", test_txt, page_cache)
+      .RegisterController(HttpMethod::GET, "/noimg", noimg, page_cache)
       .RegisterController(HttpMethod::GET, "/img/logo.jpg", img)
+      .ServeDirectory("/static", "./example")
       .RegisterController(HttpMethod::POST, "/dopost", dopost)
-      .Listen(port);
+      .RegisterController(HttpMethod::GET, "/delay", delay)
+      .RegisterController(HttpMethod::GET, "/proxy",
+                          [&upstream](HttpRequest& req) {
+                            return proxy(req, upstream);
+                          })
+      .EnableMetrics()
+      .EnableTracing(100);
+  if (argc >= 4) server.SetCapture(argv[3]);  // the third arg is the path of
+                                              // the capture file
+  server.SetWorkerProcessNum(2, std::chrono::seconds(5));
+  server.Listen(port);
   return 0;
 }
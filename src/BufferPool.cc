@@ -0,0 +1,182 @@
+#include "BufferPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+BufferPool::~BufferPool() {
+  for (const auto slab : free_) delete[] slab;
+}
+
+char* BufferPool::Acquire() {
+  lent_num_.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty()) {
+      const auto slab = free_.back();
+      free_.pop_back();
+      return slab;
+    }
+  }
+  return new char[kSlabSize];
+}
+
+void BufferPool::Release(char* const slab) {
+  lent_num_.fetch_sub(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.size() < max_free_) {
+      free_.push_back(slab);
+      return;
+    }
+  }
+  delete[] slab;
+}
+
+BufferChain::BufferChain(BufferChain&& other) noexcept
+    : pool_(other.pool_), begin_(0), end_(0) {
+  swap(other);
+}
+
+BufferChain& BufferChain::operator=(BufferChain&& other) noexcept {
+  if (this != &other) {
+    Clear();
+    pool_ = other.pool_;
+    swap(other);
+  }
+  return *this;
+}
+
+char* BufferChain::Reserve(size_t& size) {
+  if (slabs_.empty() || end_ == BufferPool::kSlabSize) {
+    slabs_.push_back(pool_->Acquire());
+    end_ = 0;
+  }
+  size = BufferPool::kSlabSize - end_;
+  return slabs_.back() + end_;
+}
+
+void BufferChain::Commit(const size_t& size) {
+  end_ += size;
+  if (end_) return;
+  // nothing was received into a new slab, give it back
+  pool_->Release(slabs_.back());
+  slabs_.pop_back();
+  end_ = slabs_.empty() ? 0 : BufferPool::kSlabSize;
+}
+
+void BufferChain::Append(const char* data, size_t size) {
+  while (size) {
+    size_t space;
+    char* const buffer = Reserve(space);
+    const auto length = std::min(space, size);
+    memcpy(buffer, data, length);
+    Commit(length);
+    data += length;
+    size -= length;
+  }
+}
+
+void BufferChain::Append(BufferChain& other) {
+  if (empty()) {
+    Clear();
+    swap(other);
+    return;
+  }
+  for (size_t i = 0; i < other.slabs_.size(); i++) {
+    const size_t begin = i ? 0 : other.begin_;
+    const size_t end =
+        i + 1 == other.slabs_.size() ? other.end_ : BufferPool::kSlabSize;
+    Append(other.slabs_[i] + begin, end - begin);
+  }
+  other.Clear();
+}
+
+size_t BufferChain::Find(const std::string_view& pattern,
+                         const size_t& limit) const {
+  // the longest proper prefix of the pattern that is also a suffix of each
+  // of its prefixes (KMP), so the bytes are scanned once across the slabs
+  std::vector<size_t> fallback(pattern.size(), 0);
+  for (size_t i = 1, matched = 0; i < pattern.size(); i++) {
+    while (matched && pattern[i] != pattern[matched])
+      matched = fallback[matched - 1];
+    if (pattern[i] == pattern[matched]) matched++;
+    fallback[i] = matched;
+  }
+  const size_t size = std::min(this->size(), limit);
+  size_t offset = 0, matched = 0;
+  for (size_t i = 0; i < slabs_.size() && offset < size; i++) {
+    const char* const slab = slabs_[i];
+    const size_t begin = i ? 0 : begin_;
+    const size_t end = std::min(i + 1 == slabs_.size() ? end_
+                                                       : BufferPool::kSlabSize,
+                                begin + size - offset);
+    for (size_t j = begin; j < end; j++) {
+      while (matched && slab[j] != pattern[matched])
+        matched = fallback[matched - 1];
+      if (slab[j] == pattern[matched] && ++matched == pattern.size())
+        return offset + j - begin + 1 - pattern.size();
+    }
+    offset += end - begin;
+  }
+  return std::string::npos;
+}
+
+void BufferChain::CopyTo(size_t size, std::string& output) const {
+  size = std::min(size, this->size());
+  output.reserve(output.size() + size);
+  for (size_t i = 0; size; i++) {
+    const size_t begin = i ? 0 : begin_;
+    const size_t end =
+        i + 1 == slabs_.size() ? end_ : BufferPool::kSlabSize;
+    const size_t length = std::min(end - begin, size);
+    output.append(slabs_[i] + begin, length);
+    size -= length;
+  }
+}
+
+void BufferChain::Consume(size_t size) {
+  if (size >= this->size()) {
+    Clear();
+    return;
+  }
+  while (size) {
+    const size_t end =
+        slabs_.size() == 1 ? end_ : BufferPool::kSlabSize;
+    const size_t length = std::min(end - begin_, size);
+    begin_ += length;
+    size -= length;
+    if (begin_ == BufferPool::kSlabSize) {
+      pool_->Release(slabs_.front());
+      slabs_.pop_front();
+      begin_ = 0;
+    }
+  }
+}
+
+size_t BufferChain::Read(char* const buffer, const size_t& size) {
+  const size_t length = std::min(size, this->size());
+  size_t copied = 0;
+  for (size_t i = 0; copied < length; i++) {
+    const size_t begin = i ? 0 : begin_;
+    const size_t end =
+        i + 1 == slabs_.size() ? end_ : BufferPool::kSlabSize;
+    const size_t slab_length = std::min(end - begin, length - copied);
+    memcpy(buffer + copied, slabs_[i] + begin, slab_length);
+    copied += slab_length;
+  }
+  Consume(length);
+  return length;
+}
+
+void BufferChain::Clear() {
+  for (const auto slab : slabs_) pool_->Release(slab);
+  slabs_.clear();
+  begin_ = end_ = 0;
+}
+
+void BufferChain::swap(BufferChain& other) noexcept {
+  std::swap(pool_, other.pool_);
+  slabs_.swap(other.slabs_);
+  std::swap(begin_, other.begin_);
+  std::swap(end_, other.end_);
+}
@@ -0,0 +1,170 @@
+#include "Capture.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+/**
+ * @brief append a LEB128 varint to a buffer
+ *
+ * @param buffer the buffer
+ * @param value the value
+ */
+static void AppendVarint(std::string& buffer, uint64_t value) {
+  while (value >= 0x80) {
+    buffer += static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  buffer += static_cast<char>(value);
+}
+
+Capture::~Capture() {
+  if (!flusher_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_running_ = false;
+  }
+  cv_.notify_one();
+  flusher_.join();
+  close(fd_);
+}
+
+bool Capture::Open(const std::string& path, const uint64_t& max_size) {
+  if (flusher_.joinable()) return false;  // already recording
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ == -1) return false;
+  max_size_ = max_size;
+  buffer_.assign(kMagic, sizeof(kMagic));
+  size_ = buffer_.size();
+  last_record_ = Clock::now();
+  is_running_ = true;
+  flusher_ = std::thread([this]() { FlushLoop(); });
+  is_enabled_ = true;
+  return true;
+}
+
+void Capture::OnConnected(const int& fd) {
+  if (!IsEnabled()) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto old = connections_.find(fd);
+  if (old != connections_.end())  // the close was missed, the fd is reused
+    Append(CLOSE, old->second);
+  const auto connection = next_connection_++;
+  connections_[fd] = connection;
+  Append(OPEN, connection);
+}
+
+void Capture::OnReceived(const int& fd, const void* const data,
+                         const size_t& size) {
+  if (!IsEnabled() || !size) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto connection = connections_.find(fd);
+  if (connection != connections_.end())
+    Append(DATA, connection->second, data, size);
+}
+
+void Capture::OnResponded(const int& fd) {
+  if (!IsEnabled()) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto connection = connections_.find(fd);
+  if (connection != connections_.end()) Append(RESPONSE, connection->second);
+}
+
+void Capture::OnDisconnected(const int& fd) {
+  if (!IsEnabled()) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto connection = connections_.find(fd);
+  if (connection == connections_.end()) return;
+  Append(CLOSE, connection->second);
+  connections_.erase(connection);
+}
+
+void Capture::Append(const RecordType& type, const uint64_t& connection,
+                     const void* const data, const size_t& size) {
+  if (size_ >= max_size_) {  // full, stop recording
+    is_enabled_ = false;
+    return;
+  }
+  const auto now = Clock::now();
+  const auto old_size = buffer_.size();
+  buffer_ += static_cast<char>(type);
+  AppendVarint(buffer_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            now - last_record_)
+                            .count());
+  AppendVarint(buffer_, connection);
+  if (type == DATA) {
+    AppendVarint(buffer_, size);
+    buffer_.append(static_cast<const char*>(data), size);
+  }
+  last_record_ = now;
+  size_ += buffer_.size() - old_size;
+}
+
+void Capture::FlushLoop() {
+  std::string writing;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait_for(lock, std::chrono::milliseconds(100),
+                 [this]() { return !is_running_; });
+    const bool is_last = !is_running_;
+    writing.swap(buffer_);
+    lock.unlock();
+    for (size_t written = 0; written < writing.size();) {
+      const auto ret =
+          write(fd_, writing.data() + written, writing.size() - written);
+      if (ret == -1) {
+        if (errno == EINTR) continue;
+        is_enabled_ = false;  // can't write any more
+        break;
+      }
+      written += ret;
+    }
+    writing.clear();
+    if (is_last) return;
+    lock.lock();
+  }
+}
+
+CaptureReader::CaptureReader(const std::string& path)
+    : file_(fopen(path.c_str(), "rb")), is_valid_(false), timestamp_ns_(0) {
+  if (!file_) return;
+  char magic[sizeof(Capture::kMagic)];
+  is_valid_ = fread(magic, 1, sizeof(magic), file_) == sizeof(magic) &&
+              !memcmp(magic, Capture::kMagic, sizeof(magic));
+}
+
+CaptureReader::~CaptureReader() {
+  if (file_) fclose(file_);
+}
+
+bool CaptureReader::Next(Record& record) {
+  if (!is_valid_) return false;
+  const int type = fgetc(file_);
+  if (type == EOF || type > Capture::CLOSE) return false;
+  uint64_t delta;
+  if (!ReadVarint(delta) || !ReadVarint(record.connection)) return false;
+  record.type = static_cast<Capture::RecordType>(type);
+  timestamp_ns_ += delta;
+  record.timestamp_ns = timestamp_ns_;
+  record.data.clear();
+  if (record.type == Capture::DATA) {
+    uint64_t size;
+    if (!ReadVarint(size)) return false;
+    record.data.resize(size);
+    if (fread(&record.data[0], 1, size, file_) != size) return false;
+  }
+  return true;
+}
+
+bool CaptureReader::ReadVarint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    const int byte = fgetc(file_);
+    if (byte == EOF) return false;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
@@ -0,0 +1,269 @@
+#include "EventLoop.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#include "Affinity.hpp"
+#include "HTTPSimple.hpp"
+
+using namespace std::chrono_literals;
+
+// the loop whose requests the thread handles, and the loop the thread runs
+static thread_local EventLoop* current_event_loop = nullptr;
+static thread_local const EventLoop* running_event_loop = nullptr;
+
+EventLoop::EventLoop(Server* const server, const int& id)
+    : server_(server), id_(id) {
+  router_ = std::make_unique<Router>(server, this);
+}
+
+EventLoop::~EventLoop() = default;
+
+void EventLoop::Start(const std::vector<int>& cpus, const bool& bind_memory) {
+  cpus_ = cpus;
+  thread_ = std::make_unique<std::thread>([this, bind_memory]() {
+    PlaceCurrentThread(cpus_, bind_memory);
+    current_event_loop = this;
+    running_event_loop = this;
+    Run();
+  });
+}
+
+void EventLoop::Join() {
+  if (thread_ && thread_->joinable()) thread_->join();
+}
+
+EventLoop* EventLoop::Current() { return current_event_loop; }
+
+void EventLoop::SetCurrent(EventLoop* const event_loop) {
+  current_event_loop = event_loop;
+}
+
+bool EventLoop::IsInLoopThread() const { return running_event_loop == this; }
+
+void EventLoop::Resume(const std::coroutine_handle<>& handle) {
+  {
+    std::lock_guard<std::mutex> lock(resume_mutex_);
+    ready_.push_back(handle);
+  }
+  if (!IsInLoopThread()) Wake();
+}
+
+void EventLoop::ResumeAfter(const std::chrono::nanoseconds& delay,
+                            const std::coroutine_handle<>& handle) {
+  const auto deadline = Clock::now() + delay;
+  bool is_earliest;
+  {
+    std::lock_guard<std::mutex> lock(resume_mutex_);
+    timers_.push({deadline, handle});
+    is_earliest = deadline < next_timer_;
+  }
+  // the loop thread computes its timeout after running the timers
+  if (is_earliest && !IsInLoopThread()) Wake();
+}
+
+ssize_t EventLoop::Recv(const int& fd, BufferChain& input) {
+  size_t size;
+  char* const buffer = input.Reserve(size);
+  const auto ret = Recv(fd, buffer, size);
+  input.Commit(ret > 0 ? ret : 0);
+  return ret;
+}
+
+void EventLoop::Offload(std::function<void()>&& func) {
+  router_->ThreadPool::push([this, func = std::move(func)](int) {
+    SetCurrent(this);
+    func();
+  });
+}
+
+EventLoop::Clock::time_point EventLoop::ResumeDue() {
+  std::vector<std::coroutine_handle<>> due;
+  {
+    std::lock_guard<std::mutex> lock(resume_mutex_);
+    due.swap(ready_);
+    const auto now = Clock::now();
+    while (!timers_.empty() && timers_.top().first <= now) {
+      due.push_back(timers_.top().second);
+      timers_.pop();
+    }
+  }
+  for (const auto& handle : due) handle.resume();
+  std::lock_guard<std::mutex> lock(resume_mutex_);
+  if (!ready_.empty())  // resumed by the coroutines above, due now
+    next_timer_ = Clock::now();
+  else if (!timers_.empty())
+    next_timer_ = timers_.top().first;
+  else
+    next_timer_ = Clock::time_point::max();
+  return next_timer_;
+}
+
+bool EventLoop::HasDue() {
+  std::lock_guard<std::mutex> lock(resume_mutex_);
+  return !ready_.empty() ||
+         (!timers_.empty() && timers_.top().first < next_timer_);
+}
+
+EpollEventLoop::EpollEventLoop(Server* const server, const int& id)
+    : EventLoop(server, id),
+      epfd_(epoll_create1(0)),
+      wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeData;
+  epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
+
+EpollEventLoop::~EpollEventLoop() {
+  close(wake_fd_);
+  close(epfd_);
+}
+
+bool EpollEventLoop::Accept(const int&) { return false; }
+
+bool EpollEventLoop::Add(const int& fd) {
+  epoll_event event;
+  event.events = EPOLLIN | EPOLLET;
+  event.data.u64 = static_cast<uint64_t>(fd);
+  return epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+ssize_t EpollEventLoop::Recv(const int& fd, void* buffer, const size_t& size) {
+  const auto ret = recv(fd, buffer, size, 0);
+  if (ret > 0 && server_->capture_.IsEnabled())
+    server_->capture_.OnReceived(fd, buffer, ret);
+  return ret;
+}
+
+bool EpollEventLoop::Send(const int& fd,
+                          const std::shared_ptr<const std::string>& data_ptr,
+                          const bool& close_after) {
+  server_->capture_.OnResponded(fd);
+  const std::string& data = *data_ptr;
+  size_t sent = 0;
+  for (int i = 0; i < 10 && sent < data.size();) {  // try 10 times
+    const auto ret =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (ret == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {  // can't send now
+        std::this_thread::sleep_for(200ms);
+        i++;
+        continue;
+      } else {  // encountered error
+        std::stringstream error_ss;
+        error_ss << '[' << server_->client_addrs_[fd]
+                 << "] send() failed, errno: " << errno;
+        server_->logger.Error(error_ss.str());
+        if (close_after) Close(fd);
+        return false;
+      }
+    }
+    sent += ret;
+  }
+  if (sent < data.size()) {  // sent failed after 10 retries
+    std::stringstream error_ss;
+    error_ss << '[' << server_->client_addrs_[fd]
+             << "] send() failed after 10 retries";
+    server_->logger.Error(error_ss.str());
+  }
+  if (close_after) Close(fd);
+  return sent == data.size();
+}
+
+void EpollEventLoop::Close(const int& fd) {
+  router_->OnDisconnected(fd);
+  server_->OnDisconnected(fd);  // before the fd can be reused
+  close(fd);
+}
+
+void EpollEventLoop::ResumeWhenReady(const int& fd, Waiter* const waiter) {
+  epoll_event event;
+  event.events = waiter->events | EPOLLONESHOT;
+  event.data.u64 = kWatchFlag | static_cast<uint32_t>(fd);
+  {
+    std::lock_guard<std::mutex> lock(watches_mutex_);
+    watches_[fd] = waiter;
+    // a fd stays registered after its one-shot event, re-arm it
+    if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &event) == 0 ||
+        (errno == ENOENT && epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) == 0))
+      return;
+    watches_.erase(fd);
+  }
+  waiter->events = EPOLLERR;
+  Resume(waiter->handle);
+}
+
+void EpollEventLoop::Wake() {
+  const uint64_t value = 1;
+  if (write(wake_fd_, &value, sizeof(value)) < 0) {
+    std::stringstream ss;
+    ss << "Event loop " << id_ << " wake up failed, errno: " << errno;
+    server_->logger.Error(ss.str());
+  }
+}
+
+void EpollEventLoop::Run() {
+  Tracer& tracer = server_->tracer;
+  epoll_event events[kMaxEpollEvents];
+  for (;;) {
+    const bool is_traced = tracer.Sample();
+    const auto next_timer = ResumeDue();
+    int timeout = -1;
+    if (next_timer != Clock::time_point::max())  // rounded up to milliseconds
+      timeout = static_cast<int>(std::max<int64_t>(
+          std::chrono::ceil<std::chrono::milliseconds>(next_timer -
+                                                       Clock::now())
+              .count(),
+          0));
+    const auto wait_begin = is_traced ? Clock::now() : Clock::time_point();
+    const int num_ready = epoll_wait(epfd_, events, kMaxEpollEvents, timeout);
+    const auto woken = is_traced ? Clock::now() : Clock::time_point();
+    for (int i = 0; i < num_ready; i++) {
+      const uint64_t data = events[i].data.u64;
+      if (data == kWakeData) {  // coroutines to resume
+        uint64_t value;
+        while (read(wake_fd_, &value, sizeof(value)) > 0) {
+        }
+        continue;
+      }
+      if (data & kWatchFlag) {  // a coroutine waits for it
+        const int fd = static_cast<int>(data & ~kWatchFlag);
+        Waiter* waiter = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(watches_mutex_);
+          const auto watch = watches_.find(fd);
+          if (watch != watches_.end()) {
+            waiter = watch->second;
+            watches_.erase(watch);
+          }
+        }
+        if (waiter) {
+          waiter->events = events[i].events;
+          waiter->handle.resume();
+        }
+        continue;
+      }
+      const int fd = static_cast<int>(data);
+      if (events[i].events & EPOLLIN) {  // incoming request
+        router_->push(fd);
+      } else {  // encounter error
+        std::stringstream ss;
+        ss << server_->client_addrs_[fd] << " disconnected";
+        server_->logger.Info(ss.str());
+        Close(fd);
+      }
+    }
+    if (is_traced) {
+      const auto args = "\"events\":" + std::to_string(num_ready);
+      tracer.Record("epoll_wait", wait_begin, woken, std::string(args));
+      tracer.Record("dispatch", woken, Clock::now(), std::string(args));
+    }
+  }
+}
@@ -0,0 +1,421 @@
+#include "Hpack.hpp"
+
+#include <algorithm>
+
+// the static table (RFC 7541 Appendix A)
+static const HeaderField kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// the Huffman code of each symbol (RFC 7541 Appendix B), with its length in
+// bits
+static const std::pair<uint32_t, uint8_t> kHuffmanCodes[256] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6},
+    {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+    {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6},
+    {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7},
+    {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7},
+    {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7}, {0xfd, 8},
+    {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6},
+    {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6},
+    {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5},
+    {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7},
+    {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22},
+    {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22},
+    {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23},
+    {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24},
+    {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24},
+    {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+    {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22},
+    {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22},
+    {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22},
+    {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21}, {0x7fffea, 23},
+    {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21},
+    {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+    {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23},
+    {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20},
+    {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23},
+    {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26},
+    {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22},
+    {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26},
+    {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27},
+    {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19},
+    {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27},
+    {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21},
+    {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28},
+    {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20},
+    {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22},
+    {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22},
+    {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24},
+    {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26},
+    {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27},
+    {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27},
+    {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27},
+    {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+};
+
+static const size_t kStaticTableSize =
+    sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+// the overhead of a field in the dynamic table
+static const size_t kFieldOverhead = 32;
+
+// a node of the Huffman decoding tree, either a symbol or a branch
+struct HuffmanNode {
+  int16_t children[2] = {-1, -1};
+  int16_t symbol = -1;
+};
+
+/**
+ * @brief get the Huffman decoding tree, built from the codes on first use
+ *
+ * @return the nodes, the root first
+ */
+static const std::vector<HuffmanNode>& HuffmanTree() {
+  static const std::vector<HuffmanNode> tree = []() {
+    std::vector<HuffmanNode> nodes(1);
+    for (int16_t symbol = 0; symbol < 256; symbol++) {
+      const auto& code = kHuffmanCodes[symbol];
+      size_t node = 0;
+      for (int bit = code.second - 1; bit >= 0; bit--) {
+        const int branch = (code.first >> bit) & 1;
+        if (nodes[node].children[branch] == -1) {
+          nodes[node].children[branch] = static_cast<int16_t>(nodes.size());
+          nodes.emplace_back();
+        }
+        node = nodes[node].children[branch];
+      }
+      nodes[node].symbol = symbol;
+    }
+    return nodes;
+  }();
+  return tree;
+}
+
+/**
+ * @brief append an integer with an N-bit prefix (RFC 7541 5.1)
+ *
+ * @param first the bits of the first byte above the prefix
+ * @param prefix_bits N
+ * @param value the integer
+ * @param block the output
+ */
+static void EncodeInteger(const uint8_t& first, const int& prefix_bits,
+                          uint64_t value, std::string& block) {
+  const uint64_t max_prefix = (1u << prefix_bits) - 1;
+  if (value < max_prefix) {
+    block += static_cast<char>(first | value);
+    return;
+  }
+  block += static_cast<char>(first | max_prefix);
+  value -= max_prefix;
+  while (value >= 0x80) {
+    block += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  block += static_cast<char>(value);
+}
+
+/**
+ * @brief read an integer with an N-bit prefix (RFC 7541 5.1)
+ *
+ * @param block the input
+ * @param pos the position in the input, moved past the integer
+ * @param prefix_bits N
+ * @param value the integer
+ * @return false if it is truncated or too large
+ */
+static bool DecodeInteger(const std::string& block, size_t& pos,
+                          const int& prefix_bits, uint64_t& value) {
+  if (pos >= block.size()) return false;
+  const uint64_t max_prefix = (1u << prefix_bits) - 1;
+  value = static_cast<uint8_t>(block[pos++]) & max_prefix;
+  if (value < max_prefix) return true;
+  for (int shift = 0; shift <= 28; shift += 7) {
+    if (pos >= block.size()) return false;
+    const uint8_t byte = block[pos++];
+    value += static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief append a string literal (RFC 7541 5.2), Huffman encoded if shorter
+ *
+ * @param str the string
+ * @param block the output
+ */
+static void EncodeString(const std::string& str, std::string& block) {
+  const auto huffman_size = HuffmanEncodedSize(str);
+  if (huffman_size < str.size()) {
+    EncodeInteger(0x80, 7, huffman_size, block);
+    HuffmanEncode(str, block);
+  } else {
+    EncodeInteger(0, 7, str.size(), block);
+    block += str;
+  }
+}
+
+/**
+ * @brief read a string literal (RFC 7541 5.2)
+ *
+ * @param block the input
+ * @param pos the position in the input, moved past the string
+ * @param str the string
+ * @return false if it is malformed
+ */
+static bool DecodeString(const std::string& block, size_t& pos,
+                         std::string& str) {
+  if (pos >= block.size()) return false;
+  const bool is_huffman = block[pos] & 0x80;
+  uint64_t length;
+  if (!DecodeInteger(block, pos, 7, length) || length > block.size() - pos)
+    return false;
+  str.clear();
+  if (is_huffman) {
+    if (!HuffmanDecode(reinterpret_cast<const uint8_t*>(block.data() + pos),
+                       length, str))
+      return false;
+  } else {
+    str.assign(block, pos, length);
+  }
+  pos += length;
+  return true;
+}
+
+const HeaderField* HpackTable::Get(const size_t& index) const {
+  if (!index) return nullptr;
+  if (index <= kStaticTableSize) return &kStaticTable[index - 1];
+  const size_t dynamic_index = index - kStaticTableSize - 1;
+  return dynamic_index < fields_.size() ? &fields_[dynamic_index] : nullptr;
+}
+
+size_t HpackTable::Find(const HeaderField& field, bool& is_exact) const {
+  size_t name_index = 0;
+  is_exact = false;
+  for (size_t i = 0; i < kStaticTableSize; i++) {
+    if (kStaticTable[i].first != field.first) continue;
+    if (kStaticTable[i].second == field.second) {
+      is_exact = true;
+      return i + 1;
+    }
+    if (!name_index) name_index = i + 1;
+  }
+  for (size_t i = 0; i < fields_.size(); i++) {
+    if (fields_[i].first != field.first) continue;
+    if (fields_[i].second == field.second) {
+      is_exact = true;
+      return kStaticTableSize + 1 + i;
+    }
+    if (!name_index) name_index = kStaticTableSize + 1 + i;
+  }
+  return name_index;
+}
+
+void HpackTable::Add(const HeaderField& field) {
+  const size_t field_size =
+      field.first.size() + field.second.size() + kFieldOverhead;
+  while (!fields_.empty() && size_ + field_size > max_size_) {
+    size_ -= fields_.back().first.size() + fields_.back().second.size() +
+             kFieldOverhead;
+    fields_.pop_back();
+  }
+  if (field_size > max_size_) return;  // too large, the table is just emptied
+  fields_.push_front(field);
+  size_ += field_size;
+}
+
+void HpackTable::SetMaxSize(const size_t& max_size) {
+  max_size_ = max_size;
+  while (!fields_.empty() && size_ > max_size_) {
+    size_ -= fields_.back().first.size() + fields_.back().second.size() +
+             kFieldOverhead;
+    fields_.pop_back();
+  }
+}
+
+bool HpackDecoder::Decode(const std::string& block, HeaderList& fields) {
+  size_t pos = 0;
+  while (pos < block.size()) {
+    const uint8_t first = block[pos];
+    if (first & 0x80) {  // indexed field
+      uint64_t index;
+      if (!DecodeInteger(block, pos, 7, index)) return false;
+      const auto field = table_.Get(index);
+      if (!field) return false;
+      fields.push_back(*field);
+    } else if ((first & 0xe0) == 0x20) {  // dynamic table size update
+      uint64_t size;
+      if (!DecodeInteger(block, pos, 5, size) || size > max_table_size_)
+        return false;
+      table_.SetMaxSize(size);
+    } else {  // literal field, with or without indexing, or never indexed
+      const bool is_indexing = (first & 0xc0) == 0x40;
+      uint64_t index;
+      if (!DecodeInteger(block, pos, is_indexing ? 6 : 4, index)) return false;
+      HeaderField field;
+      if (index) {  // indexed name
+        const auto name = table_.Get(index);
+        if (!name) return false;
+        field.first = name->first;
+      } else if (!DecodeString(block, pos, field.first)) {
+        return false;
+      }
+      if (!DecodeString(block, pos, field.second)) return false;
+      if (is_indexing) table_.Add(field);
+      fields.push_back(std::move(field));
+    }
+  }
+  return true;
+}
+
+void HpackEncoder::SetMaxTableSize(const size_t& size) {
+  const auto max_size = std::min(size, HpackTable::kDefaultMaxSize);
+  if (max_size == table_.max_size()) return;
+  table_.SetMaxSize(max_size);
+  is_size_update_pending_ = true;
+}
+
+void HpackEncoder::Encode(const HeaderList& fields, std::string& block) {
+  if (is_size_update_pending_) {
+    EncodeInteger(0x20, 5, table_.max_size(), block);
+    is_size_update_pending_ = false;
+  }
+  for (const auto& field : fields) {
+    bool is_exact;
+    const auto index = table_.Find(field, is_exact);
+    if (is_exact) {
+      EncodeInteger(0x80, 7, index, block);
+      continue;
+    }
+    // the lengths differ from a response to another, they would only push
+    // the other fields out of the table
+    const bool is_indexing = field.first != "content-length";
+    EncodeInteger(is_indexing ? 0x40 : 0, is_indexing ? 6 : 4, index, block);
+    if (!index) EncodeString(field.first, block);
+    EncodeString(field.second, block);
+    if (is_indexing) table_.Add(field);
+  }
+}
+
+bool HuffmanDecode(const uint8_t* data, const size_t& size,
+                   std::string& output) {
+  const auto& tree = HuffmanTree();
+  size_t node = 0;
+  int depth = 0;  // the bits read since the last symbol
+  bool is_all_ones = true;
+  for (size_t i = 0; i < size; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      const int branch = (data[i] >> bit) & 1;
+      const auto next = tree[node].children[branch];
+      if (next == -1) return false;  // EOS, or not a code
+      node = next;
+      depth++;
+      is_all_ones = is_all_ones && branch;
+      if (tree[node].symbol != -1) {
+        output += static_cast<char>(tree[node].symbol);
+        node = 0;
+        depth = 0;
+        is_all_ones = true;
+      }
+    }
+  }
+  // the padding is the beginning of EOS (all ones), shorter than a byte
+  return depth < 8 && is_all_ones;
+}
+
+void HuffmanEncode(const std::string& input, std::string& output) {
+  uint64_t bits = 0;
+  int bit_num = 0;
+  for (const unsigned char c : input) {
+    const auto& code = kHuffmanCodes[c];
+    bits = (bits << code.second) | code.first;
+    bit_num += code.second;
+    while (bit_num >= 8) {
+      bit_num -= 8;
+      output += static_cast<char>(bits >> bit_num);
+    }
+    bits &= (uint64_t(1) << bit_num) - 1;
+  }
+  if (bit_num)  // padded with the beginning of EOS
+    output += static_cast<char>((bits << (8 - bit_num)) | (0xff >> bit_num));
+}
+
+size_t HuffmanEncodedSize(const std::string& input) {
+  size_t bit_num = 0;
+  for (const unsigned char c : input) bit_num += kHuffmanCodes[c].second;
+  return (bit_num + 7) / 8;
+}
@@ -0,0 +1,588 @@
+#include "Http2.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+
+#include "EventLoop.hpp"
+#include "XForm.hpp"
+
+static const size_t kFrameHeaderSize = 9;
+// the SETTINGS_MAX_FRAME_SIZE of both sides (the initial value)
+static const size_t kMaxFrameSize = 16384;
+static const uint32_t kMaxConcurrentStreams = 128;
+// the windows of the peer, given back as soon as the bytes arrive
+static const int64_t kDefaultWindow = 65535;
+static const int64_t kReceiveWindow = 1 << 20;
+static const int64_t kMaxWindow = 0x7fffffff;
+static const size_t kMaxHeaderBlockSize = 1 << 20;
+
+// the flags of the frames
+static const uint8_t kEndStream = 0x1;
+static const uint8_t kAck = 0x1;
+static const uint8_t kEndHeaders = 0x4;
+static const uint8_t kPadded = 0x8;
+static const uint8_t kPriority = 0x20;
+
+// the identifiers of the settings
+static const uint16_t kHeaderTableSize = 0x1;
+static const uint16_t kMaxConcurrentStreamsId = 0x3;
+static const uint16_t kInitialWindowSize = 0x4;
+static const uint16_t kMaxFrameSizeId = 0x5;
+
+static const char* const kMethodNames[] = {
+    "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "TRACE", "CONNECT",
+    "PATCH"};
+
+/**
+ * @brief read a big-endian integer
+ *
+ * @param data the bytes
+ * @param size the number of bytes
+ * @return the integer
+ */
+static uint32_t ReadUint(const char* data, const size_t& size) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < size; i++)
+    value = (value << 8) | static_cast<uint8_t>(data[i]);
+  return value;
+}
+
+/**
+ * @brief append a big-endian integer
+ *
+ * @param value the integer
+ * @param size the number of bytes
+ * @param output the output
+ */
+static void WriteUint(const uint32_t& value, const size_t& size,
+                      std::string& output) {
+  for (size_t i = size; i > 0; i--)
+    output += static_cast<char>((value >> (8 * (i - 1))) & 0xff);
+}
+
+/**
+ * @brief convert the lowercase name of a HTTP/2 header to the usual HTTP/1.1
+ * spelling that the controllers look for (content-type -> Content-Type)
+ *
+ * @param name the name
+ * @return the converted name
+ */
+static std::string CanonicalName(std::string name) {
+  bool is_word_begin = true;
+  for (auto& c : name) {
+    if (is_word_begin) c = static_cast<char>(toupper(c));
+    is_word_begin = c == '-';
+  }
+  return name;
+}
+
+/**
+ * @brief decode base64url without padding (RFC 4648 5), as in HTTP2-Settings
+ *
+ * @param input the encoded string
+ * @param output the decoded bytes
+ * @return false if it is malformed
+ */
+static bool DecodeBase64Url(const std::string& input, std::string& output) {
+  uint32_t bits = 0;
+  int bit_num = 0;
+  for (const char c : input) {
+    int value;
+    if (c >= 'A' && c <= 'Z') {
+      value = c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+      value = c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+      value = c - '0' + 52;
+    } else if (c == '-' || c == '+') {
+      value = 62;
+    } else if (c == '_' || c == '/') {
+      value = 63;
+    } else if (c == '=') {
+      break;
+    } else {
+      return false;
+    }
+    bits = (bits << 6) | value;
+    bit_num += 6;
+    if (bit_num >= 8) {
+      bit_num -= 8;
+      output += static_cast<char>((bits >> bit_num) & 0xff);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief build a request from the fields of its header block
+ *
+ * @param fields the fields
+ * @param request the request
+ * @return false if it is malformed
+ */
+static bool BuildRequest(const HeaderList& fields, HttpRequest& request) {
+  std::string method, path, authority;
+  for (const auto& field : fields) {
+    if (field.first.empty()) return false;
+    if (field.first[0] == ':') {  // pseudo-header
+      if (field.first == ":method")
+        method = field.second;
+      else if (field.first == ":path")
+        path = field.second;
+      else if (field.first == ":authority")
+        authority = field.second;
+      continue;
+    }
+    auto& value = request.headers[CanonicalName(field.first)];
+    if (!value.empty())  // repeated, e.g. the crumbs of a cookie
+      value += field.first == "cookie" ? "; " : ", ";
+    value += field.second;
+  }
+  const auto method_name =
+      std::find_if(std::begin(kMethodNames), std::end(kMethodNames),
+                   [&method](const char* name) { return method == name; });
+  if (method_name == std::end(kMethodNames) || path.empty()) return false;
+  request.method = static_cast<HttpMethod>(method_name - kMethodNames);
+  if (!authority.empty() && !request.headers.count("Host"))
+    request.headers["Host"] = authority;
+  const auto query_pos = path.find('?');
+  if (query_pos == std::string::npos) {
+    request.path = path;
+  } else {
+    request.path = path.substr(0, query_pos);
+    request.params = DecodeXWWWFormUrlencoded(
+        std::string_view(path).substr(query_pos + 1));
+  }
+  return true;
+}
+
+Http2Connection::Http2Connection(EventLoop* const event_loop, const int& fd,
+                                 DispatchFunc&& dispatch)
+    : event_loop_(event_loop),
+      fd_(fd),
+      dispatch_(std::move(dispatch)),
+      send_window_(kDefaultWindow),
+      initial_send_window_(kDefaultWindow),
+      max_send_frame_size_(kMaxFrameSize) {}
+
+void Http2Connection::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  WriteSettings();
+  SendOutput();
+}
+
+bool Http2Connection::Upgrade(const std::string& settings,
+                              HttpRequestPtr& request) {
+  std::string payload;
+  if (!DecodeBase64Url(settings, payload)) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ApplySettings(payload.data(), payload.size()) != NO_ERROR) return false;
+  output_ =
+      "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\n"
+      "Upgrade: h2c\r\n\r\n";
+  WriteSettings();
+  last_stream_id_ = 1;
+  auto& stream = streams_[1];
+  stream.is_head = request->method == HttpMethod::HEAD;
+  stream.request = std::move(request);
+  stream.send_window = initial_send_window_;
+  Dispatch(1, stream);
+  SendOutput();
+  return true;
+}
+
+Http2Connection::ErrorCode Http2Connection::Serve(std::string&& received) {
+  ErrorCode error = NO_ERROR;
+  bool is_closing = false;
+  std::string last_output;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (is_closed_) return NO_ERROR;
+    input_ += received;
+    BufferChain buffer(event_loop_->buffer_pool());
+    for (;;) {
+      error = Process();
+      if (error != NO_ERROR) break;
+      const auto ret = event_loop_->Recv(fd_, buffer);
+      if (ret > 0) {
+        buffer.Read(buffer.size(), input_);
+      } else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;  // no data available
+      } else if (ret != -1 || errno != EINTR) {  // closed by the peer, or error
+        is_closing = true;
+        break;
+      }
+    }
+    if (error != NO_ERROR) {
+      std::string goaway;
+      WriteUint(last_stream_id_, 4, goaway);
+      WriteUint(error, 4, goaway);
+      WriteFrame(GOAWAY, 0, 0, goaway.data(), goaway.size());
+      is_closing = true;
+    } else if (received_num_) {  // give the received bytes back
+      std::string increment;
+      WriteUint(static_cast<uint32_t>(received_num_), 4, increment);
+      WriteFrame(WINDOW_UPDATE, 0, 0, increment.data(), increment.size());
+      received_num_ = 0;
+    }
+    if (is_closing) {  // nothing can be sent from now on
+      is_closed_ = true;
+      last_output.swap(output_);
+    } else {
+      SendOutput();
+    }
+  }
+  if (!is_closing) return NO_ERROR;
+  // unlocked, as closing the socket calls OnClosed()
+  if (last_output.empty())
+    event_loop_->Close(fd_);
+  else
+    event_loop_->Send(fd_, std::move(last_output), true);
+  return error;
+}
+
+bool Http2Connection::Respond(const uint32_t& stream_id,
+                              const HttpResponse& response,
+                              const HttpStatusCode& status_code) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (is_closed_) return false;
+  const auto stream = streams_.find(stream_id);
+  if (stream == streams_.end()) return false;  // reset by the peer
+
+  HeaderList fields = {
+      {":status", std::to_string(static_cast<int>(status_code))}};
+  for (const auto& header : response.headers) {
+    std::string name = header.first;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    // specific to HTTP/1.1 connections
+    if (name == "connection" || name == "keep-alive" ||
+        name == "proxy-connection" || name == "transfer-encoding" ||
+        name == "upgrade")
+      continue;
+    fields.emplace_back(std::move(name), header.second);
+  }
+  std::string body;
+  if (!stream->second.is_head) {
+    if (response.filepath.empty()) {  // content in memory
+      body = response.body;
+    } else {  // content in file
+      std::ifstream file(response.filepath);
+      std::stringstream ss;
+      ss << file.rdbuf();
+      body = ss.str();
+    }
+  }
+
+  std::string block;
+  encoder_.Encode(fields, block);
+  const uint8_t end_stream = body.empty() ? kEndStream : 0;
+  size_t offset = 0;
+  do {  // split into CONTINUATION frames if it's too large for one
+    const auto length = std::min(block.size() - offset, max_send_frame_size_);
+    const uint8_t end_headers = offset + length == block.size() ? kEndHeaders
+                                                                 : 0;
+    if (!offset)
+      WriteFrame(HEADERS, end_stream | end_headers, stream_id, block.data(),
+                 length);
+    else
+      WriteFrame(CONTINUATION, end_headers, stream_id, block.data() + offset,
+                 length);
+    offset += length;
+  } while (offset < block.size());
+  if (body.empty()) {
+    streams_.erase(stream);
+  } else {
+    stream->second.body = std::move(body);
+    stream->second.is_responding = true;
+    WriteData();
+  }
+  SendOutput();
+  return true;
+}
+
+void Http2Connection::OnClosed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_closed_ = true;
+  streams_.clear();
+}
+
+Http2Connection::ErrorCode Http2Connection::Process() {
+  if (!is_preface_received_) {
+    const auto size = std::min(input_.size(), kPrefaceSize);
+    if (input_.compare(0, size, kPreface, size)) return PROTOCOL_ERROR;
+    if (size < kPrefaceSize) return NO_ERROR;
+    input_.erase(0, kPrefaceSize);
+    is_preface_received_ = true;
+    WriteData();
+  }
+  size_t pos = 0;
+  ErrorCode error = NO_ERROR;
+  while (input_.size() - pos >= kFrameHeaderSize) {
+    const char* const header = input_.data() + pos;
+    const size_t length = ReadUint(header, 3);
+    const uint8_t type = header[3], flags = header[4];
+    const uint32_t stream_id = ReadUint(header + 5, 4) & 0x7fffffff;
+    if (length > kMaxFrameSize) {
+      error = FRAME_SIZE_ERROR;
+      break;
+    }
+    if (input_.size() - pos - kFrameHeaderSize < length) break;  // partial
+    error = ProcessFrame(type, flags, stream_id, header + kFrameHeaderSize,
+                         length);
+    if (error != NO_ERROR) break;
+    pos += kFrameHeaderSize + length;
+  }
+  input_.erase(0, pos);
+  return error;
+}
+
+Http2Connection::ErrorCode Http2Connection::ProcessFrame(
+    const uint8_t& type, const uint8_t& flags, const uint32_t& stream_id,
+    const char* payload, const size_t& length) {
+  // a header block can't be interrupted
+  if (continued_stream_id_ &&
+      (type != CONTINUATION || stream_id != continued_stream_id_))
+    return PROTOCOL_ERROR;
+
+  switch (type) {
+    case DATA: {
+      if (!stream_id) return PROTOCOL_ERROR;
+      size_t begin = 0, padding = 0;
+      if (flags & kPadded) {
+        if (!length) return PROTOCOL_ERROR;
+        padding = static_cast<uint8_t>(payload[0]);
+        begin = 1;
+      }
+      if (begin + padding > length) return PROTOCOL_ERROR;
+      received_num_ += length;  // counted by flow control with the padding
+      const auto stream = streams_.find(stream_id);
+      if (stream == streams_.end() || !stream->second.request) {
+        if (stream_id > last_stream_id_) return PROTOCOL_ERROR;  // idle
+        ResetStream(stream_id, STREAM_CLOSED);
+        return NO_ERROR;
+      }
+      stream->second.request->body.append(payload + begin,
+                                          length - begin - padding);
+      if (flags & kEndStream) {
+        Dispatch(stream_id, stream->second);
+      } else if (length) {  // give the bytes back to the window of the stream
+        std::string increment;
+        WriteUint(static_cast<uint32_t>(length), 4, increment);
+        WriteFrame(WINDOW_UPDATE, 0, stream_id, increment.data(),
+                   increment.size());
+      }
+      return NO_ERROR;
+    }
+    case HEADERS: {
+      if (!stream_id) return PROTOCOL_ERROR;
+      size_t begin = 0, padding = 0;
+      if (flags & kPadded) {
+        if (!length) return PROTOCOL_ERROR;
+        padding = static_cast<uint8_t>(payload[0]);
+        begin = 1;
+      }
+      if (flags & kPriority) begin += 5;
+      if (begin + padding > length) return PROTOCOL_ERROR;
+      header_block_.assign(payload + begin, length - begin - padding);
+      if (flags & kEndHeaders)
+        return ProcessHeaderBlock(stream_id, flags & kEndStream);
+      continued_stream_id_ = stream_id;
+      is_continued_end_stream_ = flags & kEndStream;
+      return NO_ERROR;
+    }
+    case CONTINUATION: {
+      if (stream_id != continued_stream_id_) return PROTOCOL_ERROR;
+      header_block_.append(payload, length);
+      if (header_block_.size() > kMaxHeaderBlockSize) return PROTOCOL_ERROR;
+      if (!(flags & kEndHeaders)) return NO_ERROR;
+      continued_stream_id_ = 0;
+      return ProcessHeaderBlock(stream_id, is_continued_end_stream_);
+    }
+    case PRIORITY: {  // the streams are served in the order they complete
+      if (!stream_id) return PROTOCOL_ERROR;
+      if (length != 5) ResetStream(stream_id, FRAME_SIZE_ERROR);
+      return NO_ERROR;
+    }
+    case RST_STREAM: {
+      if (!stream_id) return PROTOCOL_ERROR;
+      if (length != 4) return FRAME_SIZE_ERROR;
+      if (stream_id > last_stream_id_) return PROTOCOL_ERROR;  // idle
+      streams_.erase(stream_id);  // its response is dropped
+      return NO_ERROR;
+    }
+    case SETTINGS: {
+      if (stream_id) return PROTOCOL_ERROR;
+      if (flags & kAck) return length ? FRAME_SIZE_ERROR : NO_ERROR;
+      const auto error = ApplySettings(payload, length);
+      if (error != NO_ERROR) return error;
+      WriteFrame(SETTINGS, kAck, 0, nullptr, 0);
+      WriteData();  // the windows of the streams may have grown
+      return NO_ERROR;
+    }
+    case PUSH_PROMISE:  // only servers push
+      return PROTOCOL_ERROR;
+    case PING: {
+      if (stream_id) return PROTOCOL_ERROR;
+      if (length != 8) return FRAME_SIZE_ERROR;
+      if (!(flags & kAck)) WriteFrame(PING, kAck, 0, payload, length);
+      return NO_ERROR;
+    }
+    case GOAWAY: {  // the peer closes the connection once it's done
+      if (stream_id) return PROTOCOL_ERROR;
+      return length < 8 ? FRAME_SIZE_ERROR : NO_ERROR;
+    }
+    case WINDOW_UPDATE: {
+      if (length != 4) return FRAME_SIZE_ERROR;
+      const int64_t increment = ReadUint(payload, 4) & 0x7fffffff;
+      if (!stream_id) {
+        if (!increment) return PROTOCOL_ERROR;
+        send_window_ += increment;
+        if (send_window_ > kMaxWindow) return FLOW_CONTROL_ERROR;
+      } else {
+        const auto stream = streams_.find(stream_id);
+        if (stream == streams_.end()) return NO_ERROR;  // closed already
+        if (!increment) {
+          ResetStream(stream_id, PROTOCOL_ERROR);
+          return NO_ERROR;
+        }
+        stream->second.send_window += increment;
+        if (stream->second.send_window > kMaxWindow) {
+          ResetStream(stream_id, FLOW_CONTROL_ERROR);
+          return NO_ERROR;
+        }
+      }
+      WriteData();
+      return NO_ERROR;
+    }
+    default:  // unknown frames are ignored
+      return NO_ERROR;
+  }
+}
+
+Http2Connection::ErrorCode Http2Connection::ProcessHeaderBlock(
+    const uint32_t& stream_id, const bool& is_end_stream) {
+  // always decoded, to keep the dynamic table in sync
+  HeaderList fields;
+  if (!decoder_.Decode(header_block_, fields)) return COMPRESSION_ERROR;
+  header_block_.clear();
+
+  const auto stream = streams_.find(stream_id);
+  if (stream != streams_.end()) {  // trailers, ignored
+    if (!stream->second.request || !is_end_stream)
+      ResetStream(stream_id, stream->second.request ? PROTOCOL_ERROR
+                                                    : STREAM_CLOSED);
+    else
+      Dispatch(stream_id, stream->second);
+    return NO_ERROR;
+  }
+  // the client opens the odd streams, in increasing order
+  if (!(stream_id & 1) || stream_id <= last_stream_id_) return PROTOCOL_ERROR;
+  last_stream_id_ = stream_id;
+  if (streams_.size() >= kMaxConcurrentStreams) {
+    ResetStream(stream_id, REFUSED_STREAM);
+    return NO_ERROR;
+  }
+  auto request = std::make_unique<HttpRequest>();
+  if (!BuildRequest(fields, *request)) {
+    ResetStream(stream_id, PROTOCOL_ERROR);
+    return NO_ERROR;
+  }
+  auto& new_stream = streams_[stream_id];
+  new_stream.is_head = request->method == HttpMethod::HEAD;
+  new_stream.request = std::move(request);
+  new_stream.send_window = initial_send_window_;
+  if (is_end_stream) Dispatch(stream_id, new_stream);
+  return NO_ERROR;
+}
+
+Http2Connection::ErrorCode Http2Connection::ApplySettings(
+    const char* payload, const size_t& length) {
+  if (length % 6) return FRAME_SIZE_ERROR;
+  for (size_t pos = 0; pos < length; pos += 6) {
+    const auto id = ReadUint(payload + pos, 2);
+    const int64_t value = ReadUint(payload + pos + 2, 4);
+    if (id == kHeaderTableSize) {
+      encoder_.SetMaxTableSize(value);
+    } else if (id == kInitialWindowSize) {
+      if (value > kMaxWindow) return FLOW_CONTROL_ERROR;
+      for (auto& stream : streams_)
+        stream.second.send_window += value - initial_send_window_;
+      initial_send_window_ = value;
+    } else if (id == kMaxFrameSizeId) {
+      if (value < static_cast<int64_t>(kMaxFrameSize) || value > 0xffffff)
+        return PROTOCOL_ERROR;
+      max_send_frame_size_ = value;
+    }
+  }
+  return NO_ERROR;
+}
+
+void Http2Connection::Dispatch(const uint32_t& stream_id, Stream& stream) {
+  dispatch_(shared_from_this(), stream_id, std::move(stream.request));
+}
+
+void Http2Connection::WriteData() {
+  // after an upgrade, the bodies wait for the client connection preface: a
+  // client may not buffer much more than its 101 response before it
+  if (!is_preface_received_) return;
+  for (auto stream = streams_.begin(); stream != streams_.end();) {
+    auto& state = stream->second;
+    while (state.is_responding && state.sent < state.body.size() &&
+           send_window_ > 0 && state.send_window > 0) {
+      const auto length = std::min<size_t>(
+          {state.body.size() - state.sent, static_cast<size_t>(send_window_),
+           static_cast<size_t>(state.send_window), max_send_frame_size_});
+      const bool is_last = state.sent + length == state.body.size();
+      WriteFrame(DATA, is_last ? kEndStream : 0, stream->first,
+                 state.body.data() + state.sent, length);
+      state.sent += length;
+      send_window_ -= length;
+      state.send_window -= length;
+    }
+    if (state.is_responding && state.sent == state.body.size())
+      stream = streams_.erase(stream);  // done
+    else
+      ++stream;
+  }
+}
+
+void Http2Connection::WriteSettings() {
+  std::string settings;
+  WriteUint(kMaxConcurrentStreamsId, 2, settings);
+  WriteUint(kMaxConcurrentStreams, 4, settings);
+  WriteUint(kInitialWindowSize, 2, settings);
+  WriteUint(kReceiveWindow, 4, settings);
+  WriteFrame(SETTINGS, 0, 0, settings.data(), settings.size());
+  std::string increment;  // the window of the connection isn't a setting
+  WriteUint(kReceiveWindow - kDefaultWindow, 4, increment);
+  WriteFrame(WINDOW_UPDATE, 0, 0, increment.data(), increment.size());
+}
+
+void Http2Connection::WriteFrame(const uint8_t& type, const uint8_t& flags,
+                                 const uint32_t& stream_id,
+                                 const char* payload, const size_t& length) {
+  WriteUint(static_cast<uint32_t>(length), 3, output_);
+  output_ += static_cast<char>(type);
+  output_ += static_cast<char>(flags);
+  WriteUint(stream_id, 4, output_);
+  if (length) output_.append(payload, length);
+}
+
+void Http2Connection::ResetStream(const uint32_t& stream_id,
+                                  const ErrorCode& error) {
+  std::string code;
+  WriteUint(error, 4, code);
+  WriteFrame(RST_STREAM, 0, stream_id, code.data(), code.size());
+  streams_.erase(stream_id);
+}
+
+void Http2Connection::SendOutput() {
+  if (output_.empty()) return;
+  event_loop_->Send(fd_, std::move(output_), false);
+  output_.clear();
+}
@@ -0,0 +1,436 @@
+#include "HttpClient.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+
+using namespace std::chrono_literals;
+
+static const size_t kBufferSize = 16384;
+static const size_t kMaxHeaderSize = 65536;
+static const size_t kDefaultMaxIdle = 16;
+
+static const char* const kMethodNames[] = {
+    "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "TRACE", "CONNECT",
+    "PATCH"};
+
+std::string ClientResponse::Header(const std::string& name) const {
+  for (const auto& header : headers)
+    if (!strcasecmp(header.first.c_str(), name.c_str())) return header.second;
+  return std::string();
+}
+
+// parses a response from the bytes of the connection, as they arrive
+class HttpClient::ResponseParser {
+ public:
+  explicit ResponseParser(const bool& is_head) : is_head_(is_head) {}
+
+  /**
+   * @brief parse more bytes
+   *
+   * @param data the bytes
+   * @param size the number of bytes
+   * @param response the response
+   * @return 1 if the response is complete, 0 if more bytes are needed, -1 if
+   * it is malformed
+   */
+  int Feed(const char* const data, const size_t& size,
+           ClientResponse& response) {
+    buffer_.append(data, size);
+    for (;;) {
+      switch (state_) {
+        case HEAD: {
+          const int ret = ParseHead(response);
+          if (ret <= 0) return ret;
+          break;
+        }
+        case LENGTH: {
+          const auto taken = std::min(remaining_, buffer_.size());
+          response.body.append(buffer_, 0, taken);
+          buffer_.erase(0, taken);
+          remaining_ -= taken;
+          return !remaining_;
+        }
+        case CHUNK_SIZE: {
+          const auto line_end = buffer_.find("\r\n");
+          if (line_end == std::string::npos) return 0;
+          char* size_end;
+          remaining_ = strtoull(buffer_.c_str(), &size_end, 16);
+          if (size_end == buffer_.c_str()) return -1;
+          buffer_.erase(0, line_end + 2);
+          state_ = remaining_ ? CHUNK_DATA : TRAILER;
+          remaining_ += 2;  // the CRLF after the data
+          break;
+        }
+        case CHUNK_DATA: {
+          if (buffer_.size() < remaining_) return 0;
+          response.body.append(buffer_, 0, remaining_ - 2);
+          buffer_.erase(0, remaining_);
+          state_ = CHUNK_SIZE;
+          break;
+        }
+        case TRAILER: {  // skip the trailer fields up to the empty line
+          const auto line_end = buffer_.find("\r\n");
+          if (line_end == std::string::npos) return 0;
+          buffer_.erase(0, line_end + 2);
+          if (!line_end) return 1;
+          break;
+        }
+        case UNTIL_CLOSE:
+          response.body += buffer_;
+          buffer_.clear();
+          return 0;
+      }
+    }
+  }
+
+  /**
+   * @brief the upstream has closed the connection
+   *
+   * @return whether that completes the response
+   */
+  bool Finish() const { return state_ == UNTIL_CLOSE; }
+
+  /**
+   * @brief whether the connection can be used by another request once the
+   * response is complete
+   *
+   * @return true if it can
+   */
+  bool IsKeepAlive() const { return is_keep_alive_ && buffer_.empty(); }
+
+ private:
+  enum State { HEAD, LENGTH, CHUNK_SIZE, CHUNK_DATA, TRAILER, UNTIL_CLOSE };
+
+  /**
+   * @brief parse the status line and the headers
+   *
+   * @param response the response
+   * @return 1 if they are parsed, 0 if more bytes are needed, -1 if they are
+   * malformed
+   */
+  int ParseHead(ClientResponse& response) {
+    const auto header_end = buffer_.find("\r\n\r\n");
+    if (header_end == std::string::npos)
+      return buffer_.size() > kMaxHeaderSize ? -1 : 0;
+    std::istringstream head_ss(buffer_.substr(0, header_end + 4));
+    buffer_.erase(0, header_end + 4);
+    std::string version, reason;
+    head_ss >> version >> response.status;
+    std::getline(head_ss, reason);
+    if (version.compare(0, 5, "HTTP/") || response.status < 100 ||
+        response.status > 999)
+      return -1;
+    response.headers.clear();
+    ParseHeaders(head_ss, response.headers);
+    if (response.status < 200) return ParseHead(response);  // 100 Continue
+
+    std::string connection = response.Header("Connection");
+    std::transform(connection.begin(), connection.end(), connection.begin(),
+                   ::tolower);
+    is_keep_alive_ = version == "HTTP/1.1" ? connection != "close"
+                                           : connection == "keep-alive";
+    std::string transfer_encoding = response.Header("Transfer-Encoding");
+    std::transform(transfer_encoding.begin(), transfer_encoding.end(),
+                   transfer_encoding.begin(), ::tolower);
+    const auto content_length = response.Header("Content-Length");
+    if (is_head_ || response.status == 204 || response.status == 304) {
+      state_ = LENGTH;
+      remaining_ = 0;
+    } else if (transfer_encoding.find("chunked") != std::string::npos) {
+      state_ = CHUNK_SIZE;
+    } else if (!content_length.empty() && transfer_encoding.empty()) {
+      char* length_end;
+      remaining_ = strtoull(content_length.c_str(), &length_end, 10);
+      if (length_end == content_length.c_str()) return -1;
+      state_ = LENGTH;
+    } else {  // delimited by the end of the connection
+      state_ = UNTIL_CLOSE;
+      is_keep_alive_ = false;
+    }
+    return 1;
+  }
+
+  const bool is_head_;
+  State state_ = HEAD;
+  size_t remaining_ = 0;  // of the body, or of the chunk with its CRLF
+  bool is_keep_alive_ = false;
+  std::string buffer_;  // the bytes not parsed yet
+};
+
+// a wait for a socket, ended by whoever comes first: the socket or the timer
+struct WaitState {
+  int fd;
+  std::atomic<bool> is_done{false};
+};
+
+/**
+ * @brief wake a wait up once it has timed out, by shutting the socket down
+ * (which ends the request anyway)
+ *
+ * @param state the wait
+ * @param timeout the timeout
+ */
+static DetachedTask Watchdog(const std::shared_ptr<WaitState> state,
+                             const std::chrono::nanoseconds timeout) {
+  co_await Sleep(timeout);
+  if (!state->is_done.exchange(true)) shutdown(state->fd, SHUT_RDWR);
+}
+
+/**
+ * @brief send a request from a HttpClient and call a function with the
+ * response in the worker group
+ *
+ * @param client the client
+ * @param method the method
+ * @param path the path
+ * @param body the body
+ * @param headers the headers
+ * @param callback the function
+ */
+static DetachedTask RunRequest(HttpClient* const client,
+                               const HttpMethod method, std::string path,
+                               std::string body, ClientHeaders headers,
+                               ClientCallback callback) {
+  auto response = co_await client->Request(method, std::move(path),
+                                           std::move(body), std::move(headers));
+  const auto event_loop = EventLoop::Current();
+  if (event_loop && event_loop->IsInLoopThread()) co_await ResumeOnWorker();
+  callback(std::move(response));
+}
+
+HttpClient::HttpClient(const std::string& host, const uint16_t& port)
+    : addr_(), addr_len_(0), max_idle_(kDefaultMaxIdle), timeout_(10s) {
+  host_header_ = host.find(':') == std::string::npos ? host : '[' + host + ']';
+  if (port != 80) host_header_ += ':' + std::to_string(port);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &result)) return;
+  memcpy(&addr_, result->ai_addr, result->ai_addrlen);
+  addr_len_ = result->ai_addrlen;
+  freeaddrinfo(result);
+  if (addr_.ss_family == AF_INET)
+    reinterpret_cast<sockaddr_in*>(&addr_)->sin_port = htons(port);
+  else
+    reinterpret_cast<sockaddr_in6*>(&addr_)->sin6_port = htons(port);
+}
+
+HttpClient::~HttpClient() {
+  for (const auto& fd : idle_) close(fd);
+}
+
+HttpClient& HttpClient::SetMaxIdle(const size_t& num) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_idle_ = num;
+  return *this;
+}
+
+HttpClient& HttpClient::SetTimeout(const std::chrono::milliseconds& timeout) {
+  timeout_ = timeout;
+  return *this;
+}
+
+Task<ClientResponse> HttpClient::Request(HttpMethod method, std::string path,
+                                         std::string body,
+                                         ClientHeaders headers) {
+  const auto deadline = Clock::now() + timeout_;
+
+  // HTTP Request-Line and Header
+  std::stringstream ss;
+  ss << kMethodNames[method] << ' ' << path << " HTTP/1.1\r\n";
+  if (!headers.count("Host")) ss << "Host: " << host_header_ << "\r\n";
+  headers.erase("Content-Length");
+  for (const auto& header : headers)
+    ss << header.first << ": " << header.second << "\r\n";
+  if (!body.empty() || method == HttpMethod::POST ||
+      method == HttpMethod::PUT || method == HttpMethod::PATCH)
+    ss << "Content-Length: " << body.size() << "\r\n";
+  ss << "\r\n" << body;
+  const std::string request = ss.str();
+
+  ClientResponse response;
+  for (;;) {
+    int fd = TakeIdle();
+    const bool is_pooled = fd != -1;
+    if (!is_pooled) {
+      fd = co_await Connect(deadline, response.error);
+      if (fd == -1) co_return response;
+    }
+    bool is_reusable;
+    const auto outcome =
+        co_await Exchange(fd, request, method == HttpMethod::HEAD, deadline,
+                          response, is_reusable);
+    if (outcome == Outcome::DONE && is_reusable)
+      Release(fd);
+    else
+      close(fd);
+    if (outcome == Outcome::DONE) co_return response;
+    if (outcome == Outcome::FAILED || !is_pooled) {
+      response.status = 0;
+      co_return response;
+    }
+    response = ClientResponse();  // retry on another connection
+  }
+}
+
+void HttpClient::Request(const HttpMethod& method, const std::string& path,
+                         ClientCallback&& callback, std::string body,
+                         ClientHeaders headers) {
+  RunRequest(this, method, path, std::move(body), std::move(headers),
+             std::move(callback));
+}
+
+int HttpClient::TakeIdle() {
+  for (;;) {
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (idle_.empty()) return -1;
+      fd = idle_.back();
+      idle_.pop_back();
+    }
+    // drop it if the upstream has closed it, or sent something unexpected,
+    // while it was idle
+    char byte;
+    if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == -1 &&
+        (errno == EAGAIN || errno == EWOULDBLOCK))
+      return fd;
+    close(fd);
+  }
+}
+
+void HttpClient::Release(const int& fd) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < max_idle_) {
+      idle_.push_back(fd);
+      return;
+    }
+  }
+  close(fd);
+}
+
+Task<int> HttpClient::Connect(const Clock::time_point deadline,
+                              std::string& error) {
+  if (!addr_len_) {
+    error = "can't resolve the host";
+    co_return -1;
+  }
+  const int fd =
+      socket(addr_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    error = "socket() failed, errno: " + std::to_string(errno);
+    co_return -1;
+  }
+  const int is_no_delay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &is_no_delay, sizeof(is_no_delay));
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&addr_), addr_len_) ==
+      -1) {
+    if (errno != EINPROGRESS) {
+      error = "connect() failed, errno: " + std::to_string(errno);
+      close(fd);
+      co_return -1;
+    }
+    const bool is_ready = co_await Wait(fd, EPOLLOUT, deadline);
+    int so_error = 0;
+    socklen_t so_error_len = sizeof(so_error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len);
+    if (so_error || !is_ready) {
+      error = so_error ? "connect() failed, errno: " + std::to_string(so_error)
+                       : std::string("connect() timed out");
+      close(fd);
+      co_return -1;
+    }
+  }
+  co_return fd;
+}
+
+Task<HttpClient::Outcome> HttpClient::Exchange(
+    const int fd, const std::string& request, const bool is_head,
+    const Clock::time_point deadline, ClientResponse& response,
+    bool& is_reusable) {
+  is_reusable = false;
+  for (size_t sent = 0; sent < request.size();) {
+    const auto ret =
+        send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+    if (ret >= 0) {
+      sent += ret;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {  // can't send now
+      if (!co_await Wait(fd, EPOLLOUT, deadline)) {
+        response.error = "send() timed out";
+        co_return Outcome::FAILED;
+      }
+    } else if (errno != EINTR) {
+      const int error = errno;
+      response.error = "send() failed, errno: " + std::to_string(error);
+      co_return error == EPIPE || error == ECONNRESET ? Outcome::STALE
+                                                      : Outcome::FAILED;
+    }
+  }
+
+  ResponseParser parser(is_head);
+  bool has_received = false;
+  char buffer[kBufferSize];
+  for (;;) {
+    const auto ret = recv(fd, buffer, sizeof(buffer), 0);
+    if (ret > 0) {
+      has_received = true;
+      const int parsed = parser.Feed(buffer, ret, response);
+      if (parsed == 1) {
+        is_reusable = parser.IsKeepAlive();
+        co_return Outcome::DONE;
+      }
+      if (parsed == -1) {
+        response.error = "malformed response";
+        co_return Outcome::FAILED;
+      }
+    } else if (ret == 0) {  // closed by the upstream
+      if (has_received && parser.Finish()) co_return Outcome::DONE;
+      response.error = "connection closed by the upstream";
+      co_return has_received ? Outcome::FAILED : Outcome::STALE;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {  // no data now
+      if (!co_await Wait(fd, EPOLLIN, deadline)) {
+        response.error = "recv() timed out";
+        co_return Outcome::FAILED;
+      }
+    } else if (errno != EINTR) {
+      const int error = errno;
+      response.error = "recv() failed, errno: " + std::to_string(error);
+      co_return !has_received && error == ECONNRESET ? Outcome::STALE
+                                                     : Outcome::FAILED;
+    }
+  }
+}
+
+Task<bool> HttpClient::Wait(const int fd, const uint32_t events,
+                            const Clock::time_point deadline) {
+  const auto timeout = deadline - Clock::now();
+  if (timeout <= Clock::duration::zero()) co_return false;
+  if (!EventLoop::Current()) {  // not a thread of a server, block
+    pollfd pfd = {fd, static_cast<short>(events), 0};
+    const auto timeout_ms =
+        std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+    co_return poll(&pfd, 1, static_cast<int>(timeout_ms)) == 1 &&
+        !(pfd.revents & POLLERR);
+  }
+  const auto state = std::make_shared<WaitState>();
+  state->fd = fd;
+  Watchdog(state, timeout);
+  const bool is_ready = co_await ReadyAwaiter(fd, events);
+  co_return !state->is_done.exchange(true) && is_ready;
+}
@@ -1,187 +1,147 @@
 #include "HttpRequest.hpp"
 
-#include <sys/socket.h>
-#include <unistd.h>
-
 #include <algorithm>
-#include <chrono>
 #include <cstring>
 #include <sstream>
-#include <thread>
 
 #include "HTTPSimple.hpp"
-using namespace std::chrono_literals;
+#include "XForm.hpp"
 
-static const int kBufferSize = 65535;
+// the request line and the headers must fit in it
+static const size_t kMaxHeaderSize = 65536;
+static const char *const kHeaderEnd = "\r\n\r\n";
 
 extern int errno;
 
-// TODO: decode url
-bool HttpRequest::parse(std::string &remaining, Server *const server,
-                        const int fd) {
-  char recv_buffer[kBufferSize], process_buffer[kBufferSize];
-
-  int64_t recv_cnt = remaining.length(), new_recv_cnt = 0;
-  new_recv_cnt = recv(fd, recv_buffer, kBufferSize, 0);
-  if (new_recv_cnt == -1) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {  // no data available
-      new_recv_cnt = 0;
-    } else {
-      std::stringstream ss;
-      ss << '[' << server->client_addrs_[fd]
-         << "] Request line recv() failed, errno: " << errno << std::endl;
-      server->logger.Error(ss.str());
-      close(fd);
-      server->client_addrs_.erase(fd);
-      return false;
-    }
-  }
-  recv_cnt += new_recv_cnt;
-  if (recv_cnt == 0) {  // nothing to parse
-    return false;
+bool ParseHeaders(std::istream &input,
+                  std::unordered_map<std::string, std::string> &headers) {
+  std::string line;
+  while (std::getline(input, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();  // remove \r
+    if (line.empty()) return true;  // Header Stopped
+    const auto colon_pos = line.find(':');
+    if (colon_pos == std::string::npos) continue;  // not a header
+    auto value_pos = colon_pos + 1;
+    while (value_pos < line.size() && line[value_pos] == ' ') value_pos++;
+    headers[line.substr(0, colon_pos)] = line.substr(value_pos);
   }
-  std::string real_recv_buffer(
-      recv_buffer, new_recv_cnt);  // use string to prevent bugs caused by /0
-  std::stringstream recv_ss;
-  recv_ss << remaining << real_recv_buffer;
+  return false;
+}
 
-  // HTTP Request-Line
-  recv_ss.getline(process_buffer, kBufferSize);
-  std::stringstream proc_ss(process_buffer);
-  std::string method, path, version;
-  proc_ss >> method >> path >> version;
-  std::stringstream info_ss;
-  info_ss << '[' << server->client_addrs_[fd] << "] " << method << " " << path
-          << " ";
-  // method
-  if (method == "GET") {
-    this->method = HttpMethod::GET;
-  } else if (method == "POST") {
-    this->method = HttpMethod::POST;
-  } else if (method == "PUT") {
-    this->method = HttpMethod::PUT;
-  } else if (method == "DELETE") {
-    this->method = HttpMethod::DELETE;
-  } else if (method == "HEAD") {
-    this->method = HttpMethod::HEAD;
-  } else if (method == "OPTIONS") {
-    this->method = HttpMethod::OPTIONS;
-  } else if (method == "TRACE") {
-    this->method = HttpMethod::TRACE;
-  } else if (method == "CONNECT") {
-    this->method = HttpMethod::CONNECT;
-  } else if (method == "PATCH") {
-    this->method = HttpMethod::PATCH;
-  } else {  // unknown method
-    std::stringstream ss;
-    ss << '[' << server->client_addrs_[fd] << "] Unknown method: " << method;
-    server->logger.Error(ss.str());
-    close(fd);
-    server->client_addrs_.erase(fd);
-    return false;
-  }
-  // path
-  this->path = path;  // TODO: params
-  // version
-  if (version != std::string("HTTP/1.1")) {
+// TODO: decode url
+bool HttpRequest::parse(BufferChain &input, EventLoop *const event_loop,
+                        const int fd) {
+  Server *const server = event_loop->server();
+  const auto close = [&](const std::string &error) {
     std::stringstream ss;
-    ss << '[' << server->client_addrs_[fd]
-       << "] Unknown HTTP version: " << version;
+    ss << '[' << server->client_addrs_[fd] << "] " << error;
     server->logger.Error(ss.str());
+    event_loop->Close(fd);
+    this->is_closed = true;
     return false;
-  }
-
-  // HTTP Header
-  while (recv_ss.getline(process_buffer, kBufferSize)) {
-    if (process_buffer[0] == '\r') {
-      break;  // Header Stopped
-    }
-    auto colon_pos = strstr(process_buffer, ": ");
-    this->headers[std::string(process_buffer, colon_pos - process_buffer)] =
-        std::string(colon_pos + 2,
-                    strlen(process_buffer) - (colon_pos + 2 - process_buffer) -
-                        1);  // remove \r
-  }
+  };
+  size_t header_size = std::string::npos;  // with the empty line
+  int64_t content_length = 0;
+  std::stringstream info_ss;
+  for (;;) {
+    if (header_size == std::string::npos) {
+      const auto header_end = input.Find(kHeaderEnd, kMaxHeaderSize);
+      if (header_end != std::string::npos) {
+        header_size = header_end + strlen(kHeaderEnd);
+        std::string header;
+        input.CopyTo(header_size, header);
+        std::stringstream header_ss(header);
 
-  // HTTP Content
-  if (this->headers.count("Transfer-Encoding") ||
-      !this->headers.count("Content-Length")) {
-    if (this->method == HttpMethod::GET) {  // GET can have no content and no
-                                            // Content-Length in headers
-      this->body = "";
-      const auto remaining_length = recv_cnt - recv_ss.tellg();
-      char remaining_buffer[remaining_length];
-      recv_ss.readsome(remaining_buffer, remaining_length);
-      remaining = std::string(remaining_buffer, remaining_length);
-      server->logger.Info(info_ss.str());
-      return true;
-    }
-    std::stringstream ss;
-    ss << '[' << server->client_addrs_[fd]
-       << "] Unknown Transfer-Encoding or Content-Length";
-    server->logger.Error(ss.str());
-    close(fd);
-    server->client_addrs_.erase(fd);
-    return false;
-  }
-  int64_t content_length = std::stoll(this->headers["Content-Length"]);
-  if (recv_cnt - recv_ss.tellg() >=
-      content_length) {  // recv some bytes of the following requests
-    char buf[content_length + 1];
-    recv_ss.readsome(buf, content_length);
-    this->body = std::string(buf, content_length);
-    const auto remaining_length = recv_cnt - recv_ss.tellg();
-    char remaining_buffer[remaining_length];
-    recv_ss.readsome(remaining_buffer, remaining_length);
-    remaining = std::string(remaining_buffer, remaining_length);
-    server->logger.Info(info_ss.str());
-    return true;
-  }
-  // put all the remaining data of the buffer to the body
-  const auto remaining_length = recv_cnt - recv_ss.tellg();
-  recv_ss.readsome(recv_buffer, remaining_length);
-  this->body = std::string(recv_buffer, remaining_length);
-  content_length -= remaining_length;
-  recv_cnt = new_recv_cnt = 0;
-  // need more recv to get all the content
-  while (content_length > 0) {
-    const auto recv_chunk_size = std::min<size_t>(
-        content_length, kBufferSize);  // the size of the data to recv
-    for (int i = 0; i < 10; i++) {     // try 10 times
-      recv_cnt = recv(fd, recv_buffer, recv_chunk_size, 0);
-      if (recv_cnt == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {  // no data available now
-          std::this_thread::sleep_for(200ms);
-          continue;
-        } else {  // encountered error
-          std::stringstream ss;
-          ss << '[' << server->client_addrs_[fd]
-             << "] Content recv() failed, errno: " << errno << std::endl;
-          server->logger.Error(ss.str());
-          close(fd);
-          server->client_addrs_.erase(fd);
+        // HTTP Request-Line
+        std::string request_line;
+        std::getline(header_ss, request_line);
+        std::stringstream proc_ss(request_line);
+        std::string method, path, version;
+        proc_ss >> method >> path >> version;
+        if (method == "PRI" && path == "*" && version == "HTTP/2.0") {
+          this->is_http2_preface = true;
           return false;
         }
-      } else {
-        break;  // received data
+        if (server->logger.IsEnabled(Logger::LOG_LEVEL_INFO))
+          info_ss << '[' << server->client_addrs_[fd] << "] " << method << " "
+                  << path << " ";
+        // method
+        if (method == "GET") {
+          this->method = HttpMethod::GET;
+        } else if (method == "POST") {
+          this->method = HttpMethod::POST;
+        } else if (method == "PUT") {
+          this->method = HttpMethod::PUT;
+        } else if (method == "DELETE") {
+          this->method = HttpMethod::DELETE;
+        } else if (method == "HEAD") {
+          this->method = HttpMethod::HEAD;
+        } else if (method == "OPTIONS") {
+          this->method = HttpMethod::OPTIONS;
+        } else if (method == "TRACE") {
+          this->method = HttpMethod::TRACE;
+        } else if (method == "CONNECT") {
+          this->method = HttpMethod::CONNECT;
+        } else if (method == "PATCH") {
+          this->method = HttpMethod::PATCH;
+        } else {  // unknown method
+          return close("Unknown method: " + method);
+        }
+        // path and params
+        const auto query_pos = path.find('?');
+        if (query_pos == std::string::npos) {
+          this->path = path;
+        } else {
+          this->path = path.substr(0, query_pos);
+          this->params = DecodeXWWWFormUrlencoded(
+              std::string_view(path).substr(query_pos + 1));
+        }
+        // version
+        if (version != std::string("HTTP/1.1"))
+          return close("Unknown HTTP version: " + version);
+
+        // HTTP Header
+        ParseHeaders(header_ss, this->headers);
+
+        // HTTP Content
+        if (this->headers.count("Transfer-Encoding") ||
+            !this->headers.count("Content-Length")) {
+          if (this->method != HttpMethod::GET &&
+              this->method != HttpMethod::HEAD)  // GET and HEAD can have no
+                                                 // content and no
+                                                 // Content-Length in headers
+            return close("Unknown Transfer-Encoding or Content-Length");
+        } else {
+          try {
+            content_length = std::stoll(this->headers["Content-Length"]);
+          } catch (const std::exception &) {
+            content_length = -1;
+          }
+          if (content_length < 0) return close("Invalid Content-Length");
+        }
+      } else if (input.size() >= kMaxHeaderSize) {
+        return close("Request header too large");
       }
     }
-    if (recv_cnt == 0) {  // recv nothing
-      std::stringstream ss;
-      ss << '[' << server->client_addrs_[fd]
-         << "] Request body shorter than expected: " << content_length;
-      server->logger.Error(ss.str());
-      close(fd);
-      server->client_addrs_.erase(fd);
+    if (header_size != std::string::npos &&
+        input.size() >= header_size + content_length) {  // complete
+      input.Consume(header_size);
+      this->body.clear();
+      input.Read(content_length, this->body);
+      server->logger.Info(info_ss.str());
+      return true;
+    }
+    // need more recv to get the rest of the request
+    const auto recv_cnt = event_loop->Recv(fd, input);
+    if (recv_cnt > 0) continue;
+    if (recv_cnt == 0) {  // closed by the peer
+      event_loop->Close(fd);
+      this->is_closed = true;
       return false;
     }
-    new_recv_cnt = std::min<size_t>(recv_cnt, content_length);
-    this->body += std::string(
-        recv_buffer, new_recv_cnt);  // append the received data to the body
-    content_length -= new_recv_cnt;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return false;  // no data
+                                                                // available
+    if (errno == EINTR) continue;
+    return close("recv() failed, errno: " + std::to_string(errno));
   }
-  remaining = std::string(recv_buffer + new_recv_cnt,
-                          recv_cnt - new_recv_cnt);  // data of the next request
-  server->logger.Info(info_ss.str());
-  return true;
 }
@@ -1,16 +1,10 @@
 #include "HttpResponse.hpp"
 
-#include <sys/socket.h>
-
-#include <chrono>
 #include <fstream>
 #include <sstream>
-#include <thread>
 
 #include "HTTPSimple.hpp"
 
-using namespace std::chrono_literals;
-
 const std::string HttpResponse::http_version_string = std::string("HTTP/1.1");
 const std::unordered_map<HttpStatusCode, std::string>
     HttpResponse::http_status_code_string = {
@@ -21,6 +15,7 @@ const std::unordered_map<HttpStatusCode, std::string>
         {HttpStatusCode::NOT_FOUND, std::string("404 Not Found")},
         {HttpStatusCode::INTERNAL_SERVER_ERROR,
          std::string("500 Internal Server Error")},
+        {HttpStatusCode::BAD_GATEWAY, std::string("502 Bad Gateway")},
         {HttpStatusCode::SERVICE_UNAVAILABLE,
          std::string("503 Service Unavailable")}};
 
@@ -46,8 +41,7 @@ void HttpResponse::SetBody(const std::filesystem::path&& filepath) {
   this->filepath = std::move(filepath);
 }
 
-bool HttpResponse::SendRequest(Server* const server, HttpStatusCode status_code,
-                               const int& fd) {
+std::string HttpResponse::Serialize(const HttpStatusCode& status_code) const {
   // HTTP Status-Line
   std::stringstream ss;
   ss << http_version_string << ' ';
@@ -68,30 +62,10 @@ bool HttpResponse::SendRequest(Server* const server, HttpStatusCode status_code,
     file.close();
   }
 
-  const auto response = ss.str();
+  return ss.str();
+}
 
-  for (int i = 0; i < 10; i++) {  // try to send the response 10 times
-    const auto ret = send(fd, reinterpret_cast<const void*>(response.data()),
-                          response.size(), 0);
-    if (ret == -1) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {  // can't send now
-        std::this_thread::sleep_for(200ms);
-        continue;
-      } else {  // encountered error
-        std::stringstream error_ss;
-        error_ss << '[' << server->client_addrs_[fd]
-                 << "] send() failed, errno: " << errno;
-        server->logger.Error(error_ss.str());
-        return false;
-      }
-    } else {  // sent successfully
-      return true;
-    }
-  }
-  // sent failed after 10 retries
-  std::stringstream error_ss;
-  error_ss << '[' << server->client_addrs_[fd]
-           << "] send() failed after 10 retries";
-  server->logger.Error(error_ss.str());
-  return false;
+bool HttpResponse::SendRequest(EventLoop* const event_loop,
+                               HttpStatusCode status_code, const int& fd) {
+  return event_loop->Send(fd, Serialize(status_code), false);
 }
@@ -0,0 +1,198 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+// the bucket bounds of the exported histograms, in seconds
+static const std::vector<double> kExportedBounds = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05,   0.1,     0.25,   0.5,   1,      2.5,   5,    10};
+
+uint64_t Counter::Value() const {
+  uint64_t value = 0;
+  for (const auto& shard : shards_)
+    value += shard.value.load(std::memory_order_relaxed);
+  return value;
+}
+
+size_t Counter::ShardIndex() {
+  static std::atomic<size_t> next_index(0);
+  thread_local const size_t index = next_index++ % kShardNum;
+  return index;
+}
+
+uint64_t Histogram::Count() const {
+  uint64_t count = 0;
+  for (const auto& shard : shards_)
+    for (const auto& bucket : shard.buckets)
+      count += bucket.load(std::memory_order_relaxed);
+  return count;
+}
+
+uint64_t Histogram::Sum() const {
+  uint64_t sum = 0;
+  for (const auto& shard : shards_)
+    sum += shard.sum.load(std::memory_order_relaxed);
+  return sum;
+}
+
+uint64_t Histogram::Percentile(const double& percentile) const {
+  std::array<uint64_t, kBucketNum> counts{};
+  uint64_t total = 0;
+  for (const auto& shard : shards_) {
+    for (size_t i = 0; i < kBucketNum; i++) {
+      const auto count = shard.buckets[i].load(std::memory_order_relaxed);
+      counts[i] += count;
+      total += count;
+    }
+  }
+  if (!total) return 0;
+  // the rank of the value, rounded up
+  const auto rank = std::max<uint64_t>(
+      static_cast<uint64_t>(percentile / 100 * total + 0.999999), 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketNum; i++) {
+    seen += counts[i];
+    if (seen >= rank)  // the middle of the bucket
+      return BucketLowerBound(i) +
+             (BucketUpperBound(i) - BucketLowerBound(i)) / 2;
+  }
+  return BucketUpperBound(kBucketNum - 1);
+}
+
+std::vector<uint64_t> Histogram::CumulativeCounts(
+    const std::vector<uint64_t>& bounds) const {
+  std::vector<uint64_t> counts(bounds.size(), 0);
+  for (const auto& shard : shards_) {
+    size_t bound = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketNum && bound < bounds.size(); i++) {
+      while (bound < bounds.size() && BucketUpperBound(i) > bounds[bound])
+        counts[bound++] += seen;
+      seen += shard.buckets[i].load(std::memory_order_relaxed);
+    }
+    while (bound < bounds.size()) counts[bound++] += seen;
+  }
+  return counts;
+}
+
+void Histogram::Merge(const Histogram& other) {
+  auto& shard = shards_[Counter::ShardIndex() % kShardNum];
+  for (const auto& other_shard : other.shards_) {
+    for (size_t i = 0; i < kBucketNum; i++)
+      shard.buckets[i].fetch_add(
+          other_shard.buckets[i].load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    shard.sum.fetch_add(other_shard.sum.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+  }
+}
+
+Counter& Metrics::GetCounter(const std::string& name, const std::string& help,
+                             const Labels& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& counter = GetFamily(name, help, COUNTER)
+                      .counters[SerializeLabels(labels)];
+  if (!counter) counter = std::make_unique<Counter>();
+  return *counter;
+}
+
+Histogram& Metrics::GetHistogram(const std::string& name,
+                                 const std::string& help,
+                                 const Labels& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& histogram = GetFamily(name, help, HISTOGRAM)
+                        .histograms[SerializeLabels(labels)];
+  if (!histogram) histogram = std::make_unique<Histogram>();
+  return *histogram;
+}
+
+void Metrics::AddGauge(const std::string& name, const std::string& help,
+                       const Labels& labels, const Gauge& gauge) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  GetFamily(name, help, GAUGE).gauges[SerializeLabels(labels)] = gauge;
+}
+
+Metrics::Family& Metrics::GetFamily(const std::string& name,
+                                    const std::string& help, const Type& type) {
+  const auto family = families_.find(name);
+  if (family != families_.end()) return family->second;
+  auto& new_family = families_[name];
+  new_family.type = type;
+  new_family.help = help;
+  return new_family;
+}
+
+std::string Metrics::SerializeLabels(const Labels& labels) {
+  std::string ret;
+  for (const auto& label : labels) {
+    if (!ret.empty()) ret += ',';
+    ret += label.first;
+    ret += "=\"";
+    for (const auto& ch : label.second) {
+      if (ch == '\\' || ch == '"') {
+        ret += '\\';
+        ret += ch;
+      } else if (ch == '\n') {
+        ret += "\\n";
+      } else {
+        ret += ch;
+      }
+    }
+    ret += '"';
+  }
+  return ret;
+}
+
+std::string Metrics::Serialize() const {
+  std::vector<uint64_t> bounds;
+  for (const auto& bound : kExportedBounds)
+    bounds.push_back(static_cast<uint64_t>(bound * 1e9));
+  bounds.push_back(UINT64_MAX);  // +Inf, counted with the same snapshot
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::stringstream ss;
+  for (const auto& family : families_) {
+    const auto& name = family.first;
+    ss << "# HELP " << name << ' ' << family.second.help << '\n';
+    switch (family.second.type) {
+      case COUNTER:
+        ss << "# TYPE " << name << " counter\n";
+        for (const auto& counter : family.second.counters) {
+          ss << name;
+          if (!counter.first.empty()) ss << '{' << counter.first << '}';
+          ss << ' ' << counter.second->Value() << '\n';
+        }
+        break;
+      case GAUGE:
+        ss << "# TYPE " << name << " gauge\n";
+        for (const auto& gauge : family.second.gauges) {
+          ss << name;
+          if (!gauge.first.empty()) ss << '{' << gauge.first << '}';
+          ss << ' ' << gauge.second() << '\n';
+        }
+        break;
+      case HISTOGRAM:
+        ss << "# TYPE " << name << " histogram\n";
+        for (const auto& histogram : family.second.histograms) {
+          const auto& labels = histogram.first;
+          const auto separator = labels.empty() ? "" : ",";
+          const auto counts = histogram.second->CumulativeCounts(bounds);
+          const auto count = counts.back();
+          for (size_t i = 0; i < kExportedBounds.size(); i++)
+            ss << name << "_bucket{" << labels << separator << "le=\""
+               << kExportedBounds[i] << "\"} " << counts[i] << '\n';
+          ss << name << "_bucket{" << labels << separator << "le=\"+Inf\"} "
+             << count << '\n';
+          ss << name << "_sum";
+          if (!labels.empty()) ss << '{' << labels << '}';
+          ss << ' ' << histogram.second->Sum() / 1e9 << '\n';
+          ss << name << "_count";
+          if (!labels.empty()) ss << '{' << labels << '}';
+          ss << ' ' << count << '\n';
+        }
+        break;
+    }
+  }
+  return ss.str();
+}
@@ -0,0 +1,99 @@
+#include "ResponseCache.hpp"
+
+#include "HTTPSimple.hpp"
+
+void ResponseCache::Handle(HttpRequestPtr&& request,
+                           const Controller& controller,
+                           EventLoop* const event_loop, const int& fd) {
+  const auto key = Key(*request);
+  const auto now = Clock::now();
+  std::shared_ptr<const std::string> response;
+  bool is_refreshing = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = Touch(key);
+    if (entry.response && now < entry.fresh_until) {  // fresh
+      response = entry.response;
+    } else if (entry.response && now < entry.stale_until) {  // stale
+      response = entry.response;
+      if (!entry.is_in_flight) {  // refresh it in the background
+        entry.is_in_flight = true;
+        is_refreshing = true;
+      }
+    } else if (entry.is_in_flight) {  // wait for the call in flight
+      entry.waiters.push_back({event_loop, fd});
+      return;
+    } else {  // miss
+      entry.is_in_flight = true;
+      entry.waiters.push_back({event_loop, fd});
+    }
+    Evict();
+  }
+  if (response) event_loop->Send(fd, response, false);
+  if (!response || is_refreshing) Fill(std::move(request), controller, key);
+}
+
+std::string ResponseCache::Key(const HttpRequest& request) const {
+  std::string key;
+  key.push_back(static_cast<char>(request.method));
+  key += request.path;
+  for (const auto& param : policy_.vary_params) {
+    key.push_back('\0');
+    const auto value = request.params.find(param);
+    if (value != request.params.end()) key += value->second;
+  }
+  for (const auto& header : policy_.vary_headers) {
+    key.push_back('\0');
+    const auto value = request.headers.find(header);
+    if (value != request.headers.end()) key += value->second;
+  }
+  return key;
+}
+
+void ResponseCache::Fill(HttpRequestPtr&& request, const Controller& controller,
+                         const std::string& key) {
+  controller(std::move(request), [this, key](const HttpResponsePtr& response,
+                                             const HttpStatusCode& status_code) {
+    const auto serialized =
+        std::make_shared<const std::string>(response->Serialize(status_code));
+    std::vector<Waiter> waiters;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& entry = Touch(key);
+      entry.is_in_flight = false;
+      if (status_code == HttpStatusCode::OK) {
+        entry.response = serialized;
+        entry.fresh_until = Clock::now() + policy_.ttl;
+        entry.stale_until = entry.fresh_until + policy_.stale_while_revalidate;
+      }
+      waiters.swap(entry.waiters);
+      Evict();
+    }
+    for (const auto& waiter : waiters)
+      waiter.event_loop->Send(waiter.fd, serialized, false);
+  });
+}
+
+ResponseCache::Entry& ResponseCache::Touch(const std::string& key) {
+  auto entry = entries_.find(key);
+  if (entry == entries_.end()) {
+    lru_.push_front(key);
+    entry = entries_.emplace(key, Entry()).first;
+  } else {
+    lru_.erase(entry->second.lru_pos);
+    lru_.push_front(key);
+  }
+  entry->second.lru_pos = lru_.begin();
+  return entry->second;
+}
+
+void ResponseCache::Evict() {
+  auto pos = lru_.end();
+  while (entries_.size() > policy_.max_entries && pos != lru_.begin()) {
+    --pos;
+    const auto entry = entries_.find(*pos);
+    if (entry->second.is_in_flight) continue;
+    entries_.erase(entry);
+    pos = lru_.erase(pos);
+  }
+}
@@ -1,41 +1,640 @@
+#include <strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <sstream>
+
 #include "HTTPSimple.hpp"
 
 extern int errno;
 
-Router::Router(Server* const server)
+static const size_t kDefaultMaxQueueSize = 4096;
+static const uint32_t kDefaultRetryAfter = 1;
+
+static const char* const kMethodNames[] = {
+    "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "TRACE", "CONNECT",
+    "PATCH"};
+static const HttpStatusCode kStatusCodes[] = {
+    HttpStatusCode::OK,
+    HttpStatusCode::BAD_REQUEST,
+    HttpStatusCode::UNAUTHORIZED,
+    HttpStatusCode::FORBIDDEN,
+    HttpStatusCode::NOT_FOUND,
+    HttpStatusCode::INTERNAL_SERVER_ERROR,
+    HttpStatusCode::BAD_GATEWAY,
+    HttpStatusCode::SERVICE_UNAVAILABLE};
+static const char* const kPhaseHelp =
+    "Time spent in each phase of a request in seconds";
+static const char* const kDurationHelp =
+    "Time from the start of parsing to the response being sent in seconds "
+    "(status \"cached\" for responses of cached routes)";
+
+// what an HTTP/1.1 request asking for HTTP/2 is switched to instead of
+static const char* const kUpgradeProtocol = "h2c";
+
+// the queue delay of the task the worker thread is about to run
+static thread_local std::chrono::steady_clock::duration last_sojourn;
+
+/**
+ * @brief describe a request for the spans of the tracer
+ *
+ * @param fd the file descriptor of the socket
+ * @param request the request
+ * @return the arguments of the spans
+ */
+static std::string TraceArgs(const int& fd, const HttpRequest& request) {
+  return "\"fd\":" + std::to_string(fd) +
+         ",\"method\":" + Tracer::Quote(kMethodNames[request.method]) +
+         ",\"path\":" + Tracer::Quote(request.path);
+}
+
+/**
+ * @brief find a header of a request, the name is case insensitive
+ *
+ * @param request the request
+ * @param name the name of the header
+ * @return the value (nullptr if there isn't one)
+ */
+static const std::string* FindHeader(const HttpRequest& request,
+                                     const char* const name) {
+  for (const auto& [key, value] : request.headers)
+    if (!strcasecmp(key.c_str(), name)) return &value;
+  return nullptr;
+}
+
+/**
+ * @brief whether a request asks for the connection to switch to HTTP/2
+ *
+ * @param request the request
+ * @return true if it has the Upgrade: h2c and HTTP2-Settings headers
+ */
+static bool IsHttp2Upgrade(const HttpRequest& request) {
+  const auto upgrade = FindHeader(request, "Upgrade");
+  return upgrade && upgrade->find(kUpgradeProtocol) != std::string::npos &&
+         FindHeader(request, "HTTP2-Settings");
+}
+
+Router::Router(Server* const server, EventLoop* const event_loop)
     : TaskQueue([this](int, int fd) {
-        std::string remaining;
-        HttpRequestPtr request = std::make_unique<HttpRequest>();
-        while (request->parse(remaining, server_, fd)) {
-          auto controller_key = request->path;
-          controller_key.push_back(static_cast<char>(request->method));
-          const auto controller = controllers_.find(controller_key);
-          if (controller == controllers_.end()) {  // controller not found
-            HttpResponse response;
-            response.SetContentLength(0);
-            response.SendRequest(server_, HttpStatusCode::NOT_FOUND,
-                                 fd);  // return 404
-          } else {                     // controller found
-            controller->second(std::move(request),
-                               [this, fd](const HttpResponsePtr& response,
-                                          const HttpStatusCode& status_code) {
-                                 response->SendRequest(server_, status_code,
-                                                       fd);
-                               });
-          }
-          request = std::make_unique<HttpRequest>();  // as the last request is
-                                                      // processed, create a new
-                                                      // request
+        using Clock = std::chrono::steady_clock;
+        EventLoop::SetCurrent(event_loop_);
+        Tracer& tracer = server_->tracer;
+        const bool is_traced = tracer.Sample();
+        if (is_traced) {
+          const auto now = Clock::now();
+          tracer.Record("queue", now - last_sojourn, now,
+                        "\"fd\":" + std::to_string(fd));
         }
+        Serve(fd, is_traced);
       }),
-      server_(server) {}
+      server_(server),
+      event_loop_(event_loop),
+      http2_num_(0),
+      is_draining_(false),
+      max_queue_size_(kDefaultMaxQueueSize),
+      queue_delay_(server->metrics.GetHistogram(
+          "httpsimple_request_phase_seconds", kPhaseHelp,
+          {{"phase", "queue"}})),
+      parse_duration_(server->metrics.GetHistogram(
+          "httpsimple_request_phase_seconds", kPhaseHelp,
+          {{"phase", "parse"}})),
+      controller_duration_(server->metrics.GetHistogram(
+          "httpsimple_request_phase_seconds", kPhaseHelp,
+          {{"phase", "controller"}})),
+      send_duration_(server->metrics.GetHistogram(
+          "httpsimple_request_phase_seconds", kPhaseHelp,
+          {{"phase", "send"}})),
+      unmatched_duration_(server->metrics.GetHistogram(
+          "httpsimple_request_duration_seconds", kDurationHelp,
+          {{"route", ""}, {"method", ""}, {"status", "404"}})),
+      rejected_num_(server->metrics.GetCounter(
+          "httpsimple_rejected_total",
+          "Connections answered with 503 as the server was overloaded")) {
+  SetRetryAfter(kDefaultRetryAfter);
+  SetDequeueObserver(
+      [this](const std::chrono::steady_clock::duration& sojourn) {
+        codel_.OnDequeue(sojourn);
+        queue_delay_.Record(sojourn);
+        last_sojourn = sojourn;
+      });
+}
 
 void Router::SetThreadNum(const uint32_t& num) { TaskQueue::resize(num); }
 
+void Router::SetAutoScale(const ThreadPool::AutoScalePolicy& policy) {
+  TaskQueue::SetAutoScale(policy);
+}
+
+void Router::SetPlacement(const std::vector<int>& cpus,
+                          const bool& bind_memory) {
+  TaskQueue::SetPlacement(cpus, bind_memory);
+}
+
+void Router::ServeDirectory(const std::shared_ptr<StaticDirectory>& directory) {
+  auto metrics = std::make_shared<RouteMetrics>();
+  metrics->route = directory->url_prefix() + "/*";
+  metrics->method = kMethodNames[HttpMethod::GET];
+  mounts_.push_back({directory, metrics});
+}
+
+const Router::Mount* Router::FindMount(const HttpRequest& request) const {
+  if (request.method != HttpMethod::GET && request.method != HttpMethod::HEAD)
+    return nullptr;
+  for (const auto& mount : mounts_)
+    if (mount.directory->Match(request.path)) return &mount;
+  return nullptr;
+}
+
+void Router::SetMaxQueueSize(const size_t& num) { max_queue_size_ = num; }
+
+void Router::SetQueueDelayTarget(const std::chrono::milliseconds& target,
+                                 const std::chrono::milliseconds& interval) {
+  codel_.SetTarget(target, interval);
+}
+
+void Router::SetRetryAfter(const uint32_t& seconds) {
+  HttpResponse response;
+  response.headers["Retry-After"] = std::to_string(seconds);
+  response.headers["Connection"] = "close";
+  response.SetContentLength(0);
+  overload_response_ = std::make_shared<const std::string>(
+      response.Serialize(HttpStatusCode::SERVICE_UNAVAILABLE));
+}
+
 void Router::RegisterController(const HttpMethod& method, std::string path,
                                 const ControllerFunc&& func) {
+  auto metrics = std::make_shared<RouteMetrics>();
+  metrics->route = path;
+  metrics->method = kMethodNames[method];
   path.push_back(static_cast<char>(method));
-  controllers_[path] = func;
+  controllers_[path] = {func, nullptr, nullptr, metrics};
+}
+
+void Router::RegisterController(const HttpMethod& method, std::string path,
+                                const ControllerFunc&& func,
+                                const std::shared_ptr<ResponseCache>& cache) {
+  auto metrics = std::make_shared<RouteMetrics>();
+  metrics->route = path;
+  metrics->method = kMethodNames[method];
+  path.push_back(static_cast<char>(method));
+  controllers_[path] = {func, nullptr, cache, metrics};
+}
+
+void Router::RegisterController(const HttpMethod& method, std::string path,
+                                const CoroutineControllerFunc&& func) {
+  auto metrics = std::make_shared<RouteMetrics>();
+  metrics->route = path;
+  metrics->method = kMethodNames[method];
+  path.push_back(static_cast<char>(method));
+  controllers_[path] = {nullptr, func, nullptr, metrics};
+}
+
+// a coroutine controller run by the worker that parsed its request: if it
+// responds without waiting, that worker goes on with the connection, otherwise
+// the coroutine does once it has responded, whoever gets to the end first
+// leaves it to the other
+struct Router::ServeTask {
+  struct promise_type {
+    template <typename... Args>
+    explicit promise_type(Router& router, Args&&...) : router(&router) {}
+
+    struct FinalAwaiter {
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(
+          std::coroutine_handle<promise_type> handle) const noexcept {
+        auto& promise = handle.promise();
+        if (!promise.is_handed_off.exchange(true))
+          return;  // the worker goes on and destroys it
+        auto router = promise.router;
+        auto continuation = std::move(*promise.continuation);
+        handle.destroy();
+        router->ServeConnection(continuation.fd, continuation.connection,
+                                continuation.is_traced);
+      }
+      void await_resume() const noexcept {}
+    };
+
+    ServeTask get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void return_value(Continuation&& value) {
+      continuation.emplace(std::move(value));
+    }
+    void unhandled_exception() const noexcept { std::terminate(); }
+
+    Router* const router;
+    std::optional<Continuation> continuation;
+    std::atomic<bool> is_handed_off{false};
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+void Router::Serve(const int& fd, const bool& is_traced) {
+  if (http2_num_.load(std::memory_order_acquire)) {
+    Http2ConnectionPtr http2;
+    {
+      std::lock_guard<std::mutex> lock(http2_mutex_);
+      const auto it = http2_connections_.find(fd);
+      if (it != http2_connections_.end()) http2 = it->second;
+    }
+    if (http2) {
+      ServeHttp2(http2, std::string());
+      return;
+    }
+  }
+  std::shared_ptr<Connection> connection;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    auto& slot = connections_[fd];
+    if (!slot) {
+      slot = std::make_shared<Connection>(event_loop_->buffer_pool());
+    } else if (slot->is_serving) {  // the worker serving it receives again
+      slot->is_ready_again = true;
+      return;
+    }
+    slot->is_serving = true;
+    connection = slot;
+  }
+  ServeConnection(fd, connection, is_traced);
+}
+
+void Router::ServeConnection(const int& fd,
+                             const std::shared_ptr<Connection>& connection,
+                             const bool& is_traced) {
+  using Clock = std::chrono::steady_clock;
+  Tracer& tracer = server_->tracer;
+  for (;;) {
+    HttpRequestPtr request = std::make_unique<HttpRequest>();
+    auto parse_begin = Clock::now();
+    while (request->parse(connection->input, event_loop_, fd)) {
+      const auto parsed = Clock::now();
+      parse_duration_.Record(parsed - parse_begin);
+      const auto trace_args =
+          is_traced ? TraceArgs(fd, *request) : std::string();
+      if (is_traced)
+        tracer.Record("parse", parse_begin, parsed, std::string(trace_args));
+      if (IsHttp2Upgrade(*request)) {
+        UpgradeHttp2(fd, connection, request);
+        return;
+      }
+      auto controller_key = request->path;
+      controller_key.push_back(static_cast<char>(request->method));
+      const auto controller = controllers_.find(controller_key);
+      const auto routed = Clock::now();
+      if (is_traced)
+        tracer.Record("route", parsed, routed, std::string(trace_args));
+      const auto mount = controller == controllers_.end()
+                             ? FindMount(*request)
+                             : nullptr;
+      if (mount) {  // file of a directory
+        HttpResponse response;
+        const auto status_code = mount->directory->Handle(*request, response);
+        Respond(fd, response, status_code,
+                {parse_begin, routed, is_traced, trace_args}, *mount->metrics);
+      } else if (controller == controllers_.end()) {  // controller not found
+        HttpResponse response;
+        response.SetContentLength(0);
+        response.SendRequest(event_loop_, HttpStatusCode::NOT_FOUND,
+                             fd);  // return 404
+        const auto sent = Clock::now();
+        unmatched_duration_.Record(sent - parse_begin);
+        if (is_traced)
+          tracer.Record("send", routed, sent, std::string(trace_args));
+      } else if (controller->second.cache) {  // cached controller found
+        controller->second.cache->Handle(std::move(request),
+                                         controller->second.func, event_loop_,
+                                         fd);
+        const auto handled = Clock::now();
+        RouteDuration(*controller->second.metrics, nullptr)
+            .Record(handled - parse_begin);
+        if (is_traced)
+          tracer.Record("cache", routed, handled, std::string(trace_args));
+      } else if (controller->second.coroutine) {  // coroutine controller found
+        auto task = ServeCoroutine(&controller->second, std::move(request), fd,
+                                   {parse_begin, routed, is_traced, trace_args},
+                                   connection);
+        task.handle.resume();
+        if (!task.handle.promise().is_handed_off.exchange(true))
+          return;  // it's waiting, the coroutine goes on with the connection
+        task.handle.destroy();
+      } else {  // controller found
+        controller->second.func(
+            std::move(request),
+            [this, fd,
+             timing = RequestTiming{parse_begin, routed, is_traced, trace_args},
+             metrics = controller->second.metrics](
+                const HttpResponsePtr& response,
+                const HttpStatusCode& status_code) {
+              Respond(fd, *response, status_code, timing, *metrics);
+            });
+      }
+      request = std::make_unique<HttpRequest>();  // as the last request is
+                                                  // processed, create a new
+                                                  // request
+      parse_begin = Clock::now();
+    }
+    if (request->is_closed) {
+      // the event loop may have closed it before, its close is a no-op then
+      Forget(fd, connection);
+      return;
+    }
+    if (request->is_http2_preface) {  // HTTP/2 with prior knowledge
+      if (server_->logger.IsEnabled(Logger::LOG_LEVEL_INFO)) {
+        std::stringstream ss;
+        ss << '[' << server_->client_addrs_[fd] << "] HTTP/2";
+        server_->logger.Info(ss.str());
+      }
+      const auto http2 = CreateHttp2(fd);
+      http2->Start();
+      std::string received;
+      connection->input.Read(connection->input.size(), received);
+      SwitchToHttp2(fd, connection, http2, std::move(received));
+      return;
+    }
+    // no more bytes for now, the connection keeps its slabs only if a request
+    // is partly received
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      const auto it = connections_.find(fd);
+      if (it == connections_.end() || it->second != connection)
+        return;  // closed meanwhile
+      if (connection->is_ready_again) {
+        connection->is_ready_again = false;  // bytes arrived meanwhile
+        continue;
+      }
+      connection->is_serving = false;
+      if (!connection->input.empty()) return;
+      connections_.erase(it);
+    }
+    if (is_draining_.load(std::memory_order_relaxed))
+      event_loop_->Close(fd);  // idle while the server is stopping
+    return;
+  }
+}
+
+void Router::Forget(const int& fd,
+                    const std::shared_ptr<Connection>& connection) {
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  const auto it = connections_.find(fd);
+  if (it != connections_.end() && it->second == connection)
+    connections_.erase(it);
+}
+
+void Router::OnDisconnected(const int& fd) {
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    connections_.erase(fd);
+  }
+  if (!http2_num_.load(std::memory_order_acquire)) return;
+  Http2ConnectionPtr connection;
+  {
+    std::lock_guard<std::mutex> lock(http2_mutex_);
+    const auto it = http2_connections_.find(fd);
+    if (it == http2_connections_.end()) return;
+    connection = std::move(it->second);
+    http2_connections_.erase(it);
+    http2_num_--;
+  }
+  connection->OnClosed();  // its streams may still be responding
+}
+
+Http2ConnectionPtr Router::CreateHttp2(const int& fd) {
+  return std::make_shared<Http2Connection>(
+      event_loop_, fd,
+      [this](const Http2ConnectionPtr& connection, const uint32_t& stream_id,
+             HttpRequestPtr&& request) {
+        // the functions of the thread pool must be copyable
+        auto shared_request = std::make_shared<HttpRequestPtr>(
+            std::move(request));
+        event_loop_->Offload([this, connection, stream_id, shared_request]() {
+          ServeStream(connection, stream_id, std::move(*shared_request));
+        });
+      });
+}
+
+void Router::SwitchToHttp2(const int& fd,
+                           const std::shared_ptr<Connection>& connection,
+                           const Http2ConnectionPtr& http2,
+                           std::string&& received) {
+  // the session gets the bytes in order: it receives until no more are
+  // available before the other workers are sent to it
+  ServeHttp2(http2, std::move(received));
+  bool is_ready_again;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    const auto it = connections_.find(fd);
+    if (it == connections_.end() || it->second != connection)
+      return;  // closed meanwhile
+    is_ready_again = connection->is_ready_again;
+    connections_.erase(it);
+    std::lock_guard<std::mutex> http2_lock(http2_mutex_);
+    http2_connections_[fd] = http2;
+    http2_num_++;
+  }
+  if (is_ready_again) ServeHttp2(http2, std::string());
+}
+
+void Router::ServeHttp2(const Http2ConnectionPtr& connection,
+                        std::string&& received) {
+  const auto error = connection->Serve(std::move(received));
+  if (error != Http2Connection::NO_ERROR) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[connection->fd()]
+       << "] HTTP/2 connection error: " << error;
+    server_->logger.Warn(ss.str());
+  }
 }
 
-void Router::push(const int& fd) { TaskQueue::push(fd); }
+void Router::UpgradeHttp2(const int& fd,
+                          const std::shared_ptr<Connection>& connection,
+                          HttpRequestPtr& request) {
+  const auto http2 = CreateHttp2(fd);
+  const auto settings = *FindHeader(*request, "HTTP2-Settings");
+  if (!http2->Upgrade(settings, request)) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[fd] << "] Malformed HTTP2-Settings";
+    server_->logger.Error(ss.str());
+    HttpResponse response;
+    response.headers["Connection"] = "close";
+    response.SetContentLength(0);
+    event_loop_->Send(fd, response.Serialize(HttpStatusCode::BAD_REQUEST),
+                      true);
+    Forget(fd, connection);
+    return;
+  }
+  std::string received;
+  connection->input.Read(connection->input.size(), received);
+  SwitchToHttp2(fd, connection, http2, std::move(received));
+}
+
+void Router::ServeStream(const Http2ConnectionPtr& connection,
+                         const uint32_t& stream_id, HttpRequestPtr&& request) {
+  using Clock = std::chrono::steady_clock;
+  const auto begin = Clock::now();
+  if (server_->logger.IsEnabled(Logger::LOG_LEVEL_INFO)) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[connection->fd()] << "] "
+       << kMethodNames[request->method] << ' ' << request->path
+       << " (stream " << stream_id << ')';
+    server_->logger.Info(ss.str());
+  }
+  auto controller_key = request->path;
+  controller_key.push_back(static_cast<char>(request->method));
+  const auto controller = controllers_.find(controller_key);
+  const auto mount =
+      controller == controllers_.end() ? FindMount(*request) : nullptr;
+  if (mount) {  // file of a directory
+    HttpResponse response;
+    const auto status_code = mount->directory->Handle(*request, response);
+    connection->Respond(stream_id, response, status_code);
+    RouteDuration(*mount->metrics, &status_code).Record(Clock::now() - begin);
+  } else if (controller == controllers_.end()) {  // controller not found
+    HttpResponse response;
+    response.SetContentLength(0);
+    connection->Respond(stream_id, response, HttpStatusCode::NOT_FOUND);
+    unmatched_duration_.Record(Clock::now() - begin);
+  } else if (controller->second.coroutine) {  // coroutine controller found
+    ServeCoroutineStream(&controller->second, connection, stream_id,
+                         std::move(request), begin);
+  } else {  // controller found, the cache holds HTTP/1.1 responses
+    controller->second.func(
+        std::move(request),
+        [this, connection, stream_id, begin,
+         metrics = controller->second.metrics](
+            const HttpResponsePtr& response,
+            const HttpStatusCode& status_code) {
+          connection->Respond(stream_id, *response, status_code);
+          RouteDuration(*metrics, &status_code).Record(Clock::now() - begin);
+        });
+  }
+}
+
+DetachedTask Router::ServeCoroutineStream(
+    const Route* const route, const Http2ConnectionPtr connection,
+    const uint32_t stream_id, HttpRequestPtr request,
+    const std::chrono::steady_clock::time_point begin) {
+  HttpResponse response;
+  try {
+    response = co_await route->coroutine(*request);
+  } catch (const std::exception& e) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[connection->fd()]
+       << "] Controller failed: " << e.what();
+    server_->logger.Error(ss.str());
+    response = HttpResponse();
+    response.SetContentLength(0);
+    response.status = HttpStatusCode::INTERNAL_SERVER_ERROR;
+  }
+  // resumed by the event loop, don't encode and send in the loop thread
+  if (event_loop_->IsInLoopThread()) co_await ResumeOnWorker();
+  connection->Respond(stream_id, response, response.status);
+  RouteDuration(*route->metrics, &response.status)
+      .Record(std::chrono::steady_clock::now() - begin);
+}
+
+void Router::Respond(const int& fd, const HttpResponse& response,
+                     const HttpStatusCode& status_code,
+                     const RequestTiming& timing, RouteMetrics& metrics) {
+  using Clock = std::chrono::steady_clock;
+  const auto responded = Clock::now();
+  controller_duration_.Record(responded - timing.routed);
+  auto serialized = response.Serialize(status_code);
+  const auto serialized_time = Clock::now();
+  event_loop_->Send(fd, std::move(serialized), false);
+  const auto sent = Clock::now();
+  send_duration_.Record(sent - responded);
+  RouteDuration(metrics, &status_code).Record(sent - timing.parse_begin);
+  if (timing.is_traced) {
+    auto& tracer = server_->tracer;
+    const auto args = timing.trace_args + ",\"status\":" +
+                      std::to_string(static_cast<int>(status_code));
+    tracer.Record("controller", timing.routed, responded, std::string(args));
+    tracer.Record("serialize", responded, serialized_time, std::string(args));
+    tracer.Record("send", serialized_time, sent, std::string(args));
+  }
+}
+
+Router::ServeTask Router::ServeCoroutine(
+    const Route* const route, HttpRequestPtr request, const int fd,
+    const RequestTiming timing, const std::shared_ptr<Connection> connection) {
+  HttpResponse response;
+  try {
+    response = co_await route->coroutine(*request);
+  } catch (const std::exception& e) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[fd]
+       << "] Controller failed: " << e.what();
+    server_->logger.Error(ss.str());
+    response = HttpResponse();
+    response.SetContentLength(0);
+    response.status = HttpStatusCode::INTERNAL_SERVER_ERROR;
+  }
+  // resumed by the event loop, don't serialize and send in the loop thread
+  if (event_loop_->IsInLoopThread()) co_await ResumeOnWorker();
+  Respond(fd, response, response.status, timing, *route->metrics);
+  co_return Continuation{fd, timing.is_traced, connection};
+}
+
+bool Router::Admit() const {
+  const auto queue_size = TaskQueue::queue_size();
+  if (max_queue_size_ && queue_size >= max_queue_size_) return false;
+  // a standing queue means that the threads can't keep up, but an empty queue
+  // can always take a new connection
+  return queue_size == 0 || !codel_.IsOverloaded();
+}
+
+void Router::Reject(const int& fd,
+                    const std::shared_ptr<const std::string>& response) {
+  // drain (a bounded amount of) the pending request, otherwise close() resets
+  // the connection and the client may never see the response
+  char drain_buffer[4096];
+  for (int i = 0; i < 16; i++)
+    if (event_loop_->Recv(fd, drain_buffer, sizeof(drain_buffer)) <= 0) break;
+  std::stringstream ss;
+  ss << '[' << server_->client_addrs_[fd]
+     << "] rejected, server overloaded (queue: " << TaskQueue::queue_size()
+     << ", delay: "
+     << std::chrono::duration_cast<std::chrono::microseconds>(
+            codel_.LastSojourn())
+            .count()
+     << "us)";
+  server_->logger.Warn(ss.str());
+  rejected_num_.Add();
+  event_loop_->Send(fd, response, true);
+}
+
+void Router::push(const int& fd) {
+  if (!Admit()) {
+    Reject(fd, overload_response_);
+    return;
+  }
+  TaskQueue::push(fd);
+}
+
+Histogram& Router::RouteDuration(RouteMetrics& metrics,
+                                 const HttpStatusCode* const status) {
+  size_t index = kStatusCodeNum - 1;  // cached
+  if (status)
+    index = std::find(std::begin(kStatusCodes), std::end(kStatusCodes),
+                      *status) -
+            std::begin(kStatusCodes);
+  auto& slot = metrics.durations[index];
+  auto histogram = slot.load(std::memory_order_acquire);
+  if (!histogram) {  // the registry returns the same one to racing threads
+    histogram = &server_->metrics.GetHistogram(
+        "httpsimple_request_duration_seconds", kDurationHelp,
+        {{"route", metrics.route},
+         {"method", metrics.method},
+         {"status", status ? std::to_string(static_cast<int>(*status))
+                           : std::string("cached")}});
+    slot.store(histogram, std::memory_order_release);
+  }
+  return *histogram;
+}
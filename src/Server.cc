@@ -1,54 +1,430 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
-#include <sys/epoll.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
+#include <filesystem>
 #include <sstream>
 
 #include "HTTPSimple.hpp"
+#include "UringEventLoop.hpp"
 
-Server::Server() { router_ = std::make_unique<Router>(this); }
+static const char* const kUnixPrefix = "unix:";
+
+/**
+ * @brief format the address of a socket
+ *
+ * @param addr the address
+ * @param addr_size the size of the address
+ * @return e.g. "127.0.0.1:8080", "[::1]:8080" or "unix:/run/app.sock"
+ */
+static std::string FormatAddress(const sockaddr_storage& addr,
+                                 const socklen_t& addr_size) {
+  std::stringstream ss;
+  switch (addr.ss_family) {
+    case AF_INET: {
+      const auto& in = reinterpret_cast<const sockaddr_in&>(addr);
+      char host[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &in.sin_addr, host, sizeof(host));
+      ss << host << ':' << ntohs(in.sin_port);
+      break;
+    }
+    case AF_INET6: {
+      const auto& in6 = reinterpret_cast<const sockaddr_in6&>(addr);
+      char host[INET6_ADDRSTRLEN];
+      inet_ntop(AF_INET6, &in6.sin6_addr, host, sizeof(host));
+      ss << '[' << host << "]:" << ntohs(in6.sin6_port);
+      break;
+    }
+    case AF_UNIX: {
+      const auto& un = reinterpret_cast<const sockaddr_un&>(addr);
+      const size_t path_size =
+          addr_size > offsetof(sockaddr_un, sun_path)
+              ? addr_size - offsetof(sockaddr_un, sun_path)
+              : 0;
+      ss << kUnixPrefix;
+      if (path_size && !un.sun_path[0])  // abstract
+        ss << '@' << std::string(un.sun_path + 1, path_size - 1);
+      else
+        ss << std::string(un.sun_path, strnlen(un.sun_path, path_size));
+      break;
+    }
+    default:
+      ss << "unknown";
+  }
+  return ss.str();
+}
+
+Server::Server()
+    : event_loop_num_(1),
+      worker_process_num_(0),
+      drain_timeout_(Supervisor::kDefaultDrainTimeout),
+      io_backend_(IoBackend::EPOLL),
+      next_event_loop_(0),
+      connection_num_(0),
+      capture_max_size_(0) {
+  metrics.AddGauge("httpsimple_open_connections", "Open client connections",
+                   {}, [this]() { return connection_num_.load(); });
+  metrics.AddGauge("httpsimple_log_dropped_total",
+                   "Log lines dropped as a ring buffer was full", {},
+                   [this]() { return logger.dropped_num(); });
+}
 
 Server& Server::RegisterController(const HttpMethod& method,
                                    const std::string& path,
                                    const ControllerFunc&& func) {
-  router_->RegisterController(method, path, std::move(func));
+  router_settings_.push_back(
+      [method, path, func](Router& router, const uint32_t&) {
+        router.RegisterController(method, path, ControllerFunc(func));
+      });
+  return *this;
+}
+
+Server& Server::RegisterController(const HttpMethod& method,
+                                   const std::string& path,
+                                   const ControllerFunc&& func,
+                                   const CachePolicy& policy) {
+  // shared by the routers of all the event loops
+  const auto cache = std::make_shared<ResponseCache>(policy);
+  router_settings_.push_back(
+      [method, path, func, cache](Router& router, const uint32_t&) {
+        router.RegisterController(method, path, ControllerFunc(func), cache);
+      });
+  return *this;
+}
+
+Server& Server::RegisterController(const HttpMethod& method,
+                                   const std::string& path,
+                                   const CoroutineControllerFunc&& func) {
+  router_settings_.push_back(
+      [method, path, func](Router& router, const uint32_t&) {
+        router.RegisterController(method, path, CoroutineControllerFunc(func));
+      });
+  return *this;
+}
+
+Server& Server::ServeDirectory(const std::string& url_prefix,
+                               const std::string& root,
+                               const size_t& max_open_files) {
+  std::error_code error;
+  if (!std::filesystem::is_directory(root, error)) {
+    std::stringstream ss;
+    ss << "Can't serve " << root << ", it isn't a directory";
+    logger.Fatal(ss.str());
+    exit(-1);
+  }
+  // shared by the routers of all the event loops
+  const auto directory =
+      std::make_shared<StaticDirectory>(url_prefix, root, max_open_files);
+  std::stringstream ss;
+  ss << "Serving " << directory->file_num() << " files of " << root << " at "
+     << directory->url_prefix() << '/';
+  logger.Info(ss.str());
+  router_settings_.push_back([directory](Router& router, const uint32_t&) {
+    router.ServeDirectory(directory);
+  });
   return *this;
 }
 
 Server& Server::SetThreadNum(const uint32_t& num) {
-  router_->SetThreadNum(num);
+  router_settings_.push_back([num](Router& router, const uint32_t& loop_num) {
+    router.SetThreadNum(std::max(num / loop_num, 1u));
+  });
   return *this;
 }
 
-void Server::Listen(const uint16_t& port) {
+Server& Server::SetAutoScale(const uint32_t& min_num, const uint32_t& max_num) {
+  ThreadPool::AutoScalePolicy policy;
+  policy.min_thread_num = min_num;
+  policy.max_thread_num = max_num;
+  return SetAutoScale(policy);
+}
+
+Server& Server::SetAutoScale(const ThreadPool::AutoScalePolicy& policy) {
+  router_settings_.push_back(
+      [policy](Router& router, const uint32_t& loop_num) {
+        auto group_policy = policy;
+        group_policy.min_thread_num =
+            std::max(policy.min_thread_num / static_cast<int>(loop_num), 1);
+        group_policy.max_thread_num =
+            std::max(policy.max_thread_num / static_cast<int>(loop_num), 1);
+        router.SetAutoScale(group_policy);
+      });
+  return *this;
+}
+
+Server& Server::SetMaxQueueSize(const size_t& num) {
+  router_settings_.push_back([num](Router& router, const uint32_t& loop_num) {
+    router.SetMaxQueueSize(num ? std::max<size_t>(num / loop_num, 1) : 0);
+  });
+  return *this;
+}
+
+Server& Server::SetQueueDelayTarget(const std::chrono::milliseconds& target,
+                                    const std::chrono::milliseconds& interval) {
+  router_settings_.push_back([target, interval](Router& router,
+                                                const uint32_t&) {
+    router.SetQueueDelayTarget(target, interval);
+  });
+  return *this;
+}
+
+Server& Server::SetRetryAfter(const uint32_t& seconds) {
+  router_settings_.push_back([seconds](Router& router, const uint32_t&) {
+    router.SetRetryAfter(seconds);
+  });
+  return *this;
+}
+
+Server& Server::SetEventLoopNum(const uint32_t& num) {
+  event_loop_num_ = num;
+  return *this;
+}
+
+Server& Server::SetWorkerProcessNum(const uint32_t& num,
+                                    const std::chrono::seconds& drain_timeout) {
+  worker_process_num_ = num;
+  drain_timeout_ = drain_timeout;
+  return *this;
+}
+
+Server& Server::SetThreadPlacement(const ThreadPlacement& placement) {
+  placement_ = placement;
+  return *this;
+}
+
+Server& Server::SetIoBackend(const IoBackend& backend) {
+  io_backend_ = backend;
+  return *this;
+}
+
+void Server::OnConnected(const int& fd, const sockaddr_storage& client_addr,
+                         const socklen_t& addr_size) {
+  std::string addr;
+  if (client_addr.ss_family == AF_UNIX) {
+    // the peers are usually unnamed, tell them apart by the listener
+    sockaddr_storage local_addr;
+    socklen_t local_size = sizeof(local_addr);
+    memset(&local_addr, 0, sizeof(local_addr));
+    getsockname(fd, reinterpret_cast<sockaddr*>(&local_addr), &local_size);
+    addr = FormatAddress(local_addr, local_size);
+  } else {
+    addr = FormatAddress(client_addr, addr_size);
+  }
+  client_addrs_[fd] = addr;
+  ++connection_num_;
+  capture_.OnConnected(fd);
+  metrics
+      .GetCounter("httpsimple_connections_total", "Accepted client connections")
+      .Add();
+  std::stringstream log_ss;
+  log_ss << '[' << addr << "] connected (fd = " << fd << ")";
+  logger.Info(log_ss.str());
+}
+
+void Server::OnDisconnected(const int& fd) {
+  if (client_addrs_.erase(fd)) --connection_num_;
+  capture_.OnDisconnected(fd);
+}
+
+Server& Server::SetCapture(const std::string& path, const uint64_t& max_size) {
+  capture_path_ = path;
+  capture_max_size_ = max_size;
+  return *this;
+}
+
+Server& Server::EnableMetrics(const std::string& path) {
+  return RegisterController(
+      HttpMethod::GET, path,
+      [this](const HttpRequestPtr&&,
+             std::function<void(const HttpResponsePtr&,
+                                const HttpStatusCode&)>&& callback) {
+        HttpResponsePtr resp = std::make_unique<HttpResponse>();
+        resp->SetContentType("text/plain; version=0.0.4");
+        const std::string body = metrics.Serialize();
+        resp->SetBody(std::move(body), body.size());
+        callback(resp, HttpStatusCode::OK);
+      });
+}
+
+Server& Server::EnableTracing(const uint32_t& one_in,
+                              const std::string& path) {
+  tracer.SetSampleRate(one_in);
+  return RegisterController(
+      HttpMethod::GET, path,
+      [this](const HttpRequestPtr&&,
+             std::function<void(const HttpResponsePtr&,
+                                const HttpStatusCode&)>&& callback) {
+        HttpResponsePtr resp = std::make_unique<HttpResponse>();
+        resp->SetContentType("application/json");
+        const std::string body = tracer.Dump();
+        resp->SetBody(std::move(body), body.size());
+        callback(resp, HttpStatusCode::OK);
+      });
+}
+
+bool Server::InitEventLoops(const std::vector<int>& sockfds) {
+  uint32_t loop_num = event_loop_num_;
+  if (!loop_num) loop_num = std::max<uint32_t>(placement_.loop_cpus.size(), 1);
+  const auto& worker_cpus = placement_.worker_cpus.empty()
+                                ? placement_.loop_cpus
+                                : placement_.worker_cpus;
+
+  PinThread(pthread_self(), placement_.acceptor_cpus);
+  logger.SetPlacement(placement_.logger_cpus);
+
+  auto backend = io_backend_;
+  if (backend == IoBackend::IO_URING && !UringEventLoop::Supported()) {
+    logger.Warn("io_uring is not supported, falling back to epoll");
+    backend = IoBackend::EPOLL;
+  }
+
+  bool is_accepting = true;
+  for (uint32_t i = 0; i < loop_num; i++) {
+    std::unique_ptr<EventLoop> event_loop;
+    if (backend == IoBackend::IO_URING)
+      event_loop = std::make_unique<UringEventLoop>(this, i);
+    else
+      event_loop = std::make_unique<EpollEventLoop>(this, i);
+    for (const auto& sockfd : sockfds)
+      is_accepting = event_loop->Accept(sockfd) && is_accepting;
+    auto& router = event_loop->router();
+    if (!worker_cpus.empty())
+      router.SetPlacement(worker_cpus[i % worker_cpus.size()],
+                          placement_.bind_memory);
+    for (const auto& setting : router_settings_) setting(router, loop_num);
+    const Metrics::Labels labels = {{"loop", std::to_string(i)}};
+    metrics.AddGauge("httpsimple_queue_length",
+                     "Connections waiting for a worker thread", labels,
+                     [&router]() { return router.queue_size(); });
+    metrics.AddGauge("httpsimple_idle_threads",
+                     "Worker threads waiting for a connection", labels,
+                     [&router]() { return router.idle_size(); });
+    metrics.AddGauge("httpsimple_threads", "Worker threads", labels,
+                     [&router]() { return router.size(); });
+    metrics.AddGauge("httpsimple_receive_buffer_bytes",
+                     "Bytes of receive buffers held by connections", labels,
+                     [&pool = event_loop->buffer_pool()]() {
+                       return pool.lent_num() * BufferPool::kSlabSize;
+                     });
+    event_loop->Start(placement_.loop_cpus.empty()
+                          ? std::vector<int>()
+                          : placement_.loop_cpus[i % placement_.loop_cpus.size()],
+                      placement_.bind_memory);
+    event_loops_.push_back(std::move(event_loop));
+  }
+
+  std::stringstream ss;
+  ss << "Started " << loop_num << " event loop(s) ("
+     << (backend == IoBackend::IO_URING ? "io_uring" : "epoll") << ")";
+  logger.Info(ss.str());
+  return is_accepting;
+}
+
+EventLoop& Server::SelectEventLoop(const int& fd) {
+  if (event_loops_.size() > 1 && !placement_.loop_cpus.empty()) {
+    // the CPU that handled the packets of the connection
+    int cpu;
+    socklen_t cpu_size = sizeof(cpu);
+    if (!getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpu_size)) {
+      for (const auto& event_loop : event_loops_) {
+        const auto& cpus = event_loop->cpus();
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+          return *event_loop;
+      }
+    }
+  }
+  return *event_loops_[next_event_loop_++ % event_loops_.size()];
+}
+
+Server& Server::AddListener(const std::string& address) {
+  listen_addresses_.push_back(address);
+  return *this;
+}
+
+int Server::OpenListener(const std::string& address) {
+  sockaddr_storage addr;
+  socklen_t addr_size = 0;
+  memset(&addr, 0, sizeof(addr));
+  if (!address.compare(0, strlen(kUnixPrefix), kUnixPrefix)) {
+    auto& un = reinterpret_cast<sockaddr_un&>(addr);
+    const auto path = address.substr(strlen(kUnixPrefix));
+    if (!path.empty() && path.size() < sizeof(un.sun_path)) {
+      un.sun_family = AF_UNIX;
+      memcpy(un.sun_path, path.data(), path.size());
+      if (path[0] == '@') {  // abstract, the name isn't NUL-terminated
+        un.sun_path[0] = '\0';
+        addr_size = offsetof(sockaddr_un, sun_path) + path.size();
+      } else {
+        addr_size = sizeof(un);
+        // left by a previous run, bind() would fail
+        struct stat file;
+        if (!lstat(path.c_str(), &file) && S_ISSOCK(file.st_mode))
+          unlink(path.c_str());
+      }
+    }
+  } else {
+    const auto colon = address.rfind(':');
+    int port = -1;
+    if (colon != std::string::npos && colon + 1 < address.size() &&
+        address.find_first_not_of("0123456789", colon + 1) ==
+            std::string::npos &&
+        address.size() - colon <= 6)
+      port = std::stoi(address.substr(colon + 1));
+    if (0 <= port && port <= 65535) {
+      const auto host = address.substr(0, colon);
+      if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        auto& in6 = reinterpret_cast<sockaddr_in6&>(addr);
+        in6.sin6_family = AF_INET6;
+        in6.sin6_port = htons(port);
+        if (inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(),
+                      &in6.sin6_addr) == 1)
+          addr_size = sizeof(in6);
+      } else {
+        auto& in = reinterpret_cast<sockaddr_in&>(addr);
+        in.sin_family = AF_INET;
+        in.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &in.sin_addr) == 1)
+          addr_size = sizeof(in);
+      }
+    }
+  }
+  if (!addr_size) {
+    std::stringstream ss;
+    ss << "Invalid listening address " << address;
+    logger.Fatal(ss.str());
+    exit(-1);
+  }
+
   // create
   int sockfd;
-  sockaddr_in serverAddr;
-  if (!~(sockfd = socket(AF_INET, SOCK_STREAM, 0))) {
+  if (!~(sockfd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0))) {
     std::stringstream ss;
     ss << "socket() failed! errno: " << errno;
     logger.Fatal(ss.str());
     exit(-1);
   }
+  if (addr.ss_family == AF_INET6) {  // dual-stack, whatever the sysctl says
+    const int v6_only = 0;
+    setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only));
+  }
 
   // bind
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_port = htons(port);
-  serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  bzero(&(serverAddr.sin_zero), 8);
-  if (!~bind(sockfd, (struct sockaddr*)&serverAddr, sizeof(serverAddr))) {
+  if (!~bind(sockfd, reinterpret_cast<sockaddr*>(&addr), addr_size)) {
     std::stringstream ss;
-    ss << "bind() failed! errno: " << errno;
+    ss << "bind() to " << address << " failed! errno: " << errno;
     logger.Fatal(ss.str());
     close(sockfd);
     exit(-1);
   }
 
   // listen
-  if (!~listen(sockfd, 5)) {
+  if (!~listen(sockfd, SOMAXCONN)) {
     std::stringstream ss;
     ss << "listen() failed! errno: " << errno;
     logger.Fatal(ss.str());
@@ -57,74 +433,154 @@ void Server::Listen(const uint16_t& port) {
   }
 
   std::stringstream ss;
-  ss << "Listening on port " << port;
+  ss << "Listening on " << address;
   logger.Info(ss.str());
+  return sockfd;
+}
 
-  // init epoll listening thread
-  const int epfd = epoll_create1(0);
-  task_parser_ = std::make_unique<std::thread>([this, epfd]() {
-    epoll_event events[kMaxEpollEvents];
-    for (;;) {
-      const int num_ready = epoll_wait(epfd, events, kMaxEpollEvents, -1);
-      for (int i = 0; i < num_ready; i++) {
-        if (events[i].events & EPOLLIN) {  // incoming request
-          router_->push(events[i].data.fd);
-        } else {  // encounter error
-          close(events[i].data.fd);
-          std::stringstream ss;
-          ss << client_addrs_[events[i].data.fd] << " disconnected";
-          logger.Info(ss.str());
-          client_addrs_.erase(events[i].data.fd);
-        }
+void Server::Listen(const uint16_t& port) {
+  AddListener("0.0.0.0:" + std::to_string(port));
+  Listen();
+}
+
+void Server::Listen() {
+  if (listen_addresses_.empty()) {
+    logger.Fatal("No listening address!");
+    exit(-1);
+  }
+  std::vector<int> sockfds;
+  const int worker = Supervisor::WorkerIndex();
+  if (~worker) {  // started by a supervisor
+    if (!Supervisor::InheritListeners(listen_addresses_.size(), sockfds)) {
+      logger.Fatal("The listening sockets inherited don't match!");
+      exit(-1);
+    }
+  } else if (worker_process_num_) {
+    Supervisor supervisor(logger, worker_process_num_, drain_timeout_);
+    if (!supervisor.ReceiveListeners(listen_addresses_.size(), sockfds))
+      for (const auto& address : listen_addresses_)
+        sockfds.push_back(OpenListener(address));
+    supervisor.Run(sockfds);
+  } else {
+    for (const auto& address : listen_addresses_)
+      sockfds.push_back(OpenListener(address));
+  }
+
+  // record the traffic, every worker to its own file
+  if (!capture_path_.empty()) {
+    if (~worker) capture_path_ += '.' + std::to_string(worker);
+    if (!capture_.Open(capture_path_, capture_max_size_)) {
+      std::stringstream error_ss;
+      error_ss << "Can't open the capture file " << capture_path_
+               << "! errno: " << errno;
+      logger.Fatal(error_ss.str());
+      exit(-1);
+    }
+    std::stringstream capture_ss;
+    capture_ss << "Capturing the traffic to " << capture_path_;
+    logger.Info(capture_ss.str());
+  }
+
+  // a worker is stopped by its supervisor
+  const int stop_fd = ~worker ? Supervisor::WatchStopSignals() : -1;
+
+  // init event loops
+  if (InitEventLoops(sockfds)) {  // the event loops accept the connections
+    if (~stop_fd) {
+      Supervisor::NotifyReady();
+      pollfd fd = {stop_fd, POLLIN, 0};
+      while (poll(&fd, 1, -1) != 1) {
       }
+      Drain();
     }
-  });
+    for (const auto& event_loop : event_loops_) event_loop->Join();
+    return;
+  }
 
   // get connection
+  if (sockfds.size() == 1 && !~stop_fd)
+    for (;;) AcceptConnection(sockfds[0]);
+  // several sockets are polled, another process may accept first
+  std::vector<pollfd> fds;
+  for (const auto& sockfd : sockfds) {
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+    fds.push_back({sockfd, POLLIN, 0});
+  }
+  if (~stop_fd) {
+    fds.push_back({stop_fd, POLLIN, 0});
+    Supervisor::NotifyReady();
+  }
   for (;;) {
-    int comfd;
-    sockaddr_in clientAddr;
-    auto socketaddr_size = sizeof(sockaddr_in);
-    if (!~(comfd = accept(sockfd, reinterpret_cast<sockaddr*>(&clientAddr),
-                          reinterpret_cast<socklen_t*>(&socketaddr_size)))) {
+    if (!~poll(fds.data(), fds.size(), -1)) {
+      if (errno == EINTR) continue;
       std::stringstream ss;
-      ss << "accept() failed! errno: " << errno;
-      logger.Error(ss.str());
+      ss << "poll() failed! errno: " << errno;
+      logger.Fatal(ss.str());
+      exit(-1);
     }
-    // log
-    char addr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &clientAddr.sin_addr, addr, sizeof(addr));
+    if (~stop_fd && fds.back().revents) Drain();
+    for (const auto& fd : fds)
+      if (fd.revents) AcceptConnection(fd.fd);
+  }
+}
+
+void Server::Drain() {
+  std::stringstream ss;
+  ss << "Draining " << connection_num_ << " connection(s)";
+  logger.Info(ss.str());
+  for (const auto& event_loop : event_loops_) {
+    event_loop->StopAccepting();
+    event_loop->router().Drain();
+  }
+  const auto deadline = std::chrono::steady_clock::now() + drain_timeout_;
+  while (connection_num_ > 0 && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  if (connection_num_ > 0) {
+    std::stringstream warn_ss;
+    warn_ss << "Closing " << connection_num_ << " connection(s) still open";
+    logger.Warn(warn_ss.str());
+  }
+  logger.Flush();
+  exit(0);
+}
+
+void Server::AcceptConnection(const int& sockfd) {
+  int comfd;
+  sockaddr_storage clientAddr;
+  socklen_t socketaddr_size = sizeof(clientAddr);
+  if (!~(comfd = accept(sockfd, reinterpret_cast<sockaddr*>(&clientAddr),
+                        &socketaddr_size))) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return;  // accepted elsewhere
     std::stringstream ss;
-    ss << addr << ':' << ntohs(clientAddr.sin_port);
-    client_addrs_[comfd] = ss.str();
+    ss << "accept() failed! errno: " << errno;
+    logger.Error(ss.str());
+    return;
+  }
+  // log
+  OnConnected(comfd, clientAddr, socketaddr_size);
+  // set to non-blocking mode
+  int flags;
+  flags = fcntl(comfd, F_GETFL, 0);
+  if (flags < 0) {
     std::stringstream log_ss;
-    log_ss << '[' << ss.str() << "] connected (fd = " << comfd << ")";
-    logger.Info(log_ss.str());
-    // set to non-blocking mode
-    int flags;
-    flags = fcntl(comfd, F_GETFL, 0);
-    if (flags < 0) {
-      std::stringstream log_ss;
-      log_ss << '[' << ss.str() << "] fcntl(F_GETFL) failed (fd = " << comfd
-             << ")";
-      logger.Error(log_ss.str());
-      close(comfd);
-      client_addrs_.erase(comfd);
-      continue;
-    }
-    if (fcntl(comfd, F_SETFL, flags | O_NONBLOCK) < 0) {
-      std::stringstream log_ss;
-      log_ss << '[' << ss.str() << "] fcntl(F_SETFL) failed (fd = " << comfd
-             << ")";
-      logger.Error(log_ss.str());
-      close(comfd);
-      client_addrs_.erase(comfd);
-      continue;
-    }
-    // add to epoll list
-    epoll_event event;
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = comfd;
-    epoll_ctl(epfd, EPOLL_CTL_ADD, comfd, &event);
+    log_ss << '[' << client_addrs_[comfd]
+           << "] fcntl(F_GETFL) failed (fd = " << comfd
+           << ")";
+    logger.Error(log_ss.str());
+    close(comfd);
+    OnDisconnected(comfd);
+    return;
+  }
+  if (fcntl(comfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    std::stringstream log_ss;
+    log_ss << '[' << client_addrs_[comfd]
+           << "] fcntl(F_SETFL) failed (fd = " << comfd
+           << ")";
+    logger.Error(log_ss.str());
+    close(comfd);
+    OnDisconnected(comfd);
+    return;
   }
+  // add to the epoll list of an event loop
+  SelectEventLoop(comfd).Add(comfd);
 }
@@ -0,0 +1,261 @@
+#include "StaticDirectory.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+static const char* const kIndexFile = "index.html";
+static const char* const kDefaultContentType = "application/octet-stream";
+static const uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                                   IN_DELETE_SELF | IN_MOVE_SELF;
+// how long the tree must stay quiet before the index is rebuilt, so that a
+// burst of changes (e.g. a deployment) rebuilds it once
+static const int kSettleMs = 100;
+
+static const struct {
+  const char* extension;
+  const char* content_type;
+} kContentTypes[] = {
+    {"html", "text/html"},         {"htm", "text/html"},
+    {"css", "text/css"},           {"js", "text/javascript"},
+    {"mjs", "text/javascript"},    {"json", "application/json"},
+    {"txt", "text/plain"},         {"xml", "application/xml"},
+    {"png", "image/png"},          {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},        {"gif", "image/gif"},
+    {"svg", "image/svg+xml"},      {"ico", "image/x-icon"},
+    {"webp", "image/webp"},        {"pdf", "application/pdf"},
+    {"wasm", "application/wasm"},  {"mp4", "video/mp4"},
+    {"woff", "font/woff"},         {"woff2", "font/woff2"}};
+
+/**
+ * @brief get the MIME type of a file from its extension
+ *
+ * @param path the path of the file
+ * @return the MIME type
+ */
+static const char* ContentType(const std::filesystem::path& path) {
+  auto extension = path.extension().string();
+  if (extension.empty()) return kDefaultContentType;
+  extension.erase(0, 1);  // the dot
+  for (const auto& type : kContentTypes)
+    if (!strcasecmp(extension.c_str(), type.extension))
+      return type.content_type;
+  return kDefaultContentType;
+}
+
+/**
+ * @brief get the value of a hex digit
+ *
+ * @param c the digit
+ * @return the value (-1 if it isn't a hex digit)
+ */
+static int HexValue(const char& c) {
+  if ('0' <= c && c <= '9') return c - '0';
+  if ('a' <= c && c <= 'f') return c - 'a' + 10;
+  if ('A' <= c && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+StaticDirectory::OpenFile::~OpenFile() { close(fd); }
+
+StaticDirectory::StaticDirectory(const std::string& url_prefix,
+                                 const std::filesystem::path& root,
+                                 const size_t& max_open_files)
+    : url_prefix_(url_prefix.substr(0, url_prefix.find_last_not_of('/') + 1)),
+      root_(root),
+      max_open_files_(max_open_files),
+      inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      stop_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+  index_ = BuildIndex();
+  if (~inotify_fd_ && ~stop_fd_) watcher_ = std::thread([this]() { Watch(); });
+}
+
+StaticDirectory::~StaticDirectory() {
+  if (watcher_.joinable()) {
+    const uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) == sizeof(one))
+      watcher_.join();
+    else
+      watcher_.detach();
+  }
+  if (~inotify_fd_) close(inotify_fd_);
+  if (~stop_fd_) close(stop_fd_);
+}
+
+bool StaticDirectory::Match(const std::string& path) const {
+  return !path.compare(0, url_prefix_.size(), url_prefix_) &&
+         (path.size() == url_prefix_.size() || path[url_prefix_.size()] == '/');
+}
+
+HttpStatusCode StaticDirectory::Handle(const HttpRequest& request,
+                                       HttpResponse& response) {
+  std::string key;
+  if (!Normalize(std::string_view(request.path).substr(url_prefix_.size()),
+                 key)) {
+    response.SetContentLength(0);
+    return HttpStatusCode::BAD_REQUEST;
+  }
+  std::shared_ptr<const Index> index;
+  {
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    index = index_;
+  }
+  const auto entry = index->find(key);
+  if (entry == index->end()) {
+    response.SetContentLength(0);
+    return HttpStatusCode::NOT_FOUND;
+  }
+  response.SetContentType(entry->second.content_type);
+  if (request.method == HttpMethod::HEAD) {
+    response.SetContentLength(entry->second.size);
+    return HttpStatusCode::OK;
+  }
+  const auto file = Open(key, entry->second);
+  if (!file) {  // deleted since it was indexed
+    response.headers.erase("Content-Type");
+    response.SetContentLength(0);
+    return HttpStatusCode::NOT_FOUND;
+  }
+  auto& body = response.body;
+  body.resize(entry->second.size);
+  size_t size = 0;
+  while (size < body.size()) {
+    const auto read_num =
+        pread(file->fd, body.data() + size, body.size() - size, size);
+    if (read_num == -1 && errno == EINTR) continue;
+    if (read_num == -1) {
+      body.clear();
+      response.headers.erase("Content-Type");
+      response.SetContentLength(0);
+      return HttpStatusCode::INTERNAL_SERVER_ERROR;
+    }
+    if (read_num == 0) break;  // truncated since it was indexed
+    size += read_num;
+  }
+  body.resize(size);
+  response.filepath.clear();
+  response.SetContentLength(size);
+  return HttpStatusCode::OK;
+}
+
+size_t StaticDirectory::file_num() {
+  std::lock_guard<std::mutex> lock(index_mutex_);
+  return index_->size();
+}
+
+bool StaticDirectory::Normalize(std::string_view path, std::string& key) {
+  std::string segment;
+  key.clear();
+  for (size_t i = 0; i <= path.size(); i++) {
+    if (i == path.size() || path[i] == '/') {
+      if (segment == "..") return false;  // climbs out of the tree
+      if (!segment.empty() && segment != ".") {
+        if (!key.empty()) key.push_back('/');
+        key += segment;
+      }
+      segment.clear();
+    } else if (path[i] == '%') {
+      if (i + 2 >= path.size()) return false;
+      const auto high = HexValue(path[i + 1]), low = HexValue(path[i + 2]);
+      if (high < 0 || low < 0) return false;
+      const char c = static_cast<char>(high << 4 | low);
+      // an encoded separator or NUL could only be used to trick the filesystem
+      if (c == '/' || c == '\0' || c == '\\') return false;
+      segment.push_back(c);
+      i += 2;
+    } else {
+      segment.push_back(path[i]);
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<const StaticDirectory::Index> StaticDirectory::BuildIndex() {
+  auto index = std::make_shared<Index>();
+  if (~inotify_fd_) inotify_add_watch(inotify_fd_, root_.c_str(), kWatchMask);
+  std::error_code error;
+  std::filesystem::recursive_directory_iterator it(
+      root_, std::filesystem::directory_options::skip_permission_denied,
+      error);
+  for (const std::filesystem::recursive_directory_iterator end; it != end;
+       it.increment(error)) {
+    if (error) break;
+    const auto& file = *it;
+    if (file.is_symlink(error)) continue;  // may point out of the tree
+    if (file.is_directory(error)) {
+      if (~inotify_fd_)
+        inotify_add_watch(inotify_fd_, file.path().c_str(), kWatchMask);
+      continue;
+    }
+    if (!file.is_regular_file(error)) continue;
+    const auto size = file.file_size(error);
+    if (error) continue;
+    const auto relative = file.path().lexically_relative(root_);
+    const Entry entry{file.path(), size, ContentType(file.path())};
+    index->emplace(relative.generic_string(), entry);
+    if (relative.filename() == kIndexFile) {
+      const auto directory = relative.parent_path().generic_string();
+      index->emplace(directory, entry);
+    }
+  }
+  return index;
+}
+
+void StaticDirectory::Watch() {
+  alignas(inotify_event) char events[4096];
+  pollfd fds[] = {{stop_fd_, POLLIN, 0}, {inotify_fd_, POLLIN, 0}};
+  while (true) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[0].revents) return;  // stopped
+    // drain the events until the tree has been quiet for a while
+    do {
+      while (read(inotify_fd_, events, sizeof(events)) > 0) {
+      }
+      if (poll(fds, 1, 0) > 0) return;
+    } while (poll(fds + 1, 1, kSettleMs) > 0);
+    auto index = BuildIndex();
+    {
+      std::lock_guard<std::mutex> lock(index_mutex_);
+      index_ = std::move(index);
+    }
+    // the open files may have been replaced, closed once they aren't in use
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    files_.clear();
+    lru_.clear();
+  }
+}
+
+std::shared_ptr<const StaticDirectory::OpenFile> StaticDirectory::Open(
+    const std::string& key, const Entry& entry) {
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    const auto cached = files_.find(key);
+    if (cached != files_.end()) {
+      lru_.splice(lru_.begin(), lru_, cached->second.lru_pos);
+      return cached->second.file;
+    }
+  }
+  const int fd = open(entry.path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1) return nullptr;
+  auto file = std::make_shared<const OpenFile>(fd);
+  if (!max_open_files_) return file;
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  const auto [cached, is_inserted] = files_.emplace(key, CachedFile{file, {}});
+  if (!is_inserted) return cached->second.file;  // opened by another thread
+  lru_.push_front(key);
+  cached->second.lru_pos = lru_.begin();
+  while (files_.size() > max_open_files_) {
+    files_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  return file;
+}
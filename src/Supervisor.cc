@@ -0,0 +1,438 @@
+#include "Supervisor.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <sstream>
+#include <thread>
+
+// how a supervisor talks to the processes it executes
+static const char* const kWorkerEnv = "HTTPSIMPLE_WORKER";
+static const char* const kListenFdsEnv = "HTTPSIMPLE_LISTEN_FDS";
+static const char* const kReadyFdEnv = "HTTPSIMPLE_READY_FD";
+static const char* const kHandoffFdEnv = "HTTPSIMPLE_HANDOFF_FD";
+
+static const char* const kSelfPath = "/proc/self/exe";
+static constexpr std::chrono::seconds kStartTimeout{30};
+// the next generation starts its own workers first
+static constexpr std::chrono::seconds kUpgradeTimeout{60};
+static constexpr std::chrono::seconds kKillGrace{5};
+// a worker dying sooner is restarted after this delay, not in a tight loop
+static constexpr std::chrono::seconds kRestartDelay{1};
+
+static int signal_fds[2] = {-1, -1};  // a self-pipe written by OnSignal()
+
+extern char** environ;
+
+/**
+ * @brief write the number of a caught signal to the self-pipe
+ *
+ * @param signo the signal
+ */
+static void OnSignal(int signo) {
+  const int saved_errno = errno;
+  const char byte = static_cast<char>(signo);
+  if (write(signal_fds[1], &byte, 1)) {
+  }
+  errno = saved_errno;
+}
+
+/**
+ * @brief catch signals, their numbers are written to the self-pipe
+ *
+ * @param signals the signals
+ * @return the read end of the self-pipe (-1 if it can't be created)
+ */
+static int WatchSignals(const std::initializer_list<int>& signals) {
+  if (!~signal_fds[0] && pipe2(signal_fds, O_CLOEXEC | O_NONBLOCK)) return -1;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnSignal;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&action.sa_mask);
+  for (const auto& signo : signals) sigaction(signo, &action, nullptr);
+  return signal_fds[0];
+}
+
+/**
+ * @brief wait until a file descriptor is readable
+ *
+ * @param fd the file descriptor
+ * @param timeout the timeout (negative means forever)
+ * @return false on timeout
+ */
+static bool WaitReadable(const int& fd, const std::chrono::milliseconds& timeout) {
+  pollfd pfd = {fd, POLLIN, 0};
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (;;) {
+    int wait_ms = -1;
+    if (timeout.count() >= 0)
+      wait_ms = static_cast<int>(std::max<int64_t>(
+          std::chrono::ceil<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now())
+              .count(),
+          0));
+    const int ret = poll(&pfd, 1, wait_ms);
+    if (ret > 0) return true;
+    if (!ret) return false;
+    if (errno != EINTR) return false;
+  }
+}
+
+/**
+ * @brief whether a variable of the environment is one of the supervisor's
+ *
+ * @param variable the "NAME=value" string
+ * @return true if it is
+ */
+static bool IsOwnVariable(const char* const variable) {
+  for (const auto& name : {kWorkerEnv, kListenFdsEnv, kReadyFdEnv,
+                           kHandoffFdEnv}) {
+    const size_t size = strlen(name);
+    if (!strncmp(variable, name, size) && variable[size] == '=') return true;
+  }
+  return false;
+}
+
+Supervisor::Supervisor(Logger& logger, const uint32_t& worker_num,
+                       const std::chrono::seconds& drain_timeout)
+    : logger_(logger),
+      worker_num_(worker_num),
+      drain_timeout_(drain_timeout),
+      next_generation_(0),
+      handoff_fd_(-1) {
+  // the binary and the arguments the workers and the next generation run
+  char path[4096];
+  const auto path_size = readlink(kSelfPath, path, sizeof(path) - 1);
+  if (path_size > 0) path_.assign(path, path_size);
+  std::ifstream cmdline("/proc/self/cmdline", std::ios::binary);
+  std::string arg;
+  while (std::getline(cmdline, arg, '\0')) args_.push_back(arg);
+}
+
+bool Supervisor::ReceiveListeners(const size_t& num,
+                                  std::vector<int>& sockfds) {
+  const char* const value = getenv(kHandoffFdEnv);
+  if (!value) return false;
+  handoff_fd_ = atoi(value);
+  fcntl(handoff_fd_, F_SETFD, FD_CLOEXEC);
+
+  uint32_t count = 0;
+  iovec iov = {&count, sizeof(count)};
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * num));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  ssize_t ret;
+  while (!~(ret = recvmsg(handoff_fd_, &msg, MSG_CMSG_CLOEXEC)) &&
+         errno == EINTR) {
+  }
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); ret > 0 && cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    const size_t fd_num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const auto fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+    sockfds.insert(sockfds.end(), fds, fds + fd_num);
+  }
+  if (ret != sizeof(count) || (msg.msg_flags & MSG_CTRUNC) ||
+      sockfds.size() != count || count != num) {
+    std::stringstream ss;
+    ss << "The previous generation passed " << count
+       << " listening socket(s), " << num << " expected!";
+    logger_.Fatal(ss.str());
+    exit(-1);
+  }
+  std::stringstream ss;
+  ss << "Received " << num << " listening socket(s) from the previous generation";
+  logger_.Info(ss.str());
+  return true;
+}
+
+void Supervisor::Run(const std::vector<int>& sockfds) {
+  sockfds_ = sockfds;
+  const int signal_fd = WatchSignals({SIGCHLD, SIGTERM, SIGINT, SIGUSR2});
+  int ready_fds[2];
+  if (!~signal_fd || pipe2(ready_fds, O_CLOEXEC)) {
+    std::stringstream ss;
+    ss << "pipe2() failed! errno: " << errno;
+    logger_.Fatal(ss.str());
+    exit(-1);
+  }
+
+  // start the workers and wait until they all accept connections
+  workers_.resize(worker_num_, Worker{0, {}});
+  for (uint32_t i = 0; i < worker_num_; i++) StartWorker(i, ready_fds[1]);
+  close(ready_fds[1]);
+  uint32_t ready_num = 0;
+  const auto deadline = std::chrono::steady_clock::now() + kStartTimeout;
+  while (ready_num < worker_num_ &&
+         WaitReadable(ready_fds[0],
+                      std::chrono::ceil<std::chrono::milliseconds>(
+                          deadline - std::chrono::steady_clock::now()))) {
+    char bytes[64];
+    const auto read_num = read(ready_fds[0], bytes, sizeof(bytes));
+    if (!read_num) break;  // all of them died
+    if (read_num > 0) ready_num += read_num;
+  }
+  close(ready_fds[0]);
+  if (ready_num < worker_num_) {
+    std::stringstream ss;
+    ss << "Only " << ready_num << " of " << worker_num_
+       << " worker process(es) started!";
+    logger_.Fatal(ss.str());
+    for (const auto& worker : workers_)
+      if (worker.pid) kill(worker.pid, SIGKILL);
+    exit(-1);
+  }
+  std::stringstream ss;
+  ss << "Started " << worker_num_ << " worker process(es), SIGUSR2 upgrades "
+     << path_;
+  logger_.Info(ss.str());
+
+  // the previous generation can drain its workers now
+  if (~handoff_fd_) {
+    const char byte = 1;
+    if (send(handoff_fd_, &byte, 1, MSG_NOSIGNAL) != 1)
+      logger_.Error("Can't tell the previous generation it's ready");
+    close(handoff_fd_);
+    handoff_fd_ = -1;
+  }
+
+  for (;;) {
+    WaitReadable(signal_fd, std::chrono::milliseconds(-1));
+    char signo;
+    while (read(signal_fd, &signo, 1) == 1) {
+      switch (signo) {
+        case SIGCHLD:
+          Reap();
+          break;
+        case SIGUSR2:
+          Upgrade();
+          break;
+        default:  // SIGTERM, SIGINT
+          Stop();
+      }
+    }
+  }
+}
+
+pid_t Supervisor::Spawn(const std::string& path,
+                        const std::vector<std::string>& env,
+                        const std::vector<int>& fds) const {
+  // everything is prepared before fork(), as the child of a multithreaded
+  // process may only make async-signal-safe calls
+  std::vector<std::string> variables;
+  for (char** variable = environ; *variable; variable++)
+    if (!IsOwnVariable(*variable)) variables.emplace_back(*variable);
+  variables.insert(variables.end(), env.begin(), env.end());
+  std::vector<char*> envp, argv;
+  for (auto& variable : variables) envp.push_back(variable.data());
+  envp.push_back(nullptr);
+  std::vector<std::string> args = args_;
+  for (auto& arg : args) argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  struct sigaction default_action;
+  memset(&default_action, 0, sizeof(default_action));
+  default_action.sa_handler = SIG_DFL;
+
+  const pid_t pid = fork();
+  if (pid) return pid;
+  for (const auto& fd : fds) fcntl(fd, F_SETFD, 0);  // inherited by execve()
+  for (const auto& signo : {SIGCHLD, SIGTERM, SIGINT, SIGUSR2})
+    sigaction(signo, &default_action, nullptr);
+  execve(path.c_str(), argv.data(), envp.data());
+  _exit(127);
+}
+
+void Supervisor::StartWorker(const uint32_t& index, const int& ready_fd) {
+  std::stringstream fds_ss;
+  for (size_t i = 0; i < sockfds_.size(); i++)
+    fds_ss << (i ? "," : "") << sockfds_[i];
+  std::vector<std::string> env = {
+      std::string(kWorkerEnv) + '=' + std::to_string(index),
+      std::string(kListenFdsEnv) + '=' + fds_ss.str()};
+  std::vector<int> fds = sockfds_;
+  if (~ready_fd) {
+    env.push_back(std::string(kReadyFdEnv) + '=' + std::to_string(ready_fd));
+    fds.push_back(ready_fd);
+  }
+  // the running binary, even if it was replaced on disk
+  const pid_t pid = Spawn(kSelfPath, env, fds);
+  if (!~pid) {
+    std::stringstream ss;
+    ss << "fork() failed! errno: " << errno;
+    logger_.Error(ss.str());
+    workers_[index].pid = 0;
+    return;
+  }
+  workers_[index] = {pid, std::chrono::steady_clock::now()};
+  std::stringstream ss;
+  ss << "Started worker " << index << " (pid = " << pid << ")";
+  logger_.Info(ss.str());
+}
+
+void Supervisor::Reap() {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    std::stringstream status_ss;
+    if (WIFSIGNALED(status))
+      status_ss << "killed by signal " << WTERMSIG(status);
+    else
+      status_ss << "exited with status " << WEXITSTATUS(status);
+    if (pid == next_generation_) {
+      std::stringstream ss;
+      ss << "The next generation (pid = " << pid << ") " << status_ss.str();
+      logger_.Error(ss.str());
+      next_generation_ = 0;
+      continue;
+    }
+    for (uint32_t i = 0; i < workers_.size(); i++) {
+      if (workers_[i].pid != pid) continue;
+      std::stringstream ss;
+      ss << "Worker " << i << " (pid = " << pid << ") " << status_ss.str()
+         << ", restarting it";
+      logger_.Error(ss.str());
+      if (std::chrono::steady_clock::now() - workers_[i].started <
+          kRestartDelay)
+        std::this_thread::sleep_for(kRestartDelay);
+      StartWorker(i, -1);
+      break;
+    }
+  }
+}
+
+void Supervisor::Upgrade() {
+  if (next_generation_) {
+    logger_.Warn("An upgrade is in progress already");
+    return;
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) {
+    std::stringstream ss;
+    ss << "socketpair() failed! errno: " << errno;
+    logger_.Error(ss.str());
+    return;
+  }
+  const pid_t pid = Spawn(
+      path_, {std::string(kHandoffFdEnv) + '=' + std::to_string(fds[1])},
+      {fds[1]});
+  close(fds[1]);
+  if (!~pid) {
+    std::stringstream ss;
+    ss << "fork() failed! errno: " << errno;
+    logger_.Error(ss.str());
+    close(fds[0]);
+    return;
+  }
+  next_generation_ = pid;
+  std::stringstream ss;
+  ss << "Upgrading to " << path_ << " (pid = " << pid << ")";
+  logger_.Info(ss.str());
+
+  // pass the listening sockets, the connections queued on them aren't lost
+  uint32_t count = sockfds_.size();
+  iovec iov = {&count, sizeof(count)};
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  memcpy(CMSG_DATA(cmsg), sockfds_.data(), sizeof(int) * count);
+  bool is_ready = sendmsg(fds[0], &msg, MSG_NOSIGNAL) == sizeof(count);
+
+  // wait until its workers accept connections
+  char byte = 0;
+  is_ready = is_ready && WaitReadable(fds[0], kUpgradeTimeout) &&
+             recv(fds[0], &byte, 1, 0) == 1;
+  close(fds[0]);
+  if (!is_ready) {
+    logger_.Error("The next generation failed to start, keeping this one");
+    kill(pid, SIGTERM);  // reaped by Reap()
+    return;
+  }
+  logger_.Info("The next generation is ready, draining the old workers");
+  Stop();
+}
+
+void Supervisor::Stop() {
+  std::stringstream ss;
+  ss << "Stopping " << workers_.size() << " worker process(es)";
+  logger_.Info(ss.str());
+  for (const auto& worker : workers_)
+    if (worker.pid) kill(worker.pid, SIGTERM);
+  const auto deadline =
+      std::chrono::steady_clock::now() + drain_timeout_ + kKillGrace;
+  bool is_killed = false;
+  for (;;) {
+    bool is_running = false;
+    for (auto& worker : workers_) {
+      if (!worker.pid) continue;
+      if (waitpid(worker.pid, nullptr, WNOHANG) == worker.pid)
+        worker.pid = 0;
+      else
+        is_running = true;
+    }
+    if (!is_running) break;
+    if (!is_killed && std::chrono::steady_clock::now() >= deadline) {
+      logger_.Warn("Killing the workers still draining");
+      for (const auto& worker : workers_)
+        if (worker.pid) kill(worker.pid, SIGKILL);
+      is_killed = true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  logger_.Info("Stopped");
+  logger_.Flush();
+  exit(0);
+}
+
+int Supervisor::WorkerIndex() {
+  const char* const value = getenv(kWorkerEnv);
+  return value ? atoi(value) : -1;
+}
+
+bool Supervisor::InheritListeners(const size_t& num,
+                                  std::vector<int>& sockfds) {
+  const char* const value = getenv(kListenFdsEnv);
+  if (!value) return false;
+  std::stringstream ss(value);
+  std::string fd;
+  while (std::getline(ss, fd, ',')) {
+    sockfds.push_back(atoi(fd.c_str()));
+    fcntl(sockfds.back(), F_SETFD, FD_CLOEXEC);
+  }
+  return sockfds.size() == num;
+}
+
+void Supervisor::NotifyReady() {
+  const char* const value = getenv(kReadyFdEnv);
+  if (!value) return;  // restarted, no one waits for it
+  const int fd = atoi(value);
+  const char byte = 1;
+  if (write(fd, &byte, 1)) {
+  }
+  close(fd);
+}
+
+int Supervisor::WatchStopSignals() { return WatchSignals({SIGTERM, SIGINT}); }
@@ -0,0 +1,108 @@
+#include "Tracer.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <utility>
+
+static const size_t kDefaultBufferSize = 4096;
+
+std::atomic<uint64_t> Tracer::next_id_(0);
+
+Tracer::Tracer()
+    : id_(next_id_++), sample_rate_(0), buffer_size_(kDefaultBufferSize) {}
+
+void Tracer::Record(const char* const name, const Clock::time_point& begin,
+                    const Clock::time_point& end, std::string&& args) {
+  Span span{name,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                begin.time_since_epoch())
+                .count(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+                .count(),
+            std::move(args)};
+  auto& buffer = LocalBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  if (buffer.spans.size() < buffer.spans.capacity()) {
+    buffer.spans.push_back(std::move(span));
+  } else {
+    buffer.spans[buffer.next] = std::move(span);
+    buffer.next = (buffer.next + 1) % buffer.spans.size();
+  }
+}
+
+Tracer::ThreadBuffer& Tracer::LocalBuffer() {
+  // a thread may trace for several tracers, keyed by id as addresses get
+  // reused
+  thread_local std::vector<std::pair<uint64_t, std::shared_ptr<ThreadBuffer>>>
+      buffers;
+  for (const auto& buffer : buffers)
+    if (buffer.first == id_) return *buffer.second;
+  auto buffer = std::make_shared<ThreadBuffer>();
+  buffer->tid = static_cast<int>(syscall(SYS_gettid));
+  buffer->spans.reserve(buffer_size_);
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    // forget the threads that have exited (retired workers)
+    buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                  [](const std::shared_ptr<ThreadBuffer>& b) {
+                                    return b.use_count() == 1;
+                                  }),
+                   buffers_.end());
+    buffers_.push_back(buffer);
+  }
+  buffers.emplace_back(id_, buffer);
+  return *buffer;
+}
+
+std::string Tracer::Dump() const {
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    buffers = buffers_;
+  }
+  const int pid = getpid();
+  std::stringstream ss;
+  ss << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool is_first = true;
+  char number[32];
+  for (const auto& buffer : buffers) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    for (const auto& span : buffer->spans) {
+      if (!is_first) ss << ',';
+      is_first = false;
+      // timestamps are in microseconds
+      ss << "{\"name\":\"" << span.name << "\",\"cat\":\"http\",\"ph\":\"X\"";
+      snprintf(number, sizeof(number), "%.3f", span.begin_ns / 1e3);
+      ss << ",\"ts\":" << number;
+      snprintf(number, sizeof(number), "%.3f", span.duration_ns / 1e3);
+      ss << ",\"dur\":" << number;
+      ss << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid;
+      if (!span.args.empty()) ss << ",\"args\":{" << span.args << '}';
+      ss << '}';
+    }
+  }
+  ss << "]}";
+  return ss.str();
+}
+
+std::string Tracer::Quote(const std::string& str) {
+  std::string ret("\"");
+  for (const auto& ch : str) {
+    if (ch == '"' || ch == '\\') {
+      ret += '\\';
+      ret += ch;
+    } else if (static_cast<unsigned char>(ch) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+      ret += escaped;
+    } else {
+      ret += ch;
+    }
+  }
+  ret += '"';
+  return ret;
+}
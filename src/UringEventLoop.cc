@@ -0,0 +1,431 @@
+#include "UringEventLoop.hpp"
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "HTTPSimple.hpp"
+
+static const int kUserDataShift = 56;
+
+static uint64_t UserData(const uint64_t& type, const uint64_t& payload) {
+  return type << kUserDataShift | payload;
+}
+
+UringEventLoop::UringEventLoop(Server* const server, const int& id)
+    : EventLoop(server, id),
+      wake_fd_(eventfd(0, EFD_CLOEXEC)),
+      wake_value_(0),
+      is_sleeping_(false),
+      timer_deadline_(Clock::time_point::max()) {}
+
+UringEventLoop::~UringEventLoop() { close(wake_fd_); }
+
+bool UringEventLoop::Supported() {
+  // multishot recv needs Linux 6.0
+  utsname name;
+  if (uname(&name)) return false;
+  int major = 0, minor = 0;
+  if (sscanf(name.release, "%d.%d", &major, &minor) != 2 || major < 6)
+    return false;
+  IoUring ring;
+  return ring.Init(8) &&
+         ring.Supports({IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                        IORING_OP_CLOSE, IORING_OP_ASYNC_CANCEL,
+                        IORING_OP_READ, IORING_OP_POLL_ADD,
+                        IORING_OP_TIMEOUT}) &&
+         ring.RegisterBufferRing(kBufferGroup, 8, 64);
+}
+
+bool UringEventLoop::Accept(const int& sockfd) {
+  listen_fds_.push_back(sockfd);
+  return true;
+}
+
+void UringEventLoop::StopAccepting() { Submit({CANCEL, -1, nullptr}); }
+
+bool UringEventLoop::Add(const int& fd) {
+  Submit({RECV, fd, nullptr});
+  return true;
+}
+
+ssize_t UringEventLoop::Recv(const int& fd, void* buffer, const size_t& size) {
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  const auto connection = connections_.find(fd);
+  if (connection == connections_.end()) return 0;  // closed
+  const auto recv_cnt =
+      connection->second.input.Read(static_cast<char*>(buffer), size);
+  if (!recv_cnt) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return recv_cnt;
+}
+
+ssize_t UringEventLoop::Recv(const int& fd, BufferChain& input) {
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  const auto connection = connections_.find(fd);
+  if (connection == connections_.end()) return 0;  // closed
+  const auto recv_cnt = connection->second.input.size();
+  if (!recv_cnt) {
+    errno = EAGAIN;
+    return -1;
+  }
+  input.Append(connection->second.input);  // hands the slabs over
+  return recv_cnt;
+}
+
+bool UringEventLoop::Send(const int& fd,
+                          const std::shared_ptr<const std::string>& data,
+                          const bool& close_after) {
+  server_->capture_.OnResponded(fd);
+  auto send = std::make_unique<SendOp>();
+  send->fd = fd;
+  send->data = data;
+  send->offset = 0;
+  send->close_after = close_after;
+  Submit({SEND, fd, std::move(send)});
+  return true;
+}
+
+void UringEventLoop::Close(const int& fd) { Submit({CLOSE, fd, nullptr}); }
+
+void UringEventLoop::ResumeWhenReady(const int& fd, Waiter* const waiter) {
+  Submit({POLL, fd, nullptr, waiter});
+}
+
+void UringEventLoop::Submit(PendingOp&& op) {
+  if (IsInLoopThread()) {
+    Prepare(std::move(op));
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back(std::move(op));
+  }
+  Wake();
+}
+
+void UringEventLoop::Wake() {
+  if (!is_sleeping_) return;  // only wake the loop up if it's waiting
+  const uint64_t value = 1;
+  if (write(wake_fd_, &value, sizeof(value)) < 0) {
+    std::stringstream ss;
+    ss << "Event loop " << id_ << " wake up failed, errno: " << errno;
+    server_->logger.Error(ss.str());
+  }
+}
+
+void UringEventLoop::Prepare(PendingOp&& op) {
+  switch (op.type) {
+    case RECV: {
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.try_emplace(op.fd, buffer_pool_);
+      }
+      PrepareRecv(op.fd);
+      break;
+    }
+    case SEND: {
+      if (op.send->close_after) {
+        // stop receiving, send, then close, all in one submission
+        PrepareCancel(op.fd, IOSQE_IO_HARDLINK);
+        PrepareSend(std::move(op.send), IOSQE_IO_HARDLINK);
+        PrepareClose(op.fd);
+      } else {
+        PrepareSend(std::move(op.send), 0);
+      }
+      break;
+    }
+    case CLOSE: {
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (!connections_.count(op.fd)) break;  // closed already
+      }
+      PrepareCancel(op.fd, IOSQE_IO_HARDLINK);
+      PrepareClose(op.fd);
+      break;
+    }
+    case POLL: {
+      PreparePoll(op.fd, op.waiter);
+      break;
+    }
+    case CANCEL: {  // stop accepting
+      for (const auto& listen_fd : listen_fds_) PrepareCancel(listen_fd, 0);
+      listen_fds_.clear();
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void UringEventLoop::PrepareAccept(const int& listen_fd) {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) return;
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = UserData(ACCEPT, listen_fd);
+}
+
+void UringEventLoop::PrepareRecv(const int& fd) {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[fd]
+       << "] recv can't be submitted, submission queue full";
+    server_->logger.Error(ss.str());
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = UserData(RECV, fd);
+}
+
+void UringEventLoop::PrepareSend(std::unique_ptr<SendOp>&& send,
+                                 const uint8_t& flags) {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) {
+    std::stringstream ss;
+    ss << '[' << server_->client_addrs_[send->fd]
+       << "] send can't be submitted, submission queue full";
+    server_->logger.Error(ss.str());
+    return;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = send->fd;
+  sqe->addr = reinterpret_cast<uint64_t>(send->data->data() + send->offset);
+  sqe->len = send->data->size() - send->offset;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->flags = flags;
+  // owned by the completion from now on
+  sqe->user_data = UserData(SEND, reinterpret_cast<uint64_t>(send.release()));
+}
+
+void UringEventLoop::PrepareCancel(const int& fd, const uint8_t& flags) {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->flags = flags;
+  sqe->user_data = UserData(CANCEL, fd);
+}
+
+void UringEventLoop::PrepareClose(const int& fd) {
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    connections_.erase(fd);
+  }
+  router_->OnDisconnected(fd);
+  server_->OnDisconnected(fd);
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) {  // close it anyway
+    close(fd);
+    return;
+  }
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  sqe->user_data = UserData(CLOSE, fd);
+}
+
+void UringEventLoop::PrepareWake() {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) return;
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wake_fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&wake_value_);
+  sqe->len = sizeof(wake_value_);
+  sqe->user_data = UserData(WAKE, wake_fd_);
+}
+
+void UringEventLoop::PreparePoll(const int& fd, Waiter* const waiter) {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) {  // can't be watched
+    waiter->events = EPOLLERR;
+    Resume(waiter->handle);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = waiter->events;
+  sqe->user_data = UserData(POLL, reinterpret_cast<uint64_t>(waiter));
+}
+
+void UringEventLoop::PrepareTimer(const Clock::time_point& deadline) {
+  if (deadline >= timer_deadline_) return;  // a timeout completes before
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) return;
+  // steady_clock is CLOCK_MONOTONIC, the clock of absolute timeouts
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      deadline.time_since_epoch())
+                      .count();
+  timer_spec_.tv_sec = ns / 1000000000;
+  timer_spec_.tv_nsec = ns % 1000000000;
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = reinterpret_cast<uint64_t>(&timer_spec_);
+  sqe->len = 1;
+  sqe->timeout_flags = IORING_TIMEOUT_ABS;
+  sqe->user_data = UserData(TIMER, 0);
+  timer_deadline_ = deadline;
+}
+
+void UringEventLoop::Complete(const io_uring_cqe& cqe) {
+  const auto type = cqe.user_data >> kUserDataShift;
+  const uint64_t payload =
+      cqe.user_data & ((uint64_t(1) << kUserDataShift) - 1);
+  const bool has_more = cqe.flags & IORING_CQE_F_MORE;
+  switch (type) {
+    case ACCEPT: {
+      if (cqe.res >= 0) {
+        const int comfd = cqe.res;
+        sockaddr_storage client_addr;
+        socklen_t addr_size = sizeof(client_addr);
+        memset(&client_addr, 0, sizeof(client_addr));
+        getpeername(comfd, reinterpret_cast<sockaddr*>(&client_addr),
+                    &addr_size);
+        server_->OnConnected(comfd, client_addr, addr_size);
+        Prepare({RECV, comfd, nullptr});
+      } else if (cqe.res != -ECANCELED) {
+        std::stringstream ss;
+        ss << "accept() failed! errno: " << -cqe.res;
+        server_->logger.Error(ss.str());
+      }
+      const int listen_fd = static_cast<int>(payload);
+      if (!has_more && std::find(listen_fds_.begin(), listen_fds_.end(),
+                                 listen_fd) != listen_fds_.end())
+        PrepareAccept(listen_fd);
+      break;
+    }
+    case RECV: {
+      const int fd = static_cast<int>(payload);
+      if (cqe.res > 0) {
+        const uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        bool is_new_data = false;
+        {
+          std::lock_guard<std::mutex> lock(connections_mutex_);
+          const auto connection = connections_.find(fd);
+          if (connection != connections_.end()) {
+            auto& input = connection->second.input;
+            is_new_data = input.empty();
+            input.Append(ring_.Buffer(kBufferGroup, buffer_id), cqe.res);
+          }
+        }
+        server_->capture_.OnReceived(fd, ring_.Buffer(kBufferGroup, buffer_id),
+                                     cqe.res);
+        ring_.RecycleBuffer(kBufferGroup, buffer_id);
+        // like edge-triggered epoll, only wake a worker up when the input
+        // becomes non-empty
+        if (is_new_data) router_->push(fd);
+        if (!has_more) PrepareRecv(fd);
+      } else if (cqe.res == -ENOBUFS) {  // out of buffers, try again
+        PrepareRecv(fd);
+      } else if (cqe.res != -ECANCELED) {  // disconnected or error
+        std::stringstream ss;
+        ss << server_->client_addrs_[fd] << " disconnected";
+        server_->logger.Info(ss.str());
+        Prepare({CLOSE, fd, nullptr});
+      }
+      break;
+    }
+    case SEND: {
+      std::unique_ptr<SendOp> send(reinterpret_cast<SendOp*>(payload));
+      if (cqe.res < 0) {
+        if (cqe.res != -ECANCELED) {
+          std::stringstream ss;
+          ss << '[' << server_->client_addrs_[send->fd]
+             << "] send() failed, errno: " << -cqe.res;
+          server_->logger.Error(ss.str());
+        }
+      } else if (send->offset + cqe.res < send->data->size() &&
+                 !send->close_after) {  // short send, send the rest
+        send->offset += cqe.res;
+        PrepareSend(std::move(send), 0);
+      }
+      break;
+    }
+    case WAKE: {
+      PrepareWake();
+      break;
+    }
+    case POLL: {
+      auto waiter = reinterpret_cast<Waiter*>(payload);
+      waiter->events = cqe.res < 0 ? static_cast<uint32_t>(EPOLLERR) : cqe.res;
+      waiter->handle.resume();
+      break;
+    }
+    case TIMER: {  // the expired timers run before the next wait
+      timer_deadline_ = Clock::time_point::max();
+      break;
+    }
+    default:  // CLOSE and CANCEL need no handling
+      break;
+  }
+}
+
+void UringEventLoop::Run() {
+  if (!ring_.Init(kEntries) ||
+      !ring_.RegisterBufferRing(kBufferGroup, kBufferNum, kBufferSize)) {
+    std::stringstream ss;
+    ss << "Event loop " << id_ << " io_uring setup failed! errno: " << errno;
+    server_->logger.Fatal(ss.str());
+    exit(-1);
+  }
+  PrepareWake();
+  for (const auto& listen_fd : listen_fds_) PrepareAccept(listen_fd);
+
+  Tracer& tracer = server_->tracer;
+  std::vector<PendingOp> pending;
+  for (;;) {
+    const bool is_traced = tracer.Sample();
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending.swap(pending_);
+    }
+    for (auto& op : pending) Prepare(std::move(op));
+    pending.clear();
+    const auto next_timer = ResumeDue();
+    if (next_timer != Clock::time_point::max()) PrepareTimer(next_timer);
+
+    // announce the sleep before checking the queues for the last time, so
+    // that a worker either sees it and wakes us up or its op is seen here
+    is_sleeping_ = true;
+    bool has_pending;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      has_pending = !pending_.empty();
+    }
+    has_pending = has_pending || HasDue();
+    const auto wait_begin = is_traced ? Clock::now() : Clock::time_point();
+    const int ret = ring_.Submit(has_pending ? 0 : 1);
+    is_sleeping_ = false;
+    const auto woken = is_traced ? Clock::now() : Clock::time_point();
+    if (ret < 0 && ret != -EINTR && ret != -EBUSY) {
+      std::stringstream ss;
+      ss << "Event loop " << id_ << " io_uring_enter() failed, errno: " << -ret;
+      server_->logger.Error(ss.str());
+    }
+    int completion_num = 0;
+    ring_.ForEachCqe([this, &completion_num](const io_uring_cqe& cqe) {
+      Complete(cqe);
+      ++completion_num;
+    });
+    if (is_traced) {
+      const auto args = "\"completions\":" + std::to_string(completion_num);
+      tracer.Record("io_uring_enter", wait_begin, woken, std::string(args));
+      tracer.Record("dispatch", woken, Clock::now(), std::string(args));
+    }
+  }
+}
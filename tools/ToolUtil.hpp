@@ -0,0 +1,94 @@
+#pragma once
+
+#include <time.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "Metrics.hpp"
+
+// the framing of the response at the front of a buffer
+struct ResponseHead {
+  int status = 0;
+  size_t size = 0;  // the size of the whole response
+  bool is_closing = false;
+};
+
+/**
+ * @brief Parse the response at the front of a buffer
+ *
+ * @param input the buffer
+ * @param head the status and the size of the response
+ * @return 1 if the response is complete, 0 if more bytes are needed, -1 if it
+ * is malformed
+ */
+inline int ParseResponse(const std::string& input, ResponseHead& head) {
+  const auto header_end = input.find("\r\n\r\n");
+  if (header_end == std::string::npos) return 0;
+  if (sscanf(input.c_str(), "HTTP/1.%*d %d", &head.status) != 1) return -1;
+  size_t content_length = 0;
+  head.is_closing = false;
+  size_t line_begin = input.find("\r\n") + 2;
+  while (line_begin < header_end) {
+    const auto line_end = input.find("\r\n", line_begin);
+    const auto colon = input.find(':', line_begin);
+    if (colon != std::string::npos && colon < line_end) {
+      std::string name = input.substr(line_begin, colon - line_begin);
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      size_t value_begin = colon + 1;
+      while (value_begin < line_end && input[value_begin] == ' ')
+        value_begin++;
+      const auto value = input.substr(value_begin, line_end - value_begin);
+      try {
+        if (name == "content-length") content_length = std::stoull(value);
+      } catch (const std::exception&) {
+        return -1;
+      }
+      if (name == "connection" && value == "close") head.is_closing = true;
+    }
+    line_begin = line_end + 2;
+  }
+  head.size = header_end + 4 + content_length;
+  return input.size() >= head.size;
+}
+
+/**
+ * @brief Convert a duration to the timeout of epoll_pwait2()
+ *
+ * @param duration the duration (clamped to 0)
+ * @return the timeout
+ */
+inline timespec ToTimespec(std::chrono::nanoseconds duration) {
+  duration = std::max(duration, std::chrono::nanoseconds(0));
+  return {static_cast<time_t>(duration.count() / 1000000000),
+          static_cast<long>(duration.count() % 1000000000)};
+}
+
+/**
+ * @brief Print the percentiles of a latency histogram as a JSON member
+ *
+ * @param ss the output
+ * @param name the name of the member (suffixed with _us)
+ * @param histogram the histogram, in nanoseconds
+ */
+inline void PrintHistogram(std::stringstream& ss, const std::string& name,
+                           const Histogram& histogram) {
+  ss << ",\"" << name << "_us\":{";
+  const std::pair<const char*, double> percentiles[] = {
+      {"p50", 50},    {"p90", 90},      {"p99", 99},
+      {"p999", 99.9}, {"p9999", 99.99}, {"max", 100}};
+  bool is_first = true;
+  for (const auto& percentile : percentiles) {
+    if (!is_first) ss << ',';
+    is_first = false;
+    ss << '"' << percentile.first
+       << "\":" << histogram.Percentile(percentile.second) / 1e3;
+  }
+  const auto count = histogram.Count();
+  ss << ",\"mean\":" << (count ? histogram.Sum() / 1e3 / count : 0) << '}';
+}
@@ -0,0 +1,473 @@
+// An HTTP/1.1 load generator: keep-alive connections driven by epoll, with
+// optional pipelining and a constant request rate. Latencies are measured
+// from the time a request was scheduled, so that a stalled server is not
+// hidden by the generator waiting for it (coordinated omission).
+//
+//   ./build/HTTPSimple_load --port=8080 --scenario=mix --connections=64
+//       --rate=20000 --duration=10
+//
+// The summary is printed as one JSON object on stdout.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.hpp"
+#include "ToolUtil.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  uint16_t port = 8080;
+  std::string scenario = "index";
+  int connections = 64;
+  int threads = 1;
+  int pipeline = 1;
+  double rate = 0;  // requests per second over all connections, 0: closed loop
+  double duration = 10;
+  double warmup = 1;
+  size_t body_size = 64;
+};
+
+// a request of the mix and its weight
+struct RequestKind {
+  std::string name;
+  std::string bytes;
+  int weight;
+};
+
+/**
+ * @brief Build the request mix of a scenario
+ *
+ * @param options the options
+ * @return the requests and their weights, empty if the scenario is unknown
+ */
+static std::vector<RequestKind> Scenario(const Options& options) {
+  const std::string host = "Host: " + options.host + ':' +
+                           std::to_string(options.port) + "\r\n";
+  const RequestKind index = {"index", "GET / HTTP/1.1\r\n" + host + "\r\n", 1};
+  const RequestKind logo = {
+      "logo", "GET /img/logo.jpg HTTP/1.1\r\n" + host + "\r\n", 1};
+  std::string body = "login=3190104500&pass=4500";
+  if (options.body_size > body.size() + 5)
+    body += "&pad=" + std::string(options.body_size - body.size() - 5, 'a');
+  const RequestKind dopost = {
+      "dopost",
+      "POST /dopost HTTP/1.1\r\n" + host +
+          "Content-Type: application/x-www-form-urlencoded\r\n"
+          "Content-Length: " +
+          std::to_string(body.size()) + "\r\n\r\n" + body,
+      1};
+
+  if (options.scenario == "index") return {index};
+  if (options.scenario == "logo") return {logo};
+  if (options.scenario == "dopost") return {dopost};
+  if (options.scenario == "mix") {
+    auto mix = std::vector<RequestKind>{index, logo, dopost};
+    mix[0].weight = 70;
+    mix[1].weight = 20;
+    mix[2].weight = 10;
+    return mix;
+  }
+  return {};
+}
+
+// what every worker thread measures
+struct Stats {
+  Histogram latency;       // from the scheduled time to the response
+  Histogram service_time;  // from the time the request was written
+  uint64_t responses = 0;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;  // connection failures and lost requests
+  std::map<int, uint64_t> statuses;
+};
+
+class Worker {
+ public:
+  Worker(const Options& options, const std::vector<RequestKind>& kinds,
+         const int& connection_num, const int& id)
+      : options_(options),
+        kinds_(kinds),
+        connection_num_(connection_num),
+        random_(id),
+        epfd_(epoll_create1(EPOLL_CLOEXEC)) {
+    for (const auto& kind : kinds_) total_weight_ += kind.weight;
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(options_.port);
+    inet_pton(AF_INET, options_.host.c_str(), &addr_.sin_addr);
+  }
+
+  ~Worker() {
+    for (const auto& connection : connections_)
+      if (connection->fd >= 0) close(connection->fd);
+    close(epfd_);
+  }
+
+  /**
+   * @brief Run the load until end
+   *
+   * @param start when the load starts
+   * @param measure_from when the measurement starts (after the warm-up)
+   * @param end when the load stops
+   */
+  void Run(const Clock::time_point& start,
+           const Clock::time_point& measure_from,
+           const Clock::time_point& end) {
+    measure_from_ = measure_from;
+    // every connection sends at rate / connections, staggered
+    const double total_connections = options_.connections;
+    interval_ = options_.rate > 0
+                    ? std::chrono::nanoseconds(static_cast<int64_t>(
+                          total_connections * 1e9 / options_.rate))
+                    : std::chrono::nanoseconds(0);
+    for (int i = 0; i < connection_num_; i++) {
+      auto connection = std::make_unique<Connection>();
+      connection->index = i;
+      connection->next_send =
+          start + interval_ * i / std::max(connection_num_, 1);
+      connections_.push_back(std::move(connection));
+      Connect(*connections_.back());
+    }
+
+    epoll_event events[256];
+    for (;;) {
+      const auto now = Clock::now();
+      if (now >= end) break;
+      auto next_due = end;
+      for (const auto& connection : connections_) {
+        Schedule(*connection, now);
+        if (connection->fd < 0)  // retry connecting soon
+          next_due = std::min(next_due, now + std::chrono::milliseconds(10));
+        else if (interval_.count())
+          next_due = std::min(next_due, connection->next_send);
+      }
+      const timespec timeout = ToTimespec(next_due - Clock::now());
+      const int num_ready = epoll_pwait2(epfd_, events, 256, &timeout, nullptr);
+      for (int i = 0; i < num_ready; i++) {
+        auto& connection = *connections_[events[i].data.u32];
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+          Reconnect(connection, true);
+          continue;
+        }
+        if (events[i].events & EPOLLOUT) {
+          if (connection.is_connecting) connection.is_connecting = false;
+          Flush(connection);
+        }
+        if (events[i].events & EPOLLIN) Read(connection);
+      }
+    }
+  }
+
+  Stats stats;
+
+ private:
+  struct Pending {
+    Clock::time_point scheduled;
+    Clock::time_point written;
+  };
+
+  struct Connection {
+    uint32_t index;
+    int fd = -1;
+    bool is_connecting = false;
+    std::string output;
+    size_t output_offset = 0;
+    std::string input;
+    std::deque<Pending> in_flight;
+    Clock::time_point next_send;
+  };
+
+  void Connect(Connection& connection) {
+    connection.fd =
+        socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const int one = 1;
+    setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(connection.fd, reinterpret_cast<sockaddr*>(&addr_),
+                sizeof(addr_)) &&
+        errno != EINPROGRESS) {
+      ++stats.errors;
+      close(connection.fd);
+      connection.fd = -1;
+      return;
+    }
+    connection.is_connecting = true;
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.u32 = connection.index;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, connection.fd, &event);
+  }
+
+  /**
+   * @brief close a connection and open a new one
+   *
+   * @param connection the connection
+   * @param is_error whether the requests in flight are lost
+   */
+  void Reconnect(Connection& connection, const bool& is_error) {
+    if (connection.fd >= 0) close(connection.fd);
+    connection.fd = -1;
+    if (is_error || !connection.in_flight.empty())
+      stats.errors += std::max<size_t>(connection.in_flight.size(), 1);
+    connection.in_flight.clear();
+    connection.output.clear();
+    connection.output_offset = 0;
+    connection.input.clear();
+    Connect(connection);
+  }
+
+  /**
+   * @brief send the requests that are due
+   *
+   * @param connection the connection
+   * @param now the current time
+   */
+  void Schedule(Connection& connection, const Clock::time_point& now) {
+    if (connection.fd < 0) {
+      Connect(connection);
+      if (connection.fd < 0) return;
+    }
+    bool is_new = false;
+    while (static_cast<int>(connection.in_flight.size()) < options_.pipeline) {
+      Clock::time_point scheduled = now;
+      if (interval_.count()) {
+        // a request that couldn't be sent on time keeps its scheduled time
+        if (connection.next_send > now) break;
+        scheduled = connection.next_send;
+        connection.next_send += interval_;
+      }
+      connection.output += Pick().bytes;
+      connection.in_flight.push_back({scheduled, Clock::time_point()});
+      is_new = true;
+    }
+    if (is_new && !connection.is_connecting) Flush(connection);
+  }
+
+  const RequestKind& Pick() {
+    if (kinds_.size() == 1) return kinds_[0];
+    int value = std::uniform_int_distribution<int>(0, total_weight_ - 1)(
+        random_);
+    for (const auto& kind : kinds_) {
+      if (value < kind.weight) return kind;
+      value -= kind.weight;
+    }
+    return kinds_.back();
+  }
+
+  void Flush(Connection& connection) {
+    while (connection.output_offset < connection.output.size()) {
+      const auto ret =
+          send(connection.fd, connection.output.data() + connection.output_offset,
+               connection.output.size() - connection.output_offset,
+               MSG_NOSIGNAL);
+      if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        Reconnect(connection, true);
+        return;
+      }
+      connection.output_offset += ret;
+    }
+    const auto now = Clock::now();
+    for (auto& pending : connection.in_flight)
+      if (pending.written == Clock::time_point()) pending.written = now;
+    if (connection.output_offset == connection.output.size()) {
+      connection.output.clear();
+      connection.output_offset = 0;
+    }
+  }
+
+  void Read(Connection& connection) {
+    char buffer[65536];
+    for (;;) {
+      const auto ret = recv(connection.fd, buffer, sizeof(buffer), 0);
+      if (ret > 0) {
+        connection.input.append(buffer, ret);
+        continue;
+      }
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      Reconnect(connection, !connection.in_flight.empty());  // closed
+      return;
+    }
+    while (ParseResponse(connection)) {
+    }
+  }
+
+  /**
+   * @brief consume one complete response from the input
+   *
+   * @param connection the connection
+   * @return whether a response was consumed
+   */
+  bool ParseResponse(Connection& connection) {
+    auto& input = connection.input;
+    ResponseHead head;
+    const int ret = ::ParseResponse(input, head);
+    if (ret < 0) Reconnect(connection, true);
+    if (ret <= 0) return false;
+
+    const auto now = Clock::now();
+    if (!connection.in_flight.empty()) {
+      const auto pending = connection.in_flight.front();
+      connection.in_flight.pop_front();
+      if (pending.scheduled >= measure_from_) {
+        stats.latency.Record(now - pending.scheduled);
+        stats.service_time.Record(now - pending.written);
+        ++stats.responses;
+        stats.bytes += head.size;
+        ++stats.statuses[head.status];
+      }
+    }
+    input.erase(0, head.size);
+    if (head.is_closing) {
+      Reconnect(connection, false);
+      return false;
+    }
+    return true;
+  }
+
+  const Options& options_;
+  const std::vector<RequestKind>& kinds_;
+  const int connection_num_;
+  int total_weight_ = 0;
+  std::mt19937 random_;
+  const int epfd_;
+  sockaddr_in addr_;
+  std::chrono::nanoseconds interval_;
+  Clock::time_point measure_from_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+};
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    const auto equal = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || equal == std::string::npos) return false;
+    const auto name = arg.substr(2, equal - 2);
+    const auto value = arg.substr(equal + 1);
+    try {
+      if (name == "host")
+        options.host = value;
+      else if (name == "port")
+        options.port = static_cast<uint16_t>(std::stoi(value));
+      else if (name == "scenario")
+        options.scenario = value;
+      else if (name == "connections")
+        options.connections = std::stoi(value);
+      else if (name == "threads")
+        options.threads = std::stoi(value);
+      else if (name == "pipeline")
+        options.pipeline = std::stoi(value);
+      else if (name == "rate")
+        options.rate = std::stod(value);
+      else if (name == "duration")
+        options.duration = std::stod(value);
+      else if (name == "warmup")
+        options.warmup = std::stod(value);
+      else if (name == "body-size")
+        options.body_size = std::stoull(value);
+      else
+        return false;
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  return options.connections > 0 && options.threads > 0 &&
+         options.pipeline > 0 && options.duration > 0 &&
+         options.threads <= options.connections;
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--host=127.0.0.1] [--port=8080]"
+                 " [--scenario=index|logo|dopost|mix] [--connections=64]"
+                 " [--threads=1] [--pipeline=1] [--rate=<req/s, 0: as fast as"
+                 " possible>] [--duration=<s>] [--warmup=<s>]"
+                 " [--body-size=<bytes of the /dopost body>]"
+              << std::endl;
+    return 1;
+  }
+  const auto kinds = Scenario(options);
+  if (kinds.empty()) {
+    std::cerr << "Unknown scenario: " << options.scenario << std::endl;
+    return 1;
+  }
+
+  const auto start = Clock::now();
+  const auto measure_from =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(options.warmup));
+  const auto end = measure_from +
+                   std::chrono::duration_cast<Clock::duration>(
+                       std::chrono::duration<double>(options.duration));
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options.threads; i++) {
+    const int connection_num = options.connections / options.threads +
+                               (i < options.connections % options.threads);
+    workers.push_back(
+        std::make_unique<Worker>(options, kinds, connection_num, i));
+  }
+  for (auto& worker : workers)
+    threads.emplace_back([&worker, start, measure_from, end]() {
+      worker->Run(start, measure_from, end);
+    });
+  for (auto& thread : threads) thread.join();
+
+  Stats total;
+  for (const auto& worker : workers) {
+    total.latency.Merge(worker->stats.latency);
+    total.service_time.Merge(worker->stats.service_time);
+    total.responses += worker->stats.responses;
+    total.bytes += worker->stats.bytes;
+    total.errors += worker->stats.errors;
+    for (const auto& status : worker->stats.statuses)
+      total.statuses[status.first] += status.second;
+  }
+
+  std::stringstream ss;
+  ss << "{\"scenario\":\"" << options.scenario
+     << "\",\"connections\":" << options.connections
+     << ",\"threads\":" << options.threads
+     << ",\"pipeline\":" << options.pipeline
+     << ",\"target_rate\":" << options.rate
+     << ",\"duration\":" << options.duration
+     << ",\"responses\":" << total.responses
+     << ",\"errors\":" << total.errors
+     << ",\"rps\":" << total.responses / options.duration
+     << ",\"mb_per_sec\":" << total.bytes / options.duration / 1e6
+     << ",\"statuses\":{";
+  bool is_first = true;
+  for (const auto& status : total.statuses) {
+    if (!is_first) ss << ',';
+    is_first = false;
+    ss << '"' << status.first << "\":" << status.second;
+  }
+  ss << '}';
+  // corrected for coordinated omission when a rate is set
+  PrintHistogram(ss, "latency", total.latency);
+  PrintHistogram(ss, "service_time", total.service_time);
+  ss << '}';
+  std::cout << ss.str() << std::endl;
+  return 0;
+}
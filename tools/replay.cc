@@ -0,0 +1,439 @@
+// Replays a capture recorded by Server::SetCapture() against a server: every
+// captured connection is opened at its captured time, its bytes are sent as
+// they were received, and a chunk the client sent after the n-th response
+// waits for the n-th response, so that the pipelining of the clients is kept.
+// With --speed=N the times are divided by N, with --speed=0 only the
+// responses pace the connections.
+//
+//   ./build/HTTPSimple_replay --capture=traffic.cap --port=8080 --speed=2
+//
+// The summary is printed as one JSON object on stdout.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Capture.hpp"
+#include "Metrics.hpp"
+#include "ToolUtil.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string capture;
+  std::string host = "127.0.0.1";
+  uint16_t port = 8080;
+  double speed = 1;    // 0: as fast as the responses allow
+  double timeout = 10;  // after the last captured record, in seconds
+};
+
+// the bytes of one capture DATA record
+struct Chunk {
+  int64_t at_ns;  // since the recording started
+  std::string bytes;
+  uint64_t responses_before;  // the responses sent before it was received
+  Clock::time_point scheduled;
+  Clock::time_point written;
+};
+
+struct Connection {
+  uint32_t index;
+  int64_t open_ns = 0;
+  std::vector<Chunk> chunks;
+  // for every response, the last chunk received before it was sent (-1 if
+  // none)
+  std::vector<int64_t> response_chunks;
+
+  int fd = -1;
+  bool is_connecting = false;
+  bool is_done = false;
+  size_t next_chunk = 0;
+  std::string output;
+  size_t output_offset = 0;
+  std::string input;
+  uint64_t responses = 0;
+  Clock::time_point queued;  // when it is due to send the next chunk
+};
+
+struct Stats {
+  Histogram latency;       // from the scheduled time of the request
+  Histogram service_time;  // from the time the request was written
+  uint64_t responses = 0;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;  // failed connections and missing responses
+  std::map<int, uint64_t> statuses;
+};
+
+/**
+ * @brief Load the connections of a capture file
+ *
+ * @param path the path of the capture file
+ * @param connections the connections, in the order they were accepted
+ * @param last_ns the time of the last record
+ * @return whether the file is a capture file
+ */
+static bool LoadCapture(const std::string& path,
+                        std::vector<std::unique_ptr<Connection>>& connections,
+                        int64_t& last_ns) {
+  CaptureReader reader(path);
+  if (!reader.IsValid()) return false;
+  std::map<uint64_t, Connection*> by_id;
+  CaptureReader::Record record;
+  last_ns = 0;
+  while (reader.Next(record)) {
+    last_ns = record.timestamp_ns;
+    if (record.type == Capture::OPEN) {
+      connections.push_back(std::make_unique<Connection>());
+      auto& connection = *connections.back();
+      connection.index = connections.size() - 1;
+      connection.open_ns = record.timestamp_ns;
+      by_id[record.connection] = &connection;
+      continue;
+    }
+    const auto connection = by_id.find(record.connection);
+    if (connection == by_id.end()) continue;
+    auto& chunks = connection->second->chunks;
+    auto& response_chunks = connection->second->response_chunks;
+    switch (record.type) {
+      case Capture::DATA:
+        chunks.push_back({static_cast<int64_t>(record.timestamp_ns),
+                          std::move(record.data), response_chunks.size(),
+                          Clock::time_point(), Clock::time_point()});
+        break;
+      case Capture::RESPONSE:
+        response_chunks.push_back(static_cast<int64_t>(chunks.size()) - 1);
+        break;
+      default:  // CLOSE, the connection closes once it's replayed
+        by_id.erase(connection);
+        break;
+    }
+  }
+  return true;
+}
+
+class Replayer {
+ public:
+  Replayer(const Options& options,
+           std::vector<std::unique_ptr<Connection>>& connections)
+      : options_(options),
+        connections_(connections),
+        epfd_(epoll_create1(EPOLL_CLOEXEC)) {
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(options_.port);
+    inet_pton(AF_INET, options_.host.c_str(), &addr_.sin_addr);
+  }
+
+  ~Replayer() {
+    for (const auto& connection : connections_)
+      if (connection->fd >= 0) close(connection->fd);
+    close(epfd_);
+  }
+
+  /**
+   * @brief Replay the connections until they are all done or end
+   *
+   * @param end when to give up
+   */
+  void Run(const Clock::time_point& end) {
+    start_ = Clock::now();
+    for (const auto& connection : connections_)
+      due_.push({At(connection->open_ns), connection->index});
+    epoll_event events[256];
+    while (done_num_ < connections_.size()) {
+      const auto now = Clock::now();
+      if (now >= end) break;
+      while (!due_.empty() && due_.top().first <= now) {
+        auto& connection = *connections_[due_.top().second];
+        due_.pop();
+        if (connection.is_done) continue;
+        if (connection.fd < 0)
+          Connect(connection);
+        else
+          Advance(connection, now);
+      }
+      const auto next_due = due_.empty() ? end : std::min(end, due_.top().first);
+      const timespec timeout = ToTimespec(next_due - Clock::now());
+      const int num_ready = epoll_pwait2(epfd_, events, 256, &timeout, nullptr);
+      for (int i = 0; i < num_ready; i++) {
+        auto& connection = *connections_[events[i].data.u32];
+        if (connection.is_done) continue;
+        if (events[i].events & EPOLLIN) Read(connection);
+        if (!connection.is_done && (events[i].events & (EPOLLERR | EPOLLHUP)))
+          Finish(connection);
+        if (!connection.is_done && (events[i].events & EPOLLOUT)) {
+          connection.is_connecting = false;
+          Advance(connection, Clock::now());
+        }
+      }
+    }
+    for (const auto& connection : connections_)
+      if (!connection->is_done) Finish(*connection);
+    duration_ = Clock::now() - start_;
+  }
+
+  Stats stats;
+
+  /**
+   * @brief Get how long the replay took
+   *
+   * @return the duration
+   */
+  Clock::duration duration() const { return duration_; }
+
+ private:
+  /**
+   * @brief the replay time of a capture time
+   *
+   * @param ns the capture time
+   * @return the replay time (now if the speed is 0)
+   */
+  Clock::time_point At(const int64_t& ns) const {
+    if (options_.speed <= 0) return start_;
+    return start_ + std::chrono::nanoseconds(
+                        static_cast<int64_t>(ns / options_.speed));
+  }
+
+  void Connect(Connection& connection) {
+    connection.fd =
+        socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const int one = 1;
+    setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(connection.fd, reinterpret_cast<sockaddr*>(&addr_),
+                sizeof(addr_)) &&
+        errno != EINPROGRESS) {
+      Finish(connection);
+      return;
+    }
+    connection.is_connecting = true;
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u32 = connection.index;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, connection.fd, &event);
+  }
+
+  /**
+   * @brief send the chunks that are due and whose responses before them have
+   * arrived, close the connection once everything is answered
+   *
+   * @param connection the connection
+   * @param now the current time
+   */
+  void Advance(Connection& connection, const Clock::time_point& now) {
+    if (connection.is_connecting) return;
+    while (connection.next_chunk < connection.chunks.size()) {
+      auto& chunk = connection.chunks[connection.next_chunk];
+      if (connection.responses < chunk.responses_before) break;
+      // paced by the responses only, the chunk is scheduled when it's ready
+      chunk.scheduled = options_.speed > 0 ? At(chunk.at_ns) : now;
+      if (chunk.scheduled > now) {
+        if (connection.queued != chunk.scheduled) {
+          connection.queued = chunk.scheduled;
+          due_.push({chunk.scheduled, connection.index});
+        }
+        break;
+      }
+      connection.output += chunk.bytes;
+      connection.next_chunk++;
+    }
+    Flush(connection);
+    if (!connection.is_done &&
+        connection.next_chunk == connection.chunks.size() &&
+        connection.responses >= connection.response_chunks.size() &&
+        connection.output.empty())
+      Finish(connection);
+  }
+
+  void Flush(Connection& connection) {
+    const auto pending = connection.output.size() - connection.output_offset;
+    while (connection.output_offset < connection.output.size()) {
+      const auto ret = send(
+          connection.fd, connection.output.data() + connection.output_offset,
+          connection.output.size() - connection.output_offset, MSG_NOSIGNAL);
+      if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        Finish(connection);
+        return;
+      }
+      connection.output_offset += ret;
+    }
+    if (pending) {  // the chunks appended since the last flush are written
+      const auto now = Clock::now();
+      for (size_t i = connection.next_chunk; i-- > 0;) {
+        auto& chunk = connection.chunks[i];
+        if (chunk.written != Clock::time_point()) break;
+        chunk.written = now;
+      }
+    }
+    if (connection.output_offset == connection.output.size()) {
+      connection.output.clear();
+      connection.output_offset = 0;
+    }
+  }
+
+  void Read(Connection& connection) {
+    char buffer[65536];
+    bool is_closed = false;
+    for (;;) {
+      const auto ret = recv(connection.fd, buffer, sizeof(buffer), 0);
+      if (ret > 0) {
+        connection.input.append(buffer, ret);
+        continue;
+      }
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      is_closed = true;
+      break;
+    }
+    bool is_closing = false;
+    ResponseHead head;
+    int ret = 0;
+    while (!is_closing && (ret = ParseResponse(connection.input, head)) > 0) {
+      OnResponse(connection, head);
+      connection.input.erase(0, head.size);
+      is_closing = head.is_closing;
+    }
+    if (is_closed || is_closing || ret < 0)
+      Finish(connection);
+    else
+      Advance(connection, Clock::now());
+  }
+
+  void OnResponse(Connection& connection, const ResponseHead& head) {
+    const auto now = Clock::now();
+    const auto index = connection.responses++;
+    ++stats.responses;
+    stats.bytes += head.size;
+    ++stats.statuses[head.status];
+    if (index >= connection.response_chunks.size()) return;  // unexpected
+    const auto chunk = connection.response_chunks[index];
+    if (chunk < 0 || static_cast<size_t>(chunk) >= connection.next_chunk)
+      return;
+    stats.latency.Record(now - connection.chunks[chunk].scheduled);
+    stats.service_time.Record(now - connection.chunks[chunk].written);
+  }
+
+  /**
+   * @brief close a connection, counting the responses it misses
+   *
+   * @param connection the connection
+   */
+  void Finish(Connection& connection) {
+    if (connection.is_done) return;
+    connection.is_done = true;
+    ++done_num_;
+    if (connection.fd >= 0) close(connection.fd);
+    connection.fd = -1;
+    if (connection.responses < connection.response_chunks.size())
+      stats.errors += connection.response_chunks.size() - connection.responses;
+  }
+
+  using Due = std::pair<Clock::time_point, uint32_t>;
+
+  const Options& options_;
+  std::vector<std::unique_ptr<Connection>>& connections_;
+  const int epfd_;
+  sockaddr_in addr_;
+  Clock::time_point start_;
+  Clock::duration duration_;
+  size_t done_num_ = 0;
+  // when connections have to be opened or have chunks to send
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due_;
+};
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    const auto equal = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || equal == std::string::npos) return false;
+    const auto name = arg.substr(2, equal - 2);
+    const auto value = arg.substr(equal + 1);
+    try {
+      if (name == "capture")
+        options.capture = value;
+      else if (name == "host")
+        options.host = value;
+      else if (name == "port")
+        options.port = static_cast<uint16_t>(std::stoi(value));
+      else if (name == "speed")
+        options.speed = std::stod(value);
+      else if (name == "timeout")
+        options.timeout = std::stod(value);
+      else
+        return false;
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  return !options.capture.empty() && options.speed >= 0 &&
+         options.timeout > 0;
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " --capture=<file> [--host=127.0.0.1] [--port=8080]"
+                 " [--speed=<1: as captured, 0: as fast as possible>]"
+                 " [--timeout=<s after the last captured record>]"
+              << std::endl;
+    return 1;
+  }
+  std::vector<std::unique_ptr<Connection>> connections;
+  int64_t last_ns;
+  if (!LoadCapture(options.capture, connections, last_ns)) {
+    std::cerr << "Not a capture file: " << options.capture << std::endl;
+    return 1;
+  }
+  uint64_t expected = 0;
+  for (const auto& connection : connections)
+    expected += connection->response_chunks.size();
+
+  Replayer replayer(options, connections);
+  const auto captured = std::chrono::nanoseconds(
+      options.speed > 0 ? static_cast<int64_t>(last_ns / options.speed) : 0);
+  replayer.Run(Clock::now() + captured +
+               std::chrono::duration_cast<Clock::duration>(
+                   std::chrono::duration<double>(options.timeout)));
+
+  const auto& stats = replayer.stats;
+  const double seconds =
+      std::chrono::duration<double>(replayer.duration()).count();
+  std::stringstream ss;
+  ss << "{\"capture\":\"" << options.capture << "\",\"speed\":" << options.speed
+     << ",\"connections\":" << connections.size()
+     << ",\"captured_seconds\":" << last_ns / 1e9
+     << ",\"duration\":" << seconds
+     << ",\"expected_responses\":" << expected
+     << ",\"responses\":" << stats.responses << ",\"errors\":" << stats.errors
+     << ",\"rps\":" << stats.responses / seconds
+     << ",\"mb_per_sec\":" << stats.bytes / seconds / 1e6 << ",\"statuses\":{";
+  bool is_first = true;
+  for (const auto& status : stats.statuses) {
+    if (!is_first) ss << ',';
+    is_first = false;
+    ss << '"' << status.first << "\":" << status.second;
+  }
+  ss << '}';
+  PrintHistogram(ss, "latency", stats.latency);
+  PrintHistogram(ss, "service_time", stats.service_time);
+  ss << '}';
+  std::cout << ss.str() << std::endl;
+  return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Run the load scenarios against a freshly started example server, printing
+# one JSON summary per line.
+#
+#   ./tools/scenarios.sh [build dir] [port] > load.jsonl
+
+BUILD_DIR=${1:-./build}
+PORT=${2:-8080}
+DURATION=${DURATION:-10}
+
+"$BUILD_DIR/HTTPSimple" "$PORT" > /dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null' EXIT
+sleep 1
+
+run() {
+  "$BUILD_DIR/HTTPSimple_load" --port="$PORT" --duration="$DURATION" "$@"
+}
+
+run --scenario=index --connections=64
+run --scenario=index --connections=64 --rate=10000
+run --scenario=logo --connections=16
+run --scenario=dopost --connections=64 --pipeline=8
+run --scenario=mix --connections=64 --rate=5000